@@ -117,6 +117,50 @@ int cvar_next_value(void *cvar_handle, double *value)
 	return 0;
 }
 
+void *cvar_clone_handle(void *cvar_handle, unsigned long seed,
+		void *(*cvar_malloc)(size_t size), void (*cvar_free)(void *ptr))
+{
+	handle_t *h = (handle_t *) cvar_handle;
+	handle_t *clone;
+
+	if (!h) {
+		cvar_log_error("NULL cvar_handle");
+		return NULL;
+	}
+
+	clone = (handle_t *) cvar_malloc(sizeof(handle_t));
+	if (!clone) {
+		cvar_log_error("Out of memory");
+		return NULL;
+	}
+
+	*clone = *h;
+	mts_seed32new(&clone->state, (uint32_t) seed);
+
+	return clone;
+}
+
+int cvar_next_values(void *cvar_handle, double *values, int n)
+{
+	handle_t *h = (handle_t *) cvar_handle;
+	int i;
+
+	if (!h) {
+		cvar_log_error("NULL cvar_handle");
+		return -1;
+	}
+
+	if (!values) {
+		cvar_log_error("NULL values");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		values[i] = rds_erlang(&h->state, h->shape, h->rate);
+
+	return 0;
+}
+
 void cvar_free_handle(void *handle, void (*cvar_free)(void *ptr))
 {
 	cvar_free(handle);
@@ -29,6 +29,8 @@ typedef struct handle {
 	double mean;
 	double scaledmean;
 	double gamma;
+	int cloned;		/* clones draw from their own xi[] */
+	unsigned short xi[3];
 } handle_t;
 
 /******* Part from the original FB distribution ****************/
@@ -116,6 +118,16 @@ default_src(unsigned short *xi)
 	return (drand48());
 }
 
+/*
+ * fetch a uniformly distributed random number using the erand48 generator
+ * with private state xi
+ */
+static double
+erand_src(unsigned short *xi)
+{
+	return (erand48(xi));
+}
+
 /*
  * Sample the gamma distributed random variable with gamma 'a' and
  * result mulitplier 'b', which is usually mean/gamma. Uses the default
@@ -145,6 +157,20 @@ gamma_dist_knuth_src(double a, double b,
 	else
 		return (b * gamma_dist_knuth_algA(a, src, xi));
 }
+
+/*
+ * Original handles share the global drand48 state, cloned handles are
+ * used by one thread only and keep a private erand48 state.
+ */
+static double
+gamma_next(handle_t *h)
+{
+	if (h->cloned)
+		return gamma_dist_knuth_src(h->gamma, h->scaledmean,
+		    erand_src, h->xi);
+
+	return gamma_dist_knuth(h->gamma, h->scaledmean);
+}
 /*************************************************************/
 
 void *cvar_alloc_handle(const char *cvar_parameters,
@@ -188,6 +214,7 @@ void *cvar_alloc_handle(const char *cvar_parameters,
 	}
 
 	handle.scaledmean = handle.mean / handle.gamma;
+	handle.cloned = 0;
 
 	cvar_trace("mean = %lf, gamma = %lf", handle.mean, handle.gamma);
 
@@ -235,7 +262,54 @@ int cvar_next_value(void *cvar_handle, double *value)
 		return -1;
 	}
 
-	*value = gamma_dist_knuth(h->gamma, h->scaledmean);
+	*value = gamma_next(h);
+
+	return 0;
+}
+
+void *cvar_clone_handle(void *cvar_handle, unsigned long seed,
+		void *(*cvar_malloc)(size_t size), void (*cvar_free)(void *ptr))
+{
+	handle_t *h = (handle_t *) cvar_handle;
+	handle_t *clone;
+
+	if (!h) {
+		cvar_log_error("NULL cvar_handle");
+		return NULL;
+	}
+
+	clone = (handle_t *) cvar_malloc(sizeof(handle_t));
+	if (!clone) {
+		cvar_log_error("Out of memory");
+		return NULL;
+	}
+
+	*clone = *h;
+	clone->cloned = 1;
+	clone->xi[0] = 0x330E;
+	clone->xi[1] = (unsigned short) seed;
+	clone->xi[2] = (unsigned short) (seed >> 16);
+
+	return clone;
+}
+
+int cvar_next_values(void *cvar_handle, double *values, int n)
+{
+	handle_t *h = (handle_t *) cvar_handle;
+	int i;
+
+	if (!h) {
+		cvar_log_error("NULL cvar_handle");
+		return -1;
+	}
+
+	if (!values) {
+		cvar_log_error("NULL values");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		values[i] = gamma_next(h);
 
 	return 0;
 }
@@ -61,6 +61,35 @@ int cvar_revalidate_handle(void *cvar_handle);
 
 int cvar_next_value(void *cvar_handle, double *value);
 
+/*
+ * Allocate a copy of a handle whose state is independent of the original,
+ * with its random number generator seeded from argument seed. Filebench
+ * gives each thread its own clone, so that threads do not serialize on
+ * the original handle. A clone is only ever used by one thread, and is
+ * destroyed with cvar_free_handle.
+ *
+ * Implementation: Optional. Without it, all threads share the original
+ * handle under a lock.
+ *
+ * Return a non NULL handle on success and a NULL handle on error.
+ */
+
+void *cvar_clone_handle(void *cvar_handle, unsigned long seed,
+		void *(*cvar_malloc)(size_t size), void (*cvar_free)(void *ptr));
+
+/*
+ * Called when n new values of the custom variable are required, as if
+ * cvar_next_value was called n times.
+ *
+ * Implementation: Optional. Without it, cvar_next_value is called n times.
+ *
+ * Return 0 on success and non zero on error. On success, values[0] to
+ * values[n - 1] are initialized to the next values of the variable whose
+ * state is in handle.
+ */
+
+int cvar_next_values(void *cvar_handle, double *values, int n);
+
 /*
  * Called when an existing custom variable has to be destroyed. Use function
  * cvar_free to free up memory allocated for cvar_handle.
@@ -25,6 +25,27 @@ static int init_cvar_library_ops(cvar_library_t *c);
 /* Points to the head of an array of pointers to cvar_library_t. */
 cvar_library_t **cvar_libraries;
 
+/* Number of values drawn from a cloned handle at a time. */
+#define CVAR_BATCH_SIZE 64
+
+/* A thread's private clone of a custom variable handle. */
+typedef struct cvar_thread_handle {
+	void *clone; /* Handle returned by cvar_clone_handle(). */
+	cvar_library_t *cvar_lib;
+	int next; /* Next unused entry in values. */
+	double values[CVAR_BATCH_SIZE];
+} cvar_thread_handle_t;
+
+/* Per-thread table of cloned handles, indexed by cvar->index. */
+typedef struct cvar_thread_table {
+	int nhandles;
+	cvar_thread_handle_t **handles;
+} cvar_thread_table_t;
+
+static __thread cvar_thread_table_t *cvar_thread_table;
+static pthread_key_t cvar_thread_key;
+static pthread_once_t cvar_thread_once = PTHREAD_ONCE_INIT;
+
 /*
  * Allocate space for a new custom variable in the shared memory location.
  */
@@ -39,6 +60,8 @@ cvar_alloc(void)
 	}
 
 	/* place on the head of the global list */
+	cvar->index = filebench_shm->shm_cvar_list ?
+			filebench_shm->shm_cvar_list->index + 1 : 0;
 	cvar->next = filebench_shm->shm_cvar_list;
 	filebench_shm->shm_cvar_list = cvar;
 
@@ -342,6 +365,11 @@ init_cvar_library_ops(cvar_library_t *c)
 		goto out;
 	}
 
+	/* Optional. Without them all threads share the handle under a lock. */
+	c->cvar_op.cvar_clone_handle = dlsym(c->lib_handle, FB_CVAR_CLONE_HANDLE);
+
+	c->cvar_op.cvar_next_values = dlsym(c->lib_handle, FB_CVAR_NEXT_VALUES);
+
 	c->cvar_op.cvar_module_exit = dlsym(c->lib_handle, FB_CVAR_MODULE_EXIT);
 
 	c->cvar_op.cvar_usage = dlsym(c->lib_handle, FB_CVAR_USAGE);
@@ -372,6 +400,8 @@ init_cvar_handle(cvar_t *cvar, const char *type, const char *parameters)
 	}
 
 	cvar->cvar_lib_info = t;
+	if (parameters)
+		cvar->parameters = ipc_stralloc(parameters);
 
 	cvar_lib = cvar_libraries[cvar->cvar_lib_info->index];
 	cvar->cvar_handle = cvar_lib->cvar_op.cvar_alloc_handle(parameters,
@@ -385,17 +415,161 @@ out:
 	return ret;
 }
 
+/*
+ * Frees the cloned handles of an exiting thread.
+ */
+static void
+free_cvar_thread_table(void *arg)
+{
+	cvar_thread_table_t *table = (cvar_thread_table_t *) arg;
+	cvar_thread_handle_t *th;
+	int i;
+
+	for (i = 0; i < table->nhandles; i++) {
+		th = table->handles[i];
+		if (!th)
+			continue;
+		th->cvar_lib->cvar_op.cvar_free_handle(th->clone, free);
+		free(th);
+	}
+
+	free(table->handles);
+	free(table);
+}
+
+static void
+init_cvar_thread_key(void)
+{
+	(void) pthread_key_create(&cvar_thread_key, free_cvar_thread_table);
+}
+
+/*
+ * Returns the calling thread's clone of the custom variable, cloning it
+ * on first use. Returns NULL on failure.
+ */
+static cvar_thread_handle_t *
+get_cvar_thread_handle(cvar_t *cvar, cvar_library_t *cvar_lib)
+{
+	cvar_thread_table_t *table = cvar_thread_table;
+	cvar_thread_handle_t **handles;
+	cvar_thread_handle_t *th;
+	uint64_t seed;
+	int nhandles;
+
+	if (table && cvar->index < table->nhandles &&
+			(th = table->handles[cvar->index]) != NULL)
+		return th;
+
+	if (!table) {
+		(void) pthread_once(&cvar_thread_once, init_cvar_thread_key);
+
+		table = (cvar_thread_table_t *) calloc(1, sizeof(cvar_thread_table_t));
+		if (!table) {
+			filebench_log(LOG_ERROR, "Out of memory");
+			return NULL;
+		}
+
+		cvar_thread_table = table;
+		(void) pthread_setspecific(cvar_thread_key, table);
+	}
+
+	if (cvar->index >= table->nhandles) {
+		nhandles = cvar->index + 1;
+		handles = (cvar_thread_handle_t **) realloc(table->handles,
+				sizeof(cvar_thread_handle_t *) * nhandles);
+		if (!handles) {
+			filebench_log(LOG_ERROR, "Out of memory");
+			return NULL;
+		}
+
+		memset(handles + table->nhandles, 0,
+				sizeof(cvar_thread_handle_t *) * (nhandles - table->nhandles));
+		table->handles = handles;
+		table->nhandles = nhandles;
+	}
+
+	th = (cvar_thread_handle_t *) malloc(sizeof(cvar_thread_handle_t));
+	if (!th) {
+		filebench_log(LOG_ERROR, "Out of memory");
+		return NULL;
+	}
+
+	/* Seeding from the thread's generator keeps runs reproducible. */
+	fb_random64(&seed, UINT64_MAX, 0, NULL);
+
+	th->clone = cvar_lib->cvar_op.cvar_clone_handle(cvar->cvar_handle,
+			(unsigned long) seed, malloc, free);
+	if (!th->clone) {
+		filebench_log(LOG_ERROR, "Unable to clone custom variable of type %s",
+				cvar->cvar_lib_info->type);
+		free(th);
+		return NULL;
+	}
+
+	th->cvar_lib = cvar_lib;
+	th->next = CVAR_BATCH_SIZE;
+	table->handles[cvar->index] = th;
+
+	return th;
+}
+
+/*
+ * Draws the next value from the calling thread's clone of the custom
+ * variable, refilling the clone's batch of values when it runs out.
+ * Returns 0 on success and a non-zero error code on failure.
+ */
+static int
+next_cvar_thread_value(cvar_t *cvar, cvar_library_t *cvar_lib, double *value)
+{
+	cvar_thread_handle_t *th;
+	int ret = 0;
+	int i;
+
+	th = get_cvar_thread_handle(cvar, cvar_lib);
+	if (!th)
+		return -1;
+
+	if (th->next == CVAR_BATCH_SIZE) {
+		if (cvar_lib->cvar_op.cvar_next_values) {
+			ret = cvar_lib->cvar_op.cvar_next_values(th->clone, th->values,
+					CVAR_BATCH_SIZE);
+		} else {
+			for (i = 0; i < CVAR_BATCH_SIZE && !ret; i++)
+				ret = cvar_lib->cvar_op.cvar_next_value(th->clone,
+						&th->values[i]);
+		}
+
+		if (ret)
+			return ret;
+
+		th->next = 0;
+	}
+
+	*value = th->values[th->next++];
+
+	return 0;
+}
+
+/*
+ * Returns the next value of a custom variable. Libraries that can clone
+ * their handles are sampled through a private per-thread clone, without
+ * locking. Others are sampled through the shared handle under cvar_lock.
+ */
 double
 get_cvar_value(cvar_t *cvar)
 {
 	int ret;
 	double value = 0.0;
 	fbint_t round = cvar->round;
-
-	ipc_mutex_lock(&cvar->cvar_lock);
 	cvar_library_t *cvar_lib = cvar_libraries[cvar->cvar_lib_info->index];
-	ret = cvar_lib->cvar_op.cvar_next_value(cvar->cvar_handle, &value);
-	ipc_mutex_unlock(&cvar->cvar_lock);
+
+	if (cvar_lib->cvar_op.cvar_clone_handle) {
+		ret = next_cvar_thread_value(cvar, cvar_lib, &value);
+	} else {
+		ipc_mutex_lock(&cvar->cvar_lock);
+		ret = cvar_lib->cvar_op.cvar_next_value(cvar->cvar_handle, &value);
+		ipc_mutex_unlock(&cvar->cvar_lock);
+	}
 
 	if (ret) {
 		filebench_log(LOG_ERROR, "Unable to get next_value from custom variable"
@@ -18,6 +18,8 @@
 #define FB_CVAR_REVALIDATE_HANDLE	"cvar_revalidate_handle"
 #define FB_CVAR_NEXT_VALUE			"cvar_next_value"
 #define FB_CVAR_FREE_HANDLE			"cvar_free_handle"
+#define FB_CVAR_CLONE_HANDLE		"cvar_clone_handle"
+#define FB_CVAR_NEXT_VALUES			"cvar_next_values"
 #define FB_CVAR_MODULE_EXIT			"cvar_module_exit"
 #define FB_CVAR_USAGE				"cvar_usage"
 #define FB_CVAR_VERSION				"cvar_version"
@@ -47,6 +49,11 @@ typedef struct cvar {
 	double max;
 	uint64_t round;
 	cvar_library_info_t *cvar_lib_info;
+	/* The parameters the handle was allocated with, or NULL. */
+	char *parameters;
+	/* Sequentially increasing count. It helps seek within the per-thread
+	 * table of cloned handles. */
+	int index;
 	struct cvar *next;
 } cvar_t;
 
@@ -59,6 +66,9 @@ typedef struct cvar_operations {
 	int (*cvar_revalidate_handle)(void *cvar_handle);
 	int (*cvar_next_value)(void *cvar_handle, double *value);
 	void (*cvar_free_handle)(void *cvar_handle, void (*cvar_free)(void *ptr));
+	void *(*cvar_clone_handle)(void *cvar_handle, unsigned long seed,
+			void *(*cvar_malloc)(size_t size), void (*cvar_free)(void *ptr));
+	int (*cvar_next_values)(void *cvar_handle, double *values, int n);
 	void (*cvar_module_exit)();
 	const char *(*cvar_usage)(void);
 	const char *(*cvar_version)(void);
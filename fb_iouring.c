@@ -0,0 +1,661 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include "config.h"
+#include "filebench.h"
+#include "flowop.h"
+#include "threadflow.h"
+#include "fsplug.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * The io_uring file system plug-in. It accesses local files exactly like
+ * the local file system plug-in does, so the synchronous part of its
+ * functions vector is a copy of the local one. In addition it provides
+ * the uringread, uringwrite and uringwait flowops, which submit I/O
+ * through a per-threadflow io_uring submission queue. A single thread
+ * can therefore keep up to "iodepth" (a thread attribute) I/Os in flight
+ * without paying a system call and a context switch for each of them.
+ *
+ * The ring is set up on the first uring flowop executed by a thread.
+ * The thread's private memory (tf_mem) is registered with the kernel
+ * as a fixed buffer, and the thread's tf_fd[] table is mirrored into
+ * a registered file table, so the kernel does not need to take file and
+ * page references on every request. Closefile drops the entry from the
+ * table again. If either registration fails (e.g., because of
+ * RLIMIT_MEMLOCK) the ring is still used, just without it.
+ *
+ * Every submitted I/O occupies one slot of the ring's slot array. The
+ * slot index travels to the kernel as the request's user_data, so the
+ * completion is matched to its submission in O(1), and the flowop's
+ * latency is measured from submission to completion.
+ */
+
+#define	FB_URING_DEFDEPTH	32
+#define	FB_URING_MAXDEPTH	4096
+
+typedef struct fb_uring_slot {
+	flowop_t	*us_flowop;	/* Flowop that issued the I/O */
+	hrtime_t	us_stime;	/* Submission time */
+	struct iovec	us_iov;		/* Buffer for non-fixed I/O */
+	int		us_next;	/* Next free slot */
+} fb_uring_slot_t;
+
+typedef struct fb_uring {
+	int		ur_fd;		/* Ring file descriptor */
+	uint_t		ur_depth;	/* Maximum I/Os in flight */
+	uint_t		ur_inflight;	/* I/Os currently in flight */
+	int		ur_freeslot;	/* Head of the free slot list */
+	fb_uring_slot_t	*ur_slots;	/* Per-I/O slot array */
+
+	/* Submission queue */
+	void		*ur_sq_ptr;
+	size_t		ur_sq_size;
+	uint32_t	*ur_sq_head;
+	uint32_t	*ur_sq_tail;
+	uint32_t	*ur_sq_mask;
+	uint32_t	*ur_sq_array;
+	struct io_uring_sqe *ur_sqes;
+	size_t		ur_sqes_size;
+
+	/* Completion queue */
+	void		*ur_cq_ptr;
+	size_t		ur_cq_size;
+	uint32_t	*ur_cq_head;
+	uint32_t	*ur_cq_tail;
+	uint32_t	*ur_cq_mask;
+	struct io_uring_cqe *ur_cqes;
+
+	/* Registered buffer and file table */
+	caddr_t		ur_bufbase;
+	size_t		ur_buflen;
+	int		ur_regfiles;
+	int		ur_regfd[THREADFLOW_MAXFD + 1];
+	filesetentry_t	*ur_regfse[THREADFLOW_MAXFD + 1];
+
+	/* Next offset per tf_fd[] entry for sequential I/O */
+	off64_t		ur_seqoff[THREADFLOW_MAXFD + 1];
+} fb_uring_t;
+
+static int fb_uringflow_read(threadflow_t *threadflow, flowop_t *flowop);
+static int fb_uringflow_write(threadflow_t *threadflow, flowop_t *flowop);
+static int fb_uringflow_wait(threadflow_t *threadflow, flowop_t *flowop);
+static void fb_uringflow_destruct(flowop_t *flowop);
+
+static flowop_proto_t fb_uringflow_funcs[] = {
+	{FLOW_TYPE_AIO, FLOW_ATTR_READ, "uringread", flowop_init_generic,
+	fb_uringflow_read, fb_uringflow_destruct},
+	{FLOW_TYPE_AIO, FLOW_ATTR_WRITE, "uringwrite", flowop_init_generic,
+	fb_uringflow_write, fb_uringflow_destruct},
+	{FLOW_TYPE_AIO, 0, "uringwait", flowop_init_generic,
+	fb_uringflow_wait, fb_uringflow_destruct}
+};
+
+static fsplug_func_t fb_uring_funcs;
+
+/*
+ * Initialize file system functions vector. All synchronous operations
+ * are inherited from the local file system plug-in.
+ */
+void
+fb_uring_funcvecinit(void)
+{
+	fb_lfs_funcvecinit();
+	fb_uring_funcs = *fs_functions_vec;
+	(void) strcpy(fb_uring_funcs.fs_name, "iouring");
+	fs_functions_vec = &fb_uring_funcs;
+}
+
+/*
+ * Adds the io_uring flowops. It is called only once in the master process.
+ */
+void
+fb_uring_newflowops(void)
+{
+	int nops;
+
+	nops = sizeof (fb_uringflow_funcs) / sizeof (flowop_proto_t);
+	flowop_add_from_proto(fb_uringflow_funcs, nops);
+}
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+	return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, NULL, 0));
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/*
+ * Unmaps and closes the ring, and frees its bookkeeping.
+ */
+static void
+fb_uring_free(fb_uring_t *ring)
+{
+	if (ring->ur_sqes)
+		(void) munmap(ring->ur_sqes, ring->ur_sqes_size);
+	if (ring->ur_cq_ptr && ring->ur_cq_ptr != ring->ur_sq_ptr)
+		(void) munmap(ring->ur_cq_ptr, ring->ur_cq_size);
+	if (ring->ur_sq_ptr)
+		(void) munmap(ring->ur_sq_ptr, ring->ur_sq_size);
+	if (ring->ur_fd >= 0)
+		(void) close(ring->ur_fd);
+	free(ring->ur_slots);
+	free(ring);
+}
+
+/*
+ * Registers the thread's private memory as fixed buffer and an empty
+ * file table of THREADFLOW_MAXFD + 1 entries. Failures are not fatal.
+ */
+static void
+fb_uring_register(threadflow_t *threadflow, fb_uring_t *ring)
+{
+	struct iovec iov;
+	int fds[THREADFLOW_MAXFD + 1];
+	int i;
+
+	if (threadflow->tf_mem && threadflow->tf_constmemsize) {
+		iov.iov_base = threadflow->tf_mem;
+		iov.iov_len = (size_t)threadflow->tf_constmemsize;
+		if (io_uring_register(ring->ur_fd, IORING_REGISTER_BUFFERS,
+		    &iov, 1) == 0) {
+			ring->ur_bufbase = threadflow->tf_mem;
+			ring->ur_buflen = iov.iov_len;
+		} else {
+			filebench_log(LOG_DEBUG_IMPL,
+			    "thread %s: io_uring buffer registration "
+			    "failed: %s", threadflow->tf_name,
+			    strerror(errno));
+		}
+	}
+
+	for (i = 0; i <= THREADFLOW_MAXFD; i++) {
+		fds[i] = -1;
+		ring->ur_regfd[i] = -1;
+	}
+
+	if (io_uring_register(ring->ur_fd, IORING_REGISTER_FILES,
+	    fds, THREADFLOW_MAXFD + 1) == 0) {
+		ring->ur_regfiles = 1;
+	} else {
+		filebench_log(LOG_DEBUG_IMPL,
+		    "thread %s: io_uring file registration failed: %s",
+		    threadflow->tf_name, strerror(errno));
+	}
+}
+
+/*
+ * Creates the threadflow's ring with tf_iodepth entries, or
+ * FB_URING_DEFDEPTH if the thread has no iodepth, and maps its
+ * submission and completion queues. Returns NULL on failure.
+ */
+static fb_uring_t *
+fb_uring_create(threadflow_t *threadflow)
+{
+	struct io_uring_params p;
+	fb_uring_t *ring;
+	fbint_t depth;
+	int i;
+
+	depth = FB_URING_DEFDEPTH;
+	if (threadflow->tf_iodepth)
+		depth = avd_get_int(threadflow->tf_iodepth);
+	if (depth == 0 || depth > FB_URING_MAXDEPTH) {
+		filebench_log(LOG_ERROR, "thread %s: iodepth %llu is out of "
+		    "range (1..%d)", threadflow->tf_name,
+		    (u_longlong_t)depth, FB_URING_MAXDEPTH);
+		return (NULL);
+	}
+
+	if ((ring = malloc(sizeof (fb_uring_t))) == NULL) {
+		filebench_log(LOG_ERROR, "malloc io_uring failed");
+		return (NULL);
+	}
+	(void) memset(ring, 0, sizeof (fb_uring_t));
+	ring->ur_depth = (uint_t)depth;
+
+	if ((ring->ur_slots = calloc(depth,
+	    sizeof (fb_uring_slot_t))) == NULL) {
+		filebench_log(LOG_ERROR, "malloc io_uring slots failed");
+		free(ring);
+		return (NULL);
+	}
+	for (i = 0; i < depth; i++)
+		ring->ur_slots[i].us_next = i + 1;
+	ring->ur_slots[depth - 1].us_next = -1;
+	ring->ur_freeslot = 0;
+
+	(void) memset(&p, 0, sizeof (p));
+	if ((ring->ur_fd = io_uring_setup((unsigned)depth, &p)) < 0) {
+		filebench_log(LOG_ERROR, "io_uring_setup failed: %s",
+		    strerror(errno));
+		fb_uring_free(ring);
+		return (NULL);
+	}
+
+	ring->ur_sq_size = p.sq_off.array + p.sq_entries * sizeof (uint32_t);
+	ring->ur_cq_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof (struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->ur_sq_size = ring->ur_cq_size =
+		    MAX(ring->ur_sq_size, ring->ur_cq_size);
+
+	ring->ur_sq_ptr = mmap(NULL, ring->ur_sq_size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    ring->ur_fd, IORING_OFF_SQ_RING);
+	if (ring->ur_sq_ptr == MAP_FAILED) {
+		ring->ur_sq_ptr = NULL;
+		goto mmap_failed;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->ur_cq_ptr = ring->ur_sq_ptr;
+	} else {
+		ring->ur_cq_ptr = mmap(NULL, ring->ur_cq_size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring->ur_fd, IORING_OFF_CQ_RING);
+		if (ring->ur_cq_ptr == MAP_FAILED) {
+			ring->ur_cq_ptr = NULL;
+			goto mmap_failed;
+		}
+	}
+
+	ring->ur_sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+	ring->ur_sqes = mmap(NULL, ring->ur_sqes_size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    ring->ur_fd, IORING_OFF_SQES);
+	if (ring->ur_sqes == MAP_FAILED) {
+		ring->ur_sqes = NULL;
+		goto mmap_failed;
+	}
+
+	ring->ur_sq_head = (uint32_t *)((char *)ring->ur_sq_ptr +
+	    p.sq_off.head);
+	ring->ur_sq_tail = (uint32_t *)((char *)ring->ur_sq_ptr +
+	    p.sq_off.tail);
+	ring->ur_sq_mask = (uint32_t *)((char *)ring->ur_sq_ptr +
+	    p.sq_off.ring_mask);
+	ring->ur_sq_array = (uint32_t *)((char *)ring->ur_sq_ptr +
+	    p.sq_off.array);
+	ring->ur_cq_head = (uint32_t *)((char *)ring->ur_cq_ptr +
+	    p.cq_off.head);
+	ring->ur_cq_tail = (uint32_t *)((char *)ring->ur_cq_ptr +
+	    p.cq_off.tail);
+	ring->ur_cq_mask = (uint32_t *)((char *)ring->ur_cq_ptr +
+	    p.cq_off.ring_mask);
+	ring->ur_cqes = (struct io_uring_cqe *)((char *)ring->ur_cq_ptr +
+	    p.cq_off.cqes);
+
+	fb_uring_register(threadflow, ring);
+
+	filebench_log(LOG_DEBUG_SCRIPT, "thread %s: io_uring with depth %u, "
+	    "fixed buffer %s, fixed files %s", threadflow->tf_name,
+	    ring->ur_depth, ring->ur_bufbase ? "yes" : "no",
+	    ring->ur_regfiles ? "yes" : "no");
+
+	return (ring);
+
+mmap_failed:
+	filebench_log(LOG_ERROR, "io_uring mmap failed: %s", strerror(errno));
+	fb_uring_free(ring);
+	return (NULL);
+}
+
+/*
+ * Returns the index of the fd in the registered file table, updating the
+ * table if the tf_fd[] entry was reopened since it was last registered.
+ * Returns -1 if the plain file descriptor has to be used instead.
+ */
+static int
+fb_uring_fileindex(threadflow_t *threadflow, fb_uring_t *ring,
+    fb_fdesc_t *fdesc)
+{
+	struct io_uring_files_update up;
+	int idx = fdesc - threadflow->tf_fd;
+
+	if (!ring->ur_regfiles || idx < 0 || idx > THREADFLOW_MAXFD)
+		return (-1);
+
+	if (ring->ur_regfd[idx] == fdesc->fd_num &&
+	    ring->ur_regfse[idx] == threadflow->tf_fse[idx])
+		return (idx);
+
+	(void) memset(&up, 0, sizeof (up));
+	up.offset = idx;
+	up.fds = (uint64_t)(uintptr_t)&fdesc->fd_num;
+	if (io_uring_register(ring->ur_fd, IORING_REGISTER_FILES_UPDATE,
+	    &up, 1) != 1) {
+		filebench_log(LOG_DEBUG_IMPL, "io_uring file update "
+		    "failed: %s", strerror(errno));
+		ring->ur_regfd[idx] = -1;
+		return (-1);
+	}
+
+	ring->ur_regfd[idx] = fdesc->fd_num;
+	ring->ur_regfse[idx] = threadflow->tf_fse[idx];
+
+	return (idx);
+}
+
+/*
+ * Called by closefile before the tf_fd[fd] entry is closed. Drops the
+ * entry from the registered file table, which holds its own reference
+ * to the file, so that the file is really closed and a later open that
+ * gets the same descriptor number is registered anew. Also restarts
+ * sequential I/O on the entry at offset 0.
+ */
+void
+fb_uring_closefd(threadflow_t *threadflow, int fd)
+{
+	struct io_uring_files_update up;
+	fb_uring_t *ring = threadflow->tf_uring;
+	int none = -1;
+
+	if (ring == NULL || fd < 0 || fd > THREADFLOW_MAXFD)
+		return;
+
+	ring->ur_seqoff[fd] = 0;
+
+	if (ring->ur_regfd[fd] == -1)
+		return;
+
+	(void) memset(&up, 0, sizeof (up));
+	up.offset = fd;
+	up.fds = (uint64_t)(uintptr_t)&none;
+	if (io_uring_register(ring->ur_fd, IORING_REGISTER_FILES_UPDATE,
+	    &up, 1) != 1)
+		filebench_log(LOG_DEBUG_IMPL, "io_uring file update "
+		    "failed: %s", strerror(errno));
+
+	ring->ur_regfd[fd] = -1;
+	ring->ur_regfse[fd] = NULL;
+}
+
+/*
+ * Reaps completions from the ring, waiting for at least min_complete of
+ * them. Each completed I/O is charged to the flowop that submitted it,
+ * with the latency measured from its own submission time, unless
+ * "account" is zero. Returns FILEBENCH_ERROR if any I/O failed.
+ */
+static int
+fb_uring_reap(threadflow_t *threadflow, fb_uring_t *ring,
+    uint_t min_complete, int account)
+{
+	int ret = FILEBENCH_OK;
+	uint32_t head;
+	uint32_t tail;
+
+	if (min_complete > ring->ur_inflight)
+		min_complete = ring->ur_inflight;
+
+	while (min_complete > 0) {
+		head = *ring->ur_cq_head;
+		tail = __atomic_load_n(ring->ur_cq_tail, __ATOMIC_ACQUIRE);
+		if (tail - head >= min_complete)
+			break;
+		if (io_uring_enter(ring->ur_fd, 0, min_complete,
+		    IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+			filebench_log(LOG_ERROR, "io_uring_enter failed: %s",
+			    strerror(errno));
+			return (FILEBENCH_ERROR);
+		}
+	}
+
+	head = *ring->ur_cq_head;
+	tail = __atomic_load_n(ring->ur_cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe;
+		fb_uring_slot_t *slot;
+		int sidx;
+
+		cqe = &ring->ur_cqes[head & *ring->ur_cq_mask];
+		sidx = (int)cqe->user_data;
+		slot = &ring->ur_slots[sidx];
+
+		if (cqe->res < 0) {
+			filebench_log(LOG_ERROR, "%s failed: %s",
+			    slot->us_flowop->fo_name, strerror(-cqe->res));
+			ret = FILEBENCH_ERROR;
+		} else if (account) {
+			threadflow->tf_stime = slot->us_stime;
+			flowop_endop(threadflow, slot->us_flowop, cqe->res);
+		}
+
+		slot->us_flowop->fo_inflight--;
+		slot->us_flowop = NULL;
+		slot->us_next = ring->ur_freeslot;
+		ring->ur_freeslot = sidx;
+		ring->ur_inflight--;
+		head++;
+	}
+
+	__atomic_store_n(ring->ur_cq_head, head, __ATOMIC_RELEASE);
+
+	return (ret);
+}
+
+/*
+ * Common code for uringread and uringwrite. Waits for a free slot if the
+ * ring is full or the flowop has reached its own iodepth, sets up the
+ * file and buffer as the synchronous read and write flowops do, and
+ * submits a single request. Completions that are already available are
+ * reaped on the way out, so no extra system call is needed to collect
+ * them.
+ */
+static int
+fb_uringflow_rw(threadflow_t *threadflow, flowop_t *flowop, int write)
+{
+	fb_uring_t *ring = threadflow->tf_uring;
+	struct io_uring_sqe *sqe;
+	fb_uring_slot_t *slot;
+	fb_fdesc_t *fdesc;
+	caddr_t iobuf;
+	fbint_t wss;
+	fbint_t iosize;
+	fbint_t depth = 0;
+	uint64_t fileoffset;
+	uint32_t tail;
+	int fileidx;
+	int sidx;
+	int ret;
+
+	if (ring == NULL) {
+		if ((ring = fb_uring_create(threadflow)) == NULL)
+			return (FILEBENCH_ERROR);
+		threadflow->tf_uring = ring;
+	}
+
+	depth = flowop_iodepth(flowop);
+
+	while ((ring->ur_inflight >= ring->ur_depth) ||
+	    (depth && flowop->fo_inflight >= depth)) {
+		if (fb_uring_reap(threadflow, ring, 1, 1) != FILEBENCH_OK)
+			return (FILEBENCH_ERROR);
+	}
+
+	iosize = flowop_iosize(flowop);
+
+	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
+	    &fdesc, iosize)) != FILEBENCH_OK)
+		return (ret);
+
+	if (wss < iosize) {
+		filebench_log(LOG_ERROR,
+		    "file size smaller than IO size for thread %s",
+		    flowop->fo_name);
+		return (FILEBENCH_ERROR);
+	}
+
+	fileidx = fdesc - threadflow->tf_fd;
+	if (flowop->fo_attrs & FLOW_ATTR_RANDOM) {
+		fileoffset = flowop_random_offset(flowop, wss, iosize);
+	} else {
+		fileoffset = ring->ur_seqoff[fileidx];
+		if (fileoffset + iosize > wss)
+			fileoffset = 0;
+		ring->ur_seqoff[fileidx] = fileoffset + iosize;
+	}
+
+	sidx = ring->ur_freeslot;
+	slot = &ring->ur_slots[sidx];
+	ring->ur_freeslot = slot->us_next;
+	slot->us_flowop = flowop;
+
+	tail = *ring->ur_sq_tail;
+	sqe = &ring->ur_sqes[tail & *ring->ur_sq_mask];
+	(void) memset(sqe, 0, sizeof (*sqe));
+
+	if ((fileidx = fb_uring_fileindex(threadflow, ring, fdesc)) >= 0) {
+		sqe->fd = fileidx;
+		sqe->flags = IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = fdesc->fd_num;
+	}
+
+	if (ring->ur_bufbase && iobuf >= ring->ur_bufbase &&
+	    iobuf + iosize <= ring->ur_bufbase + ring->ur_buflen) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED :
+		    IORING_OP_READ_FIXED;
+		sqe->addr = (uint64_t)(uintptr_t)iobuf;
+		sqe->len = (uint32_t)iosize;
+		sqe->buf_index = 0;
+	} else {
+		slot->us_iov.iov_base = iobuf;
+		slot->us_iov.iov_len = (size_t)iosize;
+		sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (uint64_t)(uintptr_t)&slot->us_iov;
+		sqe->len = 1;
+	}
+	sqe->off = fileoffset;
+	sqe->user_data = sidx;
+
+	ring->ur_sq_array[tail & *ring->ur_sq_mask] =
+	    tail & *ring->ur_sq_mask;
+	__atomic_store_n(ring->ur_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	filebench_log(LOG_DEBUG_IMPL,
+	    "uring fd=%d, bytes=%llu, offset=%llu", fdesc->fd_num,
+	    (u_longlong_t)iosize, (u_longlong_t)fileoffset);
+
+	slot->us_stime = gethrtime();
+	while ((ret = io_uring_enter(ring->ur_fd, 1, 0, 0)) < 0 &&
+	    errno == EINTR)
+		;
+	if (ret != 1) {
+		filebench_log(LOG_ERROR, "%s submission failed: %s",
+		    flowop->fo_name, ret < 0 ? strerror(errno) : "not queued");
+		/* the kernel did not consume the entry, take it back */
+		__atomic_store_n(ring->ur_sq_tail, tail, __ATOMIC_RELEASE);
+		slot->us_flowop = NULL;
+		slot->us_next = ring->ur_freeslot;
+		ring->ur_freeslot = sidx;
+		return (FILEBENCH_ERROR);
+	}
+	ring->ur_inflight++;
+	flowop->fo_inflight++;
+
+	return (fb_uring_reap(threadflow, ring, 0, 1));
+}
+
+/*
+ * Submits an asynchronous read of iosize bytes, at a random offset if
+ * the "random" attribute is set and sequentially otherwise.
+ */
+static int
+fb_uringflow_read(threadflow_t *threadflow, flowop_t *flowop)
+{
+	return (fb_uringflow_rw(threadflow, flowop, 0));
+}
+
+/*
+ * Submits an asynchronous write of iosize bytes, at a random offset if
+ * the "random" attribute is set and sequentially otherwise.
+ */
+static int
+fb_uringflow_write(threadflow_t *threadflow, flowop_t *flowop)
+{
+	return (fb_uringflow_rw(threadflow, flowop, 1));
+}
+
+/*
+ * Waits for all I/Os outstanding on the thread's ring to complete.
+ * The completed I/Os are charged to the flowops that issued them, the
+ * time spent waiting is charged to this flowop.
+ */
+static int
+fb_uringflow_wait(threadflow_t *threadflow, flowop_t *flowop)
+{
+	fb_uring_t *ring = threadflow->tf_uring;
+	hrtime_t stime;
+	int ret;
+
+	if (ring == NULL || ring->ur_inflight == 0)
+		return (FILEBENCH_OK);
+
+	stime = gethrtime();
+	ret = fb_uring_reap(threadflow, ring, ring->ur_inflight, 1);
+	threadflow->tf_stime = stime;
+	flowop_endop(threadflow, flowop, 0);
+
+	return (ret);
+}
+
+/*
+ * Drains and tears down the thread's ring before the flowop's private
+ * buffer is released. Only the first uring flowop of a thread to be
+ * destructed finds the ring.
+ */
+static void
+fb_uringflow_destruct(flowop_t *flowop)
+{
+	threadflow_t *threadflow = flowop->fo_thread;
+	fb_uring_t *ring;
+
+	if (threadflow && (ring = threadflow->tf_uring) != NULL) {
+		threadflow->tf_uring = NULL;
+		(void) fb_uring_reap(threadflow, ring, ring->ur_inflight, 0);
+		fb_uring_free(ring);
+	}
+
+	flowop_destruct_generic(flowop);
+}
+
+#endif /* HAVE_IO_URING */
@@ -31,10 +31,12 @@
 #include "threadflow.h" /* For aiolist definition */
 
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <ftw.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -80,6 +82,10 @@ static int fb_lfs_stat(char *, struct stat64 *);
 static int fb_lfs_fstat(fb_fdesc_t *, struct stat64 *);
 static int fb_lfs_access(const char *, int);
 static void fb_lfs_recur_rm(char *);
+static int fb_lfs_openat(fb_fdesc_t *, int, char *, int, int);
+static int fb_lfs_fstatat(int, char *, struct stat64 *);
+static int fb_lfs_unlinkat(int, char *, int);
+static int fb_lfs_mkdirat(int, char *, int);
 
 static fsplug_func_t fb_lfs_funcs =
 {
@@ -107,7 +113,11 @@ static fsplug_func_t fb_lfs_funcs =
 	fb_lfs_stat,		/* stat */
 	fb_lfs_fstat,		/* fstat */
 	fb_lfs_access,		/* access */
-	fb_lfs_recur_rm		/* recursive rm */
+	fb_lfs_recur_rm,	/* recursive rm */
+	fb_lfs_openat,		/* openat */
+	fb_lfs_fstatat,		/* fstatat */
+	fb_lfs_unlinkat,	/* unlinkat */
+	fb_lfs_mkdirat		/* mkdirat */
 };
 
 #ifdef HAVE_AIO
@@ -115,14 +125,19 @@ static fsplug_func_t fb_lfs_funcs =
  * Local file system asynchronous IO flowops are in this module, as
  * they have a number of local file system specific features.
  */
+static int fb_lfsflow_aioread(threadflow_t *threadflow, flowop_t *flowop);
 static int fb_lfsflow_aiowrite(threadflow_t *threadflow, flowop_t *flowop);
 static int fb_lfsflow_aiowait(threadflow_t *threadflow, flowop_t *flowop);
+static int fb_lfsflow_aio_init(flowop_t *flowop);
+static void fb_lfsflow_aio_destruct(flowop_t *flowop);
 
 static flowop_proto_t fb_lfsflow_funcs[] = {
-	{FLOW_TYPE_AIO, FLOW_ATTR_WRITE, "aiowrite", flowop_init_generic,
-	fb_lfsflow_aiowrite, flowop_destruct_generic},
+	{FLOW_TYPE_AIO, FLOW_ATTR_READ, "aioread", fb_lfsflow_aio_init,
+	fb_lfsflow_aioread, fb_lfsflow_aio_destruct},
+	{FLOW_TYPE_AIO, FLOW_ATTR_WRITE, "aiowrite", fb_lfsflow_aio_init,
+	fb_lfsflow_aiowrite, fb_lfsflow_aio_destruct},
 	{FLOW_TYPE_AIO, 0, "aiowait", flowop_init_generic,
-	fb_lfsflow_aiowait, flowop_destruct_generic}
+	fb_lfsflow_aiowait, fb_lfsflow_aio_destruct}
 };
 
 #endif /* HAVE_AIO */
@@ -198,277 +213,430 @@ fb_lfs_read(fb_fdesc_t *fd, caddr_t iobuf, fbint_t iosize)
 #ifdef HAVE_AIO
 
 /*
- * Asynchronous write section. An Asynchronous IO element
- * (aiolist_t) is used to associate the asynchronous write request with
- * its subsequent completion. This element includes a aiocb64 struct
- * that is used by posix aio_xxx calls to track the asynchronous writes.
- * The flowops aiowrite and aiowait result in calls to these posix
- * aio_xxx system routines to do the actual asynchronous write IO
- * operations.
+ * Asynchronous IO section. Each thread owns a ring of pointers to
+ * asynchronous IO elements (aiolist_t), allocated on the first
+ * asynchronous operation. Every element includes the aiocb64 struct that
+ * is used by the posix aio_xxx calls to track the request, the flowop
+ * that issued it and the time it was issued at.
+ *
+ * If the thread has an "iodepth" attribute, the ring is sized by the
+ * largest of it and the "iodepth" attributes of the thread's aioread and
+ * aiowrite flowops, and a full ring waits for the oldest IOs. Otherwise
+ * the number of IOs in flight is not limited: a full ring doubles in
+ * size. Only the pointers move then, so the aiocbs of IOs in flight stay
+ * where the kernel knows them.
+ *
+ * Slots are handed out in submission order at the tail of the ring
+ * and retired from its head, so both take O(1). An aiocb returned by
+ * aio_waitn() is mapped back to its slot with AIO_SLOT(), also in O(1).
+ * The latency of an asynchronous read or write is accounted to its
+ * flowop when the completion is reaped, measured from the time the
+ * request was issued.
  */
 
+#define	AIO_SLOT(aiocb) \
+	((aiolist_t *)((char *)(aiocb) - offsetof(aiolist_t, al_aiocb)))
+
+#define	AIO_DEFSLOTS	32
 
 /*
- * Allocates an asynchronous I/O list (aio, of type
- * aiolist_t) element. Adds it to the flowop thread's
- * threadflow aio list. Returns a pointer to the element.
+ * Resizes the thread's ring to "nslots" slots, which must not be less
+ * than it has now. The slots in use keep their order and move to the
+ * start of the new ring, the new slots get new aiolist_t elements.
+ * Returns FILEBENCH_OK on success, FILEBENCH_ERROR otherwise.
  */
-static aiolist_t *
-aio_allocate(flowop_t *flowop)
+static int
+aio_slots_grow(threadflow_t *threadflow, int nslots)
 {
-	aiolist_t *aiolist;
+	aiolist_t **ring;
+	int i, j;
 
-	if ((aiolist = malloc(sizeof (aiolist_t))) == NULL) {
+	if ((ring = calloc(nslots, sizeof (aiolist_t *))) == NULL) {
 		filebench_log(LOG_ERROR, "malloc aiolist failed");
-		filebench_shutdown(1);
+		return (FILEBENCH_ERROR);
 	}
 
-	bzero(aiolist, sizeof(*aiolist));
+	for (i = 0; i < threadflow->tf_aioslots; i++)
+		ring[i] = threadflow->tf_aiolist[(threadflow->tf_aiohead + i) %
+		    threadflow->tf_aioslots];
 
-	/* Add to list */
-	if (flowop->fo_thread->tf_aiolist == NULL) {
-		flowop->fo_thread->tf_aiolist = aiolist;
-		aiolist->al_next = NULL;
-	} else {
-		aiolist->al_next = flowop->fo_thread->tf_aiolist;
-		flowop->fo_thread->tf_aiolist = aiolist;
+	for (; i < nslots; i++) {
+		if ((ring[i] = calloc(1, sizeof (aiolist_t))) == NULL) {
+			filebench_log(LOG_ERROR, "malloc aiolist failed");
+			for (j = threadflow->tf_aioslots; j < i; j++)
+				free(ring[j]);
+			free(ring);
+			return (FILEBENCH_ERROR);
+		}
 	}
-	return (aiolist);
+
+	free(threadflow->tf_aiolist);
+	threadflow->tf_aiolist = ring;
+	threadflow->tf_aioslots = nslots;
+	threadflow->tf_aiohead = 0;
+
+	filebench_log(LOG_DEBUG_SCRIPT, "thread %s: %d aio slots",
+	    threadflow->tf_name, threadflow->tf_aioslots);
+
+	return (FILEBENCH_OK);
 }
 
 /*
- * Searches for the aiolist element that has a matching
- * completion block, aiocb. If none found returns FILEBENCH_ERROR. If
- * found, removes the aiolist element from flowop thread's
- * list and returns FILEBENCH_OK.
+ * Allocates the thread's ring, sized by its iodepth and the iodepths of
+ * its asynchronous flowops, or AIO_DEFSLOTS if it has no iodepth.
+ * Returns FILEBENCH_OK on success, FILEBENCH_ERROR otherwise.
  */
 static int
-aio_deallocate(flowop_t *flowop, struct aiocb64 *aiocb)
+aio_slots_alloc(threadflow_t *threadflow)
 {
-	aiolist_t *aiolist = flowop->fo_thread->tf_aiolist;
-	aiolist_t *previous = NULL;
-	aiolist_t *match = NULL;
+	fbint_t nslots = AIO_DEFSLOTS;
 
-	if (aiocb == NULL) {
-		filebench_log(LOG_ERROR, "null aiocb deallocate");
-		return (FILEBENCH_OK);
+	if (threadflow->tf_iodepth)
+		nslots = avd_get_int(threadflow->tf_iodepth);
+	if (nslots < threadflow->tf_aiomaxdepth)
+		nslots = threadflow->tf_aiomaxdepth;
+	if (nslots == 0)
+		nslots = 1;
+
+	threadflow->tf_aioslots = 0;
+	threadflow->tf_aiocount = 0;
+
+	return (aio_slots_grow(threadflow, (int)nslots));
+}
+
+/*
+ * Checks whether the asynchronous IO in the supplied slot has completed.
+ * If so, charges it to the flowop that issued it (unless "account" is
+ * zero) and marks the slot as done. Returns 1 if the IO has completed,
+ * 0 if it is still in progress and -1 if it failed.
+ */
+static int
+aio_test(threadflow_t *threadflow, aiolist_t *aio, int account)
+{
+	ssize_t ret;
+	int result;
+
+	if (aio->al_done)
+		return (1);
+
+	if ((result = aio_error64(&aio->al_aiocb)) == EINPROGRESS)
+		return (0);
+
+	ret = aio_return64(&aio->al_aiocb);
+	aio->al_done = 1;
+	aio->al_flowop->fo_inflight--;
+
+	if (result || ret < 0) {
+		filebench_log(LOG_ERROR, "%s failed: %s",
+		    aio->al_flowop->fo_name, strerror(result ? result : errno));
+		return (-1);
 	}
 
-	while (aiolist) {
-		if (aiocb == &(aiolist->al_aiocb)) {
-			match = aiolist;
-			break;
-		}
-		previous = aiolist;
-		aiolist = aiolist->al_next;
+	if (account) {
+		threadflow->tf_stime = aio->al_stime;
+		flowop_endop(threadflow, aio->al_flowop, ret);
 	}
 
-	if (match == NULL)
-		return (FILEBENCH_ERROR);
+	return (1);
+}
 
-	/* Remove from the list */
-	if (previous)
-		previous->al_next = match->al_next;
-	else
-		flowop->fo_thread->tf_aiolist = match->al_next;
+/*
+ * Frees the completed slots at the head of the thread's ring.
+ */
+static void
+aio_retire(threadflow_t *threadflow)
+{
+	while (threadflow->tf_aiocount > 0 &&
+	    threadflow->tf_aiolist[threadflow->tf_aiohead]->al_done) {
+		threadflow->tf_aiohead =
+		    (threadflow->tf_aiohead + 1) % threadflow->tf_aioslots;
+		threadflow->tf_aiocount--;
+	}
+}
+
+/*
+ * Waits for the "todo" oldest asynchronous IOs of the thread to complete,
+ * then collects any further ones that have completed in order without
+ * waiting. Returns FILEBENCH_ERROR if any of the IOs failed, FILEBENCH_OK
+ * otherwise.
+ */
+static int
+aio_reap(threadflow_t *threadflow, int todo, int account)
+{
+	aiolist_t *aio;
+	int ret;
+
+	while (threadflow->tf_aiocount > 0) {
+		aio = threadflow->tf_aiolist[threadflow->tf_aiohead];
+
+		while ((ret = aio_test(threadflow, aio, account)) == 0) {
+			const struct aiocb64 *aiocb = &aio->al_aiocb;
+
+			if (todo <= 0)
+				return (FILEBENCH_OK);
+
+			if (aio_suspend64(&aiocb, 1, NULL) < 0 &&
+			    errno != EINTR && errno != EAGAIN) {
+				filebench_log(LOG_ERROR, "aio_suspend "
+				    "failed: %s", strerror(errno));
+				return (FILEBENCH_ERROR);
+			}
+		}
+
+		aio_retire(threadflow);
+		todo--;
+
+		if (ret < 0)
+			return (FILEBENCH_ERROR);
+	}
 
 	return (FILEBENCH_OK);
 }
 
 /*
- * Emulate posix aiowrite(). Determines which file to use,
- * either one file of a fileset, or the file associated
- * with a fileobj, allocates and fills an aiolist_t element
- * for the write, and issues the asynchronous write. This
- * operation is only valid for random IO, and returns an
- * error if the flowop is set for sequential IO. Returns
- * FILEBENCH_OK on success, FILEBENCH_NORSC if iosetup can't
- * obtain a file to open, and FILEBENCH_ERROR on any
- * encountered error.
+ * Allocates an asynchronous I/O element (aiolist_t) for the flowop at
+ * the tail of its thread's ring. Waits for the oldest IOs to complete if
+ * the flowop has already reached its own iodepth, or if the ring is full
+ * and the thread has an iodepth. A full ring of a thread without one is
+ * grown instead. Returns a pointer to the element, or NULL on error.
+ */
+static aiolist_t *
+aio_allocate(threadflow_t *threadflow, flowop_t *flowop)
+{
+	aiolist_t *aio;
+	fbint_t depth = 0;
+
+	if (threadflow->tf_aiolist == NULL &&
+	    aio_slots_alloc(threadflow) != FILEBENCH_OK)
+		return (NULL);
+
+	depth = flowop_iodepth(flowop);
+
+	while ((threadflow->tf_iodepth &&
+	    threadflow->tf_aiocount == threadflow->tf_aioslots) ||
+	    (depth && flowop->fo_inflight >= depth)) {
+		if (aio_reap(threadflow, 1, 1) != FILEBENCH_OK)
+			return (NULL);
+	}
+
+	if (threadflow->tf_aiocount == threadflow->tf_aioslots &&
+	    aio_slots_grow(threadflow,
+	    threadflow->tf_aioslots * 2) != FILEBENCH_OK)
+		return (NULL);
+
+	aio = threadflow->tf_aiolist[(threadflow->tf_aiohead +
+	    threadflow->tf_aiocount) % threadflow->tf_aioslots];
+	threadflow->tf_aiocount++;
+
+	bzero(aio, sizeof (*aio));
+	aio->al_flowop = flowop;
+	flowop->fo_inflight++;
+
+	return (aio);
+}
+
+/*
+ * Emulate posix aioread() and aiowrite(). Determines which file to use,
+ * either one file of a fileset, or the file associated with a fileobj,
+ * allocates and fills an aiolist_t element for the IO, and issues the
+ * asynchronous read or write. Random IOs use a random offset within the
+ * working set, sequential ones advance the file's offset. Returns
+ * FILEBENCH_OK on success, FILEBENCH_NORSC if iosetup can't obtain a file
+ * to open, and FILEBENCH_ERROR on any encountered error.
  */
 static int
-fb_lfsflow_aiowrite(threadflow_t *threadflow, flowop_t *flowop)
+fb_lfsflow_aio_rw(threadflow_t *threadflow, flowop_t *flowop, int type)
 {
+	struct aiocb64 *aiocb;
+	aiolist_t *aio;
 	caddr_t iobuf;
 	fbint_t wss;
 	fbint_t iosize;
 	fb_fdesc_t *fdesc;
+	off64_t fileoffset;
 	int ret;
 
-	iosize = avd_get_int(flowop->fo_iosize);
+	iosize = flowop_iosize(flowop);
 
 	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
 	    &fdesc, iosize)) != FILEBENCH_OK)
 		return (ret);
 
-	if (avd_get_bool(flowop->fo_random)) {
-		uint64_t fileoffset;
-		struct aiocb64 *aiocb;
-		aiolist_t *aiolist;
+	if (wss < iosize) {
+		filebench_log(LOG_ERROR,
+		    "file size smaller than IO size for thread %s",
+		    flowop->fo_name);
+		return (FILEBENCH_ERROR);
+	}
 
-		if (wss < iosize) {
-			filebench_log(LOG_ERROR,
-			    "file size smaller than IO size for thread %s",
-			    flowop->fo_name);
-			return (FILEBENCH_ERROR);
+	if (flowop->fo_attrs & FLOW_ATTR_RANDOM) {
+		uint64_t offset;
+
+		offset = flowop_random_offset(flowop, wss, iosize);
+		fileoffset = (off64_t)offset;
+	} else {
+		fileoffset = lseek64(fdesc->fd_num, iosize, SEEK_CUR) - iosize;
+		if (fileoffset < 0 || fileoffset + iosize > wss) {
+			fileoffset = 0;
+			(void) lseek64(fdesc->fd_num, iosize, SEEK_SET);
 		}
+	}
 
-		fb_random64(&fileoffset, wss, iosize, NULL);
+	if ((aio = aio_allocate(threadflow, flowop)) == NULL)
+		return (FILEBENCH_ERROR);
 
-		aiolist = aio_allocate(flowop);
-		aiolist->al_type = AL_WRITE;
-		aiocb = &aiolist->al_aiocb;
+	aio->al_type = type;
+	aiocb = &aio->al_aiocb;
 
-		aiocb->aio_fildes = fdesc->fd_num;
-		aiocb->aio_buf = iobuf;
-		aiocb->aio_nbytes = (size_t)iosize;
-		aiocb->aio_offset = (off64_t)fileoffset;
-		aiocb->aio_reqprio = 0;
+	aiocb->aio_fildes = fdesc->fd_num;
+	aiocb->aio_buf = iobuf;
+	aiocb->aio_nbytes = (size_t)iosize;
+	aiocb->aio_offset = fileoffset;
+	aiocb->aio_reqprio = 0;
 
-		filebench_log(LOG_DEBUG_IMPL,
-		    "aio fd=%d, bytes=%llu, offset=%llu",
-		    fdesc->fd_num, (u_longlong_t)iosize,
-		    (u_longlong_t)fileoffset);
+	filebench_log(LOG_DEBUG_IMPL,
+	    "aio fd=%d, bytes=%llu, offset=%llu",
+	    fdesc->fd_num, (u_longlong_t)iosize,
+	    (u_longlong_t)fileoffset);
 
-		flowop_beginop(threadflow, flowop);
-		if (aio_write64(aiocb) < 0) {
-			filebench_log(LOG_ERROR, "aiowrite failed: %s",
-			    strerror(errno));
-			filebench_shutdown(1);
-		}
-		flowop_endop(threadflow, flowop, iosize);
-	} else {
+	aio->al_stime = gethrtime();
+	if (type == AL_READ)
+		ret = aio_read64(aiocb);
+	else
+		ret = aio_write64(aiocb);
+
+	if (ret < 0) {
+		filebench_log(LOG_ERROR, "%s failed: %s", flowop->fo_name,
+		    strerror(errno));
+		aio->al_done = 1;
+		flowop->fo_inflight--;
+		aio_retire(threadflow);
 		return (FILEBENCH_ERROR);
 	}
 
-	return (FILEBENCH_OK);
+	/* collect whatever has completed meanwhile */
+	return (aio_reap(threadflow, 0, 1));
+}
+
+static int
+fb_lfsflow_aioread(threadflow_t *threadflow, flowop_t *flowop)
+{
+	return (fb_lfsflow_aio_rw(threadflow, flowop, AL_READ));
+}
+
+static int
+fb_lfsflow_aiowrite(threadflow_t *threadflow, flowop_t *flowop)
+{
+	return (fb_lfsflow_aio_rw(threadflow, flowop, AL_WRITE));
+}
+
+/*
+ * Records the largest iodepth of the thread's asynchronous flowops, so
+ * that the thread's ring can hold all of their IOs.
+ */
+static int
+fb_lfsflow_aio_init(flowop_t *flowop)
+{
+	threadflow_t *threadflow = flowop->fo_thread;
+	fbint_t depth;
+
+	if (threadflow) {
+		depth = flowop_iodepth(flowop);
+		if (depth > threadflow->tf_aiomaxdepth)
+			threadflow->tf_aiomaxdepth = (int)depth;
+	}
+
+	return (flowop_init_generic(flowop));
 }
 
+/*
+ * Waits for all IOs still in flight and releases the thread's ring,
+ * before the flowop's private buffer, which IOs may use, is released.
+ */
+static void
+fb_lfsflow_aio_destruct(flowop_t *flowop)
+{
+	threadflow_t *threadflow = flowop->fo_thread;
+	int i;
 
+	if (threadflow && threadflow->tf_aiolist) {
+		while (threadflow->tf_aiocount > 0)
+			(void) aio_reap(threadflow, threadflow->tf_aiocount, 0);
+		for (i = 0; i < threadflow->tf_aioslots; i++)
+			free(threadflow->tf_aiolist[i]);
+		free(threadflow->tf_aiolist);
+		threadflow->tf_aiolist = NULL;
+		threadflow->tf_aioslots = 0;
+		threadflow->tf_aiocount = 0;
+	}
 
-#define	MAXREAP 4096
+	flowop_destruct_generic(flowop);
+}
 
 /*
  * Emulate posix aiowait(). Waits for the completion of half the
  * outstanding asynchronous IOs, or a single IO, which ever is
- * larger. The routine will return after a sufficient number of
- * completed calls issued by any thread in the procflow have
- * completed, or a 1 second timout elapses. All completed
- * IO operations are deleted from the thread's aiolist.
+ * larger. Each completed IO is accounted to the flowop that issued
+ * it, while the time spent waiting is accounted to this flowop.
  */
 static int
 fb_lfsflow_aiowait(threadflow_t *threadflow, flowop_t *flowop)
 {
-	struct aiocb64 **worklist;
-	aiolist_t *aio = flowop->fo_thread->tf_aiolist;
-	int uncompleted = 0;
+	hrtime_t stime;
+	uint_t todo;
+	int ret = FILEBENCH_OK;
 #ifdef HAVE_AIOWAITN
-	int i;
+	struct aiocb64 **worklist;
+	struct timespec timeout;
+	uint_t i;
 #endif
 
-	worklist = calloc(MAXREAP, sizeof (struct aiocb64 *));
+	todo = threadflow->tf_aiocount / 2;
+	if (todo == 0)
+		todo = 1;
 
-	/* Count the list of pending aios */
-	while (aio) {
-		uncompleted++;
-		aio = aio->al_next;
-	}
+	stime = gethrtime();
 
-	do {
-		uint_t ncompleted = 0;
-		uint_t todo;
-		int inprogress;
 #ifdef HAVE_AIOWAITN
-		struct timespec timeout;
+	if (threadflow->tf_aiocount > 0) {
+		worklist = calloc(threadflow->tf_aioslots,
+		    sizeof (struct aiocb64 *));
+		if (worklist == NULL) {
+			filebench_log(LOG_ERROR, "malloc aio worklist failed");
+			return (FILEBENCH_ERROR);
+		}
 
-		/* Wait for half of the outstanding requests */
 		timeout.tv_sec = 1;
 		timeout.tv_nsec = 0;
-#endif
-
-		if (uncompleted > MAXREAP)
-			todo = MAXREAP;
-		else
-			todo = uncompleted / 2;
-
-		if (todo == 0)
-			todo = 1;
-
-		flowop_beginop(threadflow, flowop);
 
-#ifdef HAVE_AIOWAITN
 		if (((aio_waitn64((struct aiocb64 **)worklist,
-		    MAXREAP, &todo, &timeout)) == -1) &&
+		    threadflow->tf_aioslots, &todo, &timeout)) == -1) &&
 		    errno && (errno != ETIME)) {
 			filebench_log(LOG_ERROR,
 			    "aiowait failed: %s, outstanding = %d, "
-			    "ncompleted = %d ",
-			    strerror(errno), uncompleted, todo);
+			    "ncompleted = %d ", strerror(errno),
+			    threadflow->tf_aiocount, todo);
 		}
 
-		ncompleted = todo;
-		/* Take the  completed I/Os from the list */
-		inprogress = 0;
-		for (i = 0; i < ncompleted; i++) {
-			if ((aio_return64(worklist[i]) == -1) &&
-			    (errno == EINPROGRESS)) {
-				inprogress++;
-				continue;
-			}
-			if (aio_deallocate(flowop, worklist[i])
-			    == FILEBENCH_ERROR) {
-				filebench_log(LOG_ERROR, "Could not remove "
-				    "aio from list ");
-				flowop_endop(threadflow, flowop, 0);
-				return (FILEBENCH_ERROR);
-			}
+		for (i = 0; i < todo; i++) {
+			if (aio_test(threadflow, AIO_SLOT(worklist[i]), 1) < 0)
+				ret = FILEBENCH_ERROR;
 		}
+		aio_retire(threadflow);
 
-		uncompleted -= ncompleted;
-		uncompleted += inprogress;
-
+		free(worklist);
+	}
 #else
-
-		for (ncompleted = 0, inprogress = 0,
-		    aio = flowop->fo_thread->tf_aiolist;
-		    ncompleted < todo && aio != NULL; aio = aio->al_next) {
-			int result = aio_error64(&aio->al_aiocb);
-
-			if (result == EINPROGRESS) {
-				inprogress++;
-				continue;
-			}
-
-			if ((aio_return64(&aio->al_aiocb) == -1) || result) {
-				filebench_log(LOG_ERROR, "aio failed: %s",
-				    strerror(result));
-				continue;
-			}
-
-			ncompleted++;
-
-			if (aio_deallocate(flowop, &aio->al_aiocb) < 0) {
-				filebench_log(LOG_ERROR, "Could not remove "
-				    "aio from list ");
-				flowop_endop(threadflow, flowop, 0);
-				return (FILEBENCH_ERROR);
-			}
-		}
-
-		uncompleted -= ncompleted;
-
+	ret = aio_reap(threadflow, todo, 1);
 #endif
-		filebench_log(LOG_DEBUG_SCRIPT,
-		    "aio2 completed %d ios, uncompleted = %d, inprogress = %d",
-		    ncompleted, uncompleted, inprogress);
 
-	} while (uncompleted > MAXREAP);
+	filebench_log(LOG_DEBUG_SCRIPT, "aiowait: %d ios still outstanding",
+	    threadflow->tf_aiocount);
 
+	threadflow->tf_stime = stime;
 	flowop_endop(threadflow, flowop, 0);
 
-	free(worklist);
-
-	return (FILEBENCH_OK);
+	return (ret);
 }
 
 #endif /* HAVE_AIO */
@@ -488,6 +656,60 @@ fb_lfs_open(fb_fdesc_t *fd, char *path, int flags, int perms)
 		return (FILEBENCH_OK);
 }
 
+/*
+ * The *at() variants of open, stat, unlink and rmdir, and mkdir. Names
+ * are relative to the directory fd "dirfd", or full paths if it is
+ * AT_FDCWD. Without openat() only the latter is ever passed in.
+ */
+static int
+fb_lfs_openat(fb_fdesc_t *fd, int dirfd, char *name, int flags, int perms)
+{
+#ifdef HAVE_OPENAT
+#ifdef O_LARGEFILE
+	flags |= O_LARGEFILE;
+#endif
+	fd->fd_num = openat(dirfd, name, flags, perms);
+#else
+	fd->fd_num = open64(name, flags, perms);
+#endif
+	if (fd->fd_num < 0)
+		return (FILEBENCH_ERROR);
+	else
+		return (FILEBENCH_OK);
+}
+
+static int
+fb_lfs_fstatat(int dirfd, char *name, struct stat64 *statbufp)
+{
+#ifdef HAVE_OPENAT
+	return (fstatat64(dirfd, name, statbufp, 0));
+#else
+	return (stat64(name, statbufp));
+#endif
+}
+
+static int
+fb_lfs_unlinkat(int dirfd, char *name, int flags)
+{
+#ifdef HAVE_OPENAT
+	return (unlinkat(dirfd, name, flags));
+#else
+	if (flags & AT_REMOVEDIR)
+		return (rmdir(name));
+	return (unlink(name));
+#endif
+}
+
+static int
+fb_lfs_mkdirat(int dirfd, char *name, int perm)
+{
+#ifdef HAVE_OPENAT
+	return (mkdirat(dirfd, name, perm));
+#else
+	return (mkdir(name, perm));
+#endif
+}
+
 /*
  * Does an unlink (delete) of a file.
  */
@@ -561,20 +783,30 @@ fb_lfs_rmdir(char *path)
 	return (rmdir(path));
 }
 
+/*
+ * nftw() callback for fb_lfs_recur_rm(). Entries are visited after
+ * their children, so directories are empty by then. Errors are ignored
+ * and the walk goes on, like "rm -rf".
+ */
+/* ARGSUSED */
+static int
+fb_lfs_recur_rm_entry(const char *path, const struct stat *sb, int flag,
+    struct FTW *ftw)
+{
+	(void) remove(path);
+	return (0);
+}
+
 /*
  * does a recursive rm to remove an entire directory tree (i.e. a fileset).
- * Supplied with the path to the root of the tree.
+ * Supplied with the path to the root of the tree. Walks the tree in
+ * process rather than running "rm -rf", so that several subtrees can be
+ * removed at once from different threads.
  */
 static void
 fb_lfs_recur_rm(char *path)
 {
-	char cmd[MAXPATHLEN];
-
-	(void) snprintf(cmd, sizeof (cmd), "rm -rf %s", path);
-
-	/* We ignore system()'s return value */
-	if (system(cmd));
-	return;
+	(void) nftw(path, fb_lfs_recur_rm_entry, 16, FTW_DEPTH | FTW_PHYS);
 }
 
 /*
@@ -24,6 +24,7 @@
  */
 
 #include <stdio.h>
+#include <ctype.h>
 #include <fcntl.h>
 /* this definition prevents warning about
    using undefined round() function */
@@ -34,8 +35,23 @@
 #include "cvars/mtwist/mtwist.h"
 
 /*
- * Generates a 64-bit random number using mtwist or from a provided random
- * variable "avd".
+ * The generator of the calling thread, if it is a worker thread. Others
+ * share the mtwist generator.
+ */
+static __thread fb_rand_t *fb_rand_thread;
+
+/*
+ * Makes "rng" the generator of the calling thread's random draws.
+ */
+void
+fb_random_setthread(fb_rand_t *rng)
+{
+	fb_rand_thread = rng;
+}
+
+/*
+ * Generates a 64-bit random number using the thread's generator, mtwist
+ * outside of worker threads, or from a provided random variable "avd".
  *
  * Returned random number "randp" is clipped by the "max" value and rounded off
  * by the "round" value.  Returns 0 on success, shuts down Filebench on
@@ -59,6 +75,8 @@ fb_random64(uint64_t *randp, uint64_t max, uint64_t round, avd_t avd)
 		} else {
 			random = avd_get_int(avd);
 		}
+	} else if (fb_rand_thread) {
+		random = fb_rand_next(fb_rand_thread);
 	} else {
 		random = mt_llrand();
 	}
@@ -102,8 +120,8 @@ fb_random32(uint32_t *randp,
 /*
  * Same as filebench_randomno64, but for probability [0-1].
  */
-static double
-fb_random_probability()
+double
+fb_random_probability(void)
 {
 	uint64_t randnum;
 
@@ -113,6 +131,262 @@ fb_random_probability()
 	return (double)randnum / (double)(UINT64_MAX);
 }
 
+/*
+ * Seeds a fast generator. The state is filled from "seed" by splitmix64,
+ * as the xoshiro authors recommend, so that similar seeds (such as
+ * consecutive thread ids) still give unrelated streams.
+ */
+void
+fb_rand_seed(fb_rand_t *rng, uint64_t seed)
+{
+	uint64_t z;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		seed += 0x9e3779b97f4a7c15ULL;
+		z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		rng->fr_s[i] = z ^ (z >> 31);
+	}
+}
+
+/*
+ * Seeds the lanes of a ring from the generator "rng", and empties it.
+ */
+void
+fb_randring_seed(fb_randring_t *rr, fb_rand_t *rng)
+{
+	fb_rand_t lane;
+	int i, l;
+
+	for (l = 0; l < FB_RANDRING_LANES; l++) {
+		fb_rand_seed(&lane, fb_rand_next(rng));
+		for (i = 0; i < 4; i++)
+			rr->rr_s[i][l] = lane.fr_s[i];
+	}
+
+	rr->rr_next = FB_RANDRING_SIZE;
+}
+
+/*
+ * Refills a ring. Each iteration of the outer loop steps all lanes, with
+ * no dependencies between them, so the inner loop maps onto SIMD
+ * registers.
+ */
+void
+fb_randring_fill(fb_randring_t *rr)
+{
+	uint64_t s0[FB_RANDRING_LANES], s1[FB_RANDRING_LANES];
+	uint64_t s2[FB_RANDRING_LANES], s3[FB_RANDRING_LANES];
+	uint64_t t;
+	int i, l;
+
+	for (l = 0; l < FB_RANDRING_LANES; l++) {
+		s0[l] = rr->rr_s[0][l];
+		s1[l] = rr->rr_s[1][l];
+		s2[l] = rr->rr_s[2][l];
+		s3[l] = rr->rr_s[3][l];
+	}
+
+	for (i = 0; i < FB_RANDRING_SIZE; i += FB_RANDRING_LANES) {
+		for (l = 0; l < FB_RANDRING_LANES; l++) {
+			rr->rr_buf[i + l] = fb_rand_rotl(s1[l] * 5, 7) * 9;
+			t = s1[l] << 17;
+			s2[l] ^= s0[l];
+			s3[l] ^= s1[l];
+			s1[l] ^= s2[l];
+			s0[l] ^= s3[l];
+			s2[l] ^= t;
+			s3[l] = fb_rand_rotl(s3[l], 45);
+		}
+	}
+
+	for (l = 0; l < FB_RANDRING_LANES; l++) {
+		rr->rr_s[0][l] = s0[l];
+		rr->rr_s[1][l] = s1[l];
+		rr->rr_s[2][l] = s2[l];
+		rr->rr_s[3][l] = s3[l];
+	}
+
+	rr->rr_next = 0;
+}
+
+/*
+ * Measures how many random I/O offsets per second each way of drawing
+ * them produces, for "filebench -b".
+ */
+#define	FB_RANDOM_BENCH_DRAWS	(20 * 1000 * 1000)
+#define	FB_RANDOM_BENCH_WSS	(1ULL << 30)
+#define	FB_RANDOM_BENCH_IOSHIFT	13
+#define	FB_RANDOM_BENCH_IOSIZE	(1 << FB_RANDOM_BENCH_IOSHIFT)
+
+static void
+fb_random_bench_report(const char *name, hrtime_t start, uint64_t sum)
+{
+	double secs = (gethrtime() - start) / 1000000000.0;
+
+	printf("  %-36s %8.1f M offsets/s  (checksum %llx)\n", name,
+	    FB_RANDOM_BENCH_DRAWS / secs / 1000000.0, (u_longlong_t)sum);
+}
+
+void
+fb_random_bench(void)
+{
+	uint64_t nblocks = FB_RANDOM_BENCH_WSS / FB_RANDOM_BENCH_IOSIZE;
+	uint64_t off, sum;
+	fb_randring_t rr;
+	fb_rand_t rng;
+	hrtime_t start;
+	int i;
+
+	printf("Random %d byte offsets within %llu bytes:\n",
+	    FB_RANDOM_BENCH_IOSIZE, (u_longlong_t)FB_RANDOM_BENCH_WSS);
+
+	start = gethrtime();
+	for (sum = 0, i = 0; i < FB_RANDOM_BENCH_DRAWS; i++) {
+		fb_random64(&off, FB_RANDOM_BENCH_WSS, FB_RANDOM_BENCH_IOSIZE,
+		    NULL);
+		sum += off;
+	}
+	fb_random_bench_report("fb_random64(), shared mtwist", start, sum);
+
+	fb_rand_seed(&rng, 0);
+	fb_random_setthread(&rng);
+	start = gethrtime();
+	for (sum = 0, i = 0; i < FB_RANDOM_BENCH_DRAWS; i++) {
+		fb_random64(&off, FB_RANDOM_BENCH_WSS, FB_RANDOM_BENCH_IOSIZE,
+		    NULL);
+		sum += off;
+	}
+	fb_random_bench_report("fb_random64(), thread generator", start,
+	    sum);
+	fb_random_setthread(NULL);
+
+	fb_randring_seed(&rr, &rng);
+	start = gethrtime();
+	for (sum = 0, i = 0; i < FB_RANDOM_BENCH_DRAWS; i++) {
+		off = fb_rand_scale(fb_randring_next(&rr), nblocks) <<
+		    FB_RANDOM_BENCH_IOSHIFT;
+		sum += off;
+	}
+	fb_random_bench_report("ring, multiply-shift", start, sum);
+}
+
+/*
+ * Returns an odd multiplier coprime with "n", which maps [0, n) onto
+ * itself as i * stride % n, scattering neighbouring values.
+ */
+uint64_t
+fb_coprime_stride(uint64_t n)
+{
+	uint64_t stride, a, b, t;
+
+	if (n <= 1)
+		return (1);
+
+	for (stride = (0x9e3779b97f4a7c15ULL % n) | 1; ; stride += 2) {
+		a = stride;
+		b = n;
+		while (b) {
+			t = a % b;
+			a = b;
+			b = t;
+		}
+		if (a == 1)
+			return (stride);
+	}
+}
+
+/*
+ * Zipf sampling by rejection-inversion, after W. Hormann and
+ * G. Derflinger, "Rejection-inversion to generate variates from monotone
+ * discrete distributions". It takes O(1) time and no tables: a rank is
+ * drawn by inverting the integral of a continuous hat function h(x) =
+ * x^-theta, and almost always accepted straight away.
+ */
+static double
+fb_zipf_helper1(double x)
+{
+	if (fabs(x) > 1e-8)
+		return (log1p(x) / x);
+	return (1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x)));
+}
+
+static double
+fb_zipf_helper2(double x)
+{
+	if (fabs(x) > 1e-8)
+		return (expm1(x) / x);
+	return (1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x)));
+}
+
+static double
+fb_zipf_h(fb_zipf_t *zp, double x)
+{
+	return (exp(-zp->fz_theta * log(x)));
+}
+
+static double
+fb_zipf_hintegral(fb_zipf_t *zp, double x)
+{
+	double logx = log(x);
+
+	return (fb_zipf_helper2((1.0 - zp->fz_theta) * logx) * logx);
+}
+
+static double
+fb_zipf_hinverse(fb_zipf_t *zp, double x)
+{
+	double t = x * (1.0 - zp->fz_theta);
+
+	if (t < -1.0)
+		t = -1.0;
+	return (exp(fb_zipf_helper1(t) * x));
+}
+
+/*
+ * Sets up a Zipf distribution over "n" ranks with exponent "theta".
+ */
+void
+fb_zipf_init(fb_zipf_t *zp, uint64_t n, double theta)
+{
+	zp->fz_n = MAX(n, 1);
+	zp->fz_theta = (theta > 0.0) ? theta : 1e-6;
+	zp->fz_hx1 = fb_zipf_hintegral(zp, 1.5) - 1.0;
+	zp->fz_hn = fb_zipf_hintegral(zp, (double)zp->fz_n + 0.5);
+	zp->fz_s = 2.0 - fb_zipf_hinverse(zp,
+	    fb_zipf_hintegral(zp, 2.5) - fb_zipf_h(zp, 2.0));
+}
+
+/*
+ * Returns a rank in [1, fz_n], rank k being drawn with a probability
+ * proportional to k^-theta. Uses "rng", or the shared generator if NULL.
+ */
+uint64_t
+fb_zipf_next(fb_zipf_t *zp, fb_rand_t *rng)
+{
+	double u, x;
+	uint64_t k;
+
+	for (;;) {
+		u = rng ? fb_rand_double(rng) : fb_random_probability();
+		u = zp->fz_hn + u * (zp->fz_hx1 - zp->fz_hn);
+		x = fb_zipf_hinverse(zp, u);
+
+		k = (uint64_t)(x + 0.5);
+		if (k < 1)
+			k = 1;
+		else if (k > zp->fz_n)
+			k = zp->fz_n;
+
+		if (((double)k - x <= zp->fz_s) ||
+		    (u >= fb_zipf_hintegral(zp, (double)k + 0.5) -
+		    fb_zipf_h(zp, (double)k)))
+			return (k);
+	}
+}
+
 /****************************************
  *					*
  * randist related functions		*
@@ -125,6 +399,7 @@ fb_rand_src_rand48(unsigned short *xi)
 	return (erand48(xi));
 }
 
+/* ARGSUSED */
 static double
 fb_rand_src_random(unsigned short *xi)
 {
@@ -178,24 +453,39 @@ rand_gamma_get(randdist_t *rndp)
 
 /*
  * fetch a table driven random number from the supplied
- * random object.
+ * random object. A single uniform draw picks an alias table slot, then
+ * chooses between the slot's bucket and its alias, and finally gives
+ * the position within the chosen bucket.
  */
 static double
 rand_table_get(randdist_t *rndp)
 {
-	double		dprob, dprcnt, dtabres, dsclres, dmin, dround;
-	int		idx;
+	double		dprob, dslot, dfrac, dkeep, dpos;
+	double		dtabres, dsclres, dmin, dround;
+	randfunc_t	*rfp;
+	uint32_t	idx;
 
 	dmin = (double)rndp->rnd_vint_min;
 	dround = (double)rndp->rnd_vint_round;
 
 	dprob = (*rndp->rnd_src)(rndp->rnd_xi);
 
-	dprcnt = (dprob * (double)(PF_TAB_SIZE));
-	idx = (int)dprcnt;
+	dslot = dprob * (double)rndp->rnd_nrft;
+	idx = (uint32_t)dslot;
+	if (idx >= rndp->rnd_nrft)
+		idx = rndp->rnd_nrft - 1;
+	dfrac = dslot - (double)idx;
+
+	rfp = &rndp->rnd_rft[idx];
+	dkeep = (double)rfp->rf_prob / 4294967296.0;
+	if (dfrac < dkeep) {
+		dpos = dfrac / dkeep;
+	} else {
+		dpos = (dfrac - dkeep) / (1.0 - dkeep);
+		rfp = &rndp->rnd_rft[rfp->rf_alias];
+	}
 
-	dtabres = (rndp->rnd_rft[idx].rf_base +
-	    (rndp->rnd_rft[idx].rf_range * (dprcnt - (double)idx)));
+	dtabres = rfp->rf_base + (rfp->rf_range * dpos);
 
 	dsclres = (dtabres * (rndp->rnd_dbl_mean - dmin)) + dmin;
 
@@ -229,6 +519,233 @@ rand_seed_set(randdist_t *rndp)
 	}
 }
 
+/*
+ * Resizes the array of doubles at *arrayp to hold size entries. On
+ * failure the array is left as it was, so the caller can still free it.
+ * Returns 0 on success, -1 on failure.
+ */
+static int
+rand_histogram_grow(double **arrayp, uint32_t size)
+{
+	double *array;
+
+	if ((array = realloc(*arrayp, size * sizeof (double))) == NULL)
+		return (-1);
+
+	*arrayp = array;
+	return (0);
+}
+
+/*
+ * Reads a histogram file into arrays of bucket minimums, maximums and
+ * weights. Each line holds "min max weight", or "value weight" for a
+ * bucket of a single value. Fields may be separated by blanks or commas,
+ * and lines starting with '#' are comments. Weights are relative, such
+ * as raw counts. Returns FILEBENCH_OK on success, FILEBENCH_ERROR on
+ * failure.
+ */
+static int
+rand_histogram_load(char *path, double **minsp, double **maxsp,
+    double **weightsp, uint32_t *np)
+{
+	char line[256];
+	double *mins = NULL, *maxs = NULL, *weights = NULL;
+	double f[3];
+	uint32_t n = 0, size = 0;
+	int lineno = 0;
+	int nfields;
+	char *cp;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		filebench_log(LOG_ERROR, "Cannot open histogram file %s: %s",
+		    path, strerror(errno));
+		return (FILEBENCH_ERROR);
+	}
+
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		lineno++;
+
+		for (cp = line; *cp; cp++) {
+			if (*cp == ',')
+				*cp = ' ';
+		}
+		for (cp = line; isspace((unsigned char)*cp); cp++)
+			;
+		if (*cp == '\0' || *cp == '#')
+			continue;
+
+		nfields = sscanf(cp, "%lf %lf %lf", &f[0], &f[1], &f[2]);
+		if (nfields == 2) {
+			f[2] = f[1];
+			f[1] = f[0];
+		} else if (nfields != 3) {
+			filebench_log(LOG_ERROR, "%s:%d: expected "
+			    "\"min max weight\" or \"value weight\"",
+			    path, lineno);
+			goto error;
+		}
+
+		if (f[1] < f[0] || f[2] < 0.0) {
+			filebench_log(LOG_ERROR, "%s:%d: bucket maximum below "
+			    "its minimum or negative weight", path, lineno);
+			goto error;
+		}
+
+		if (n == size) {
+			size = size ? size * 2 : 1024;
+			if (rand_histogram_grow(&mins, size) != 0 ||
+			    rand_histogram_grow(&maxs, size) != 0 ||
+			    rand_histogram_grow(&weights, size) != 0) {
+				filebench_log(LOG_ERROR,
+				    "Out of memory for histogram %s", path);
+				goto error;
+			}
+		}
+
+		mins[n] = f[0];
+		maxs[n] = f[1];
+		weights[n] = f[2];
+		n++;
+	}
+
+	(void) fclose(fp);
+
+	if (n == 0) {
+		filebench_log(LOG_ERROR, "Histogram file %s is empty", path);
+		return (FILEBENCH_ERROR);
+	}
+
+	*minsp = mins;
+	*maxsp = maxs;
+	*weightsp = weights;
+	*np = n;
+
+	return (FILEBENCH_OK);
+
+error:
+	(void) fclose(fp);
+	free(mins);
+	free(maxs);
+	free(weights);
+	return (FILEBENCH_ERROR);
+}
+
+/*
+ * Builds the lookup table of a random distribution from "n" buckets, each
+ * uniform over [mins[i], maxs[i]] and drawn with relative weight
+ * weights[i]. Bucket bounds are normalized for a table minimum of 0 and
+ * a table mean of 1, and the buckets are laid out as Walker's alias table,
+ * so that a draw costs the same whatever the number of buckets. Returns
+ * FILEBENCH_OK on success, FILEBENCH_ERROR on failure.
+ */
+static int
+rand_table_build(randdist_t *rndp, double *mins, double *maxs,
+    double *weights, uint32_t n)
+{
+	randfunc_t	*rft;
+	double		*q;
+	uint32_t	*small, *large;
+	uint32_t	nsmall = 0, nlarge = 0;
+	uint32_t	i, s, l;
+	double		total = 0.0, tablemean = 0.0, tablemin;
+
+	tablemin = mins[0];
+	for (i = 0; i < n; i++) {
+		total += weights[i];
+		tablemean += ((mins[i] + maxs[i]) / 2.0) * weights[i];
+		if (tablemin > mins[i])
+			tablemin = mins[i];
+	}
+
+	if (total <= 0.0) {
+		filebench_log(LOG_ERROR, "Random table has no weight");
+		return (FILEBENCH_ERROR);
+	}
+
+	tablemean /= total;
+
+	/* If table is not supplied with a mean value, set it to table mean */
+	if (rndp->rnd_dbl_mean == 0.0)
+		rndp->rnd_dbl_mean = tablemean;
+
+	/* Nor with a min value, set it to table min */
+	if (rndp->rnd_min == NULL) {
+		rndp->rnd_min = avd_int_alloc((fbint_t)tablemin);
+		rndp->rnd_vint_min = (fbint_t)tablemin;
+	}
+
+	if ((rft = ipc_randtablealloc(n * sizeof (randfunc_t))) == NULL)
+		return (FILEBENCH_ERROR);
+
+	q = malloc(n * sizeof (double));
+	small = malloc(n * sizeof (uint32_t));
+	large = malloc(n * sizeof (uint32_t));
+	if (q == NULL || small == NULL || large == NULL) {
+		filebench_log(LOG_ERROR, "Out of memory for random table");
+		free(q);
+		free(small);
+		free(large);
+		return (FILEBENCH_ERROR);
+	}
+
+	/* now normalize the entries for a min value of 0, mean of 1 */
+	tablemean -= tablemin;
+	for (i = 0; i < n; i++) {
+		/* special case if really a constant value */
+		if (tablemean == 0.0) {
+			rft[i].rf_base = 0.0;
+			rft[i].rf_range = 0.0;
+		} else {
+			rft[i].rf_base = (mins[i] - tablemin) / tablemean;
+			rft[i].rf_range = (maxs[i] - mins[i]) / tablemean;
+		}
+
+		/* scale the weights to an average of 1 per slot */
+		q[i] = weights[i] * (double)n / total;
+		if (q[i] < 1.0)
+			small[nsmall++] = i;
+		else
+			large[nlarge++] = i;
+	}
+
+	/* top up each light slot with an alias from a heavy one */
+	while (nsmall > 0 && nlarge > 0) {
+		s = small[--nsmall];
+		l = large[--nlarge];
+
+		rft[s].rf_prob = (uint32_t)(q[s] * 4294967296.0);
+		rft[s].rf_alias = l;
+
+		q[l] = (q[l] + q[s]) - 1.0;
+		if (q[l] < 1.0)
+			small[nsmall++] = l;
+		else
+			large[nlarge++] = l;
+	}
+
+	/* whatever is left is full, up to rounding errors */
+	while (nlarge > 0) {
+		l = large[--nlarge];
+		rft[l].rf_prob = UINT32_MAX;
+		rft[l].rf_alias = l;
+	}
+	while (nsmall > 0) {
+		s = small[--nsmall];
+		rft[s].rf_prob = UINT32_MAX;
+		rft[s].rf_alias = s;
+	}
+
+	free(q);
+	free(small);
+	free(large);
+
+	rndp->rnd_rft = rft;
+	rndp->rnd_nrft = n;
+
+	return (FILEBENCH_OK);
+}
+
 /*
  * Define a random entity which will contain the parameters of a random
  * distribution.
@@ -253,14 +770,16 @@ randdist_alloc(void)
 /*
  * Initializes a random distribution entity, converting avd_t parameters to
  * doubles, and converting the list of probability density function table
- * entries, if supplied, into a probablilty function table.
+ * entries or the histogram file, if supplied, into a probablilty function
+ * table.
  */
 void
 randdist_init(randdist_t *rndp)
 {
 	probtabent_t	*rdte_hdp, *ptep;
-	double		tablemean, tablemin = 0;
-	int		pteidx;
+	double		*mins, *maxs, *weights;
+	uint32_t	nent, pteidx;
+	int		percent, ret;
 
 	/* convert parameters to doubles */
 	rndp->rnd_dbl_gamma = (double)avd_get_int(rndp->rnd_gamma) / 1000.0;
@@ -270,7 +789,7 @@ randdist_init(randdist_t *rndp)
 		rndp->rnd_dbl_mean = rndp->rnd_dbl_gamma;
 
 	/* de-reference min and round amounts for later use */
-	rndp->rnd_vint_min  = avd_get_int(rndp->rnd_min);
+	rndp->rnd_vint_min  = rndp->rnd_min ? avd_get_int(rndp->rnd_min) : 0;
 	rndp->rnd_vint_round  = avd_get_int(rndp->rnd_round);
 
 	filebench_log(LOG_DEBUG_IMPL,
@@ -306,66 +825,59 @@ randdist_init(randdist_t *rndp)
 		rndp->rnd_src = fb_rand_src_random;
 	}
 
+	/* any histogram file to load? */
+	if (rndp->rnd_histogram != NULL) {
+		if (rand_histogram_load(avd_get_str(rndp->rnd_histogram),
+		    &mins, &maxs, &weights, &nent) != FILEBENCH_OK) {
+			filebench_shutdown(1);
+			return;
+		}
+
+		ret = rand_table_build(rndp, mins, maxs, weights, nent);
+		free(mins);
+		free(maxs);
+		free(weights);
+		if (ret != FILEBENCH_OK)
+			filebench_shutdown(1);
+		return;
+	}
+
 	/* any random distribution table to convert? */
 	if ((rdte_hdp = rndp->rnd_probtabs) == NULL)
 		return;
 
-	/* determine random distribution max and mins and initialize table */
-	pteidx = 0;
-	tablemean = 0.0;
-	for (ptep = rdte_hdp; ptep; ptep = ptep->pte_next) {
-		double	dmin, dmax;
-		int	entcnt;
-
-		dmax = (double)avd_get_int(ptep->pte_segmax);
-		dmin = (double)avd_get_int(ptep->pte_segmin);
-
-		/* initialize table minimum on first pass */
-		if (pteidx == 0)
-			tablemin = dmin;
-
-		/* update table minimum */
-		if (tablemin > dmin)
-			tablemin = dmin;
+	nent = 0;
+	for (ptep = rdte_hdp; ptep; ptep = ptep->pte_next)
+		nent++;
 
-		entcnt = (int)avd_get_int(ptep->pte_percent);
-		tablemean += (((dmin + dmax)/2.0) * (double)entcnt);
-
-		/* populate the lookup table */
+	mins = malloc(nent * sizeof (double));
+	maxs = malloc(nent * sizeof (double));
+	weights = malloc(nent * sizeof (double));
+	if (mins == NULL || maxs == NULL || weights == NULL) {
+		filebench_log(LOG_ERROR, "Out of memory for random table");
+		filebench_shutdown(1);
+		return;
+	}
 
-		for (; entcnt > 0; entcnt--) {
-			rndp->rnd_rft[pteidx].rf_base = dmin;
-			rndp->rnd_rft[pteidx].rf_range = dmax - dmin;
-			pteidx++;
-		}
+	/* gather the table segments, weighted by their percentage */
+	percent = 0;
+	for (ptep = rdte_hdp, pteidx = 0; ptep;
+	    ptep = ptep->pte_next, pteidx++) {
+		mins[pteidx] = (double)avd_get_int(ptep->pte_segmin);
+		maxs[pteidx] = (double)avd_get_int(ptep->pte_segmax);
+		weights[pteidx] = (double)avd_get_int(ptep->pte_percent);
+		percent += (int)avd_get_int(ptep->pte_percent);
 	}
 
 	/* check to see if probability equals 100% */
-	if (pteidx != PF_TAB_SIZE)
+	if (percent != PF_TAB_PERCENT)
 		filebench_log(LOG_ERROR,
-		    "Prob table only totals %d%%", pteidx);
+		    "Prob table only totals %d%%", percent);
 
-	/* If table is not supplied with a mean value, set it to table mean */
-	if (rndp->rnd_dbl_mean == 0.0)
-		rndp->rnd_dbl_mean = (double)tablemean / (double)PF_TAB_SIZE;
-
-	/* now normalize the entries for a min value of 0, mean of 1 */
-	tablemean = (tablemean / 100.0) - tablemin;
-
-	/* special case if really a constant value */
-	if (tablemean == 0.0) {
-		for (pteidx = 0; pteidx < PF_TAB_SIZE; pteidx++) {
-			rndp->rnd_rft[pteidx].rf_base = 0.0;
-			rndp->rnd_rft[pteidx].rf_range = 0.0;
-		}
-		return;
-	}
-
-	for (pteidx = 0; pteidx < PF_TAB_SIZE; pteidx++) {
-
-		rndp->rnd_rft[pteidx].rf_base =
-		    ((rndp->rnd_rft[pteidx].rf_base - tablemin) / tablemean);
-		rndp->rnd_rft[pteidx].rf_range =
-		    (rndp->rnd_rft[pteidx].rf_range / tablemean);
-	}
+	ret = rand_table_build(rndp, mins, maxs, weights, nent);
+	free(mins);
+	free(maxs);
+	free(weights);
+	if (ret != FILEBENCH_OK)
+		filebench_shutdown(1);
 }
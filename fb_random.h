@@ -42,17 +42,21 @@ typedef struct probtabent {
 } probtabent_t;
 
 /*
- * The supplied probability table is converted into a probability funtion
- * lookup table at initialization time. This is the definition for each
- * entry in the table.
+ * The supplied probability table or histogram file is converted into a
+ * probability function lookup table at initialization time. Each entry
+ * is a bucket, uniform over [rf_base, rf_base + rf_range], and a slot of
+ * Walker's alias table: a draw landing in the slot returns the bucket
+ * itself with probability rf_prob / 2^32 and bucket rf_alias otherwise.
  */
 typedef struct randfunc {
 	double		rf_base;
 	double		rf_range;
+	uint32_t	rf_prob;
+	uint32_t	rf_alias;
 } randfunc_t;
 
-/* Number of entries in the probability function table */
-#define	PF_TAB_SIZE	100
+/* Total of the percentages of a probability table */
+#define	PF_TAB_PERCENT	100
 
 /*
  * Random Distribution definition object. Includes a pointer to the
@@ -74,7 +78,9 @@ typedef struct randdist {
 	fbint_t		rnd_vint_min;
 	fbint_t		rnd_vint_round;
 	probtabent_t	*rnd_probtabs;
-	randfunc_t	rnd_rft[PF_TAB_SIZE];
+	avd_t		rnd_histogram;	/* Histogram file of the table */
+	randfunc_t	*rnd_rft;	/* Lookup table, in shared memory */
+	uint32_t	rnd_nrft;
 	uint16_t	rnd_xi[3];
 	uint16_t	rnd_type;
 } randdist_t;
@@ -94,11 +100,126 @@ typedef struct randdist {
 #define	RAND_PARAM_GAMMA	6
 #define	RAND_PARAM_ROUND	7
 
+/*
+ * Fast generator for the random numbers drawn on every I/O. It is
+ * xoshiro256** by D. Blackman and S. Vigna; each user keeps its own
+ * state, so no locks or shared cache lines are involved.
+ */
+typedef struct fb_rand {
+	uint64_t	fr_s[4];
+} fb_rand_t;
+
+static inline uint64_t
+fb_rand_rotl(uint64_t x, int k)
+{
+	return ((x << k) | (x >> (64 - k)));
+}
+
+static inline uint64_t
+fb_rand_next(fb_rand_t *rng)
+{
+	uint64_t *s = rng->fr_s;
+	uint64_t result = fb_rand_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = fb_rand_rotl(s[3], 45);
+
+	return (result);
+}
+
+/* Returns a random double in [0, 1) */
+static inline double
+fb_rand_double(fb_rand_t *rng)
+{
+	return ((fb_rand_next(rng) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+/*
+ * Scales a random 64-bit "r" into [0, n), by multiply-shift: returns the
+ * high 64 bits of r * n. Compilers without a 128-bit integer type, as on
+ * most 32-bit targets, get it from four 32 x 32 bit products.
+ */
+static inline uint64_t
+fb_rand_scale(uint64_t r, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+	return ((uint64_t)(((unsigned __int128)r * n) >> 64));
+#else
+	uint64_t rlo = r & 0xffffffffULL, rhi = r >> 32;
+	uint64_t nlo = n & 0xffffffffULL, nhi = n >> 32;
+	uint64_t lolo = rlo * nlo;
+	uint64_t lohi = rlo * nhi;
+	uint64_t hilo = rhi * nlo;
+	uint64_t mid;
+
+	mid = (lolo >> 32) + (lohi & 0xffffffffULL) + (hilo & 0xffffffffULL);
+	return (rhi * nhi + (lohi >> 32) + (hilo >> 32) + (mid >> 32));
+#endif
+}
+
+/* Returns a random integer in [0, n) */
+static inline uint64_t
+fb_rand_range(fb_rand_t *rng, uint64_t n)
+{
+	return (fb_rand_scale(fb_rand_next(rng), n));
+}
+
+/*
+ * Ring of random numbers for the hottest draws, such as I/O offsets. It
+ * is refilled a batch at a time by FB_RANDRING_LANES interleaved
+ * xoshiro256** generators, which the compiler can vectorize, so that a
+ * draw is just a load.
+ */
+#define	FB_RANDRING_LANES	4
+#define	FB_RANDRING_SIZE	256
+
+typedef struct fb_randring {
+	uint64_t	rr_s[4][FB_RANDRING_LANES]; /* State word by lane */
+	int		rr_next;	/* Next unused number in rr_buf */
+	uint64_t	rr_buf[FB_RANDRING_SIZE];
+} fb_randring_t;
+
+/*
+ * Zipf distribution over the ranks [1, fz_n], sampled by
+ * rejection-inversion.
+ */
+typedef struct fb_zipf {
+	uint64_t	fz_n;
+	double		fz_theta;	/* Exponent */
+	double		fz_hx1;		/* Rejection-inversion constants */
+	double		fz_hn;
+	double		fz_s;
+} fb_zipf_t;
+
 /* Function declarations */
 extern void fb_random64(uint64_t *, uint64_t, uint64_t, avd_t);
 extern void fb_random32(uint32_t *, uint32_t, uint32_t, avd_t);
+extern double fb_random_probability(void);
+
+extern void fb_rand_seed(fb_rand_t *, uint64_t);
+extern void fb_random_setthread(fb_rand_t *);
+extern void fb_randring_seed(fb_randring_t *, fb_rand_t *);
+extern void fb_randring_fill(fb_randring_t *);
+extern void fb_random_bench(void);
+extern uint64_t fb_coprime_stride(uint64_t);
+extern void fb_zipf_init(fb_zipf_t *, uint64_t, double);
+extern uint64_t fb_zipf_next(fb_zipf_t *, fb_rand_t *);
 
 extern randdist_t *randdist_alloc(void);
 extern void randdist_init(randdist_t *rndp);
 
+/* Returns the next number of a ring, refilling it if it ran out */
+static inline uint64_t
+fb_randring_next(fb_randring_t *rr)
+{
+	if (rr->rr_next == FB_RANDRING_SIZE)
+		fb_randring_fill(rr);
+	return (rr->rr_buf[rr->rr_next++]);
+}
+
 #endif	/* _FB_RANDOM_H */
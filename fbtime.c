@@ -1,4 +1,5 @@
 #include <sys/time.h>
+#include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "fbtime.h"
@@ -7,10 +8,37 @@
 
 /*
  * If we don't have gethrtime() function provided by the environment (which is
- * usually provided only by Solaris) then we use gettimeofdate().
+ * usually provided only by Solaris) then we use clock_gettime() with the
+ * raw monotonic clock, which has nanosecond resolution and is neither
+ * stepped nor slewed by NTP, so latencies can be neither quantized to
+ * microseconds nor negative. If the kernel does not support
+ * CLOCK_MONOTONIC_RAW we fall back to CLOCK_MONOTONIC. All processes run
+ * on the same kernel, so they all end up using the same clock and their
+ * timestamps remain comparable. Without clock_gettime() we use
+ * gettimeofday().
  */
 
 #ifndef HAVE_GETHRTIME
+#ifdef HAVE_CLOCK_GETTIME
+#ifdef CLOCK_MONOTONIC_RAW
+static clockid_t fb_clockid = CLOCK_MONOTONIC_RAW;
+#else
+static clockid_t fb_clockid = CLOCK_MONOTONIC;
+#endif
+
+hrtime_t
+gethrtime(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(fb_clockid, &ts) != 0) {
+		fb_clockid = CLOCK_MONOTONIC;
+		(void) clock_gettime(fb_clockid, &ts);
+	}
+
+	return ((hrtime_t)ts.tv_sec * 1000000000UL + (hrtime_t)ts.tv_nsec);
+}
+#else
 hrtime_t
 gethrtime(void)
 {
@@ -24,4 +52,65 @@ gethrtime(void)
 
 	return hrt;
 }
+#endif /* HAVE_CLOCK_GETTIME */
 #endif /* HAVE_GETHRTIME */
+
+/*
+ * Name of the clock gethrtime() reads.
+ */
+static const char *
+fbtime_clockname(void)
+{
+#ifdef HAVE_GETHRTIME
+	return ("gethrtime()");
+#elif defined(HAVE_CLOCK_GETTIME)
+#ifdef CLOCK_MONOTONIC_RAW
+	if (fb_clockid == CLOCK_MONOTONIC_RAW)
+		return ("CLOCK_MONOTONIC_RAW");
+#endif
+	return ("CLOCK_MONOTONIC");
+#else
+	return ("gettimeofday()");
+#endif
+}
+
+#define	FBTIME_CALLS	100000
+
+/*
+ * Checks the clock behind gethrtime() and reports its cost. Timestamps
+ * are taken back to back: the smallest non-zero step between two of
+ * them bounds the effective resolution of the clock, any step backwards
+ * is reported as an error, and the average step is the cost of a call,
+ * which every flowop pays twice to measure its latency.
+ */
+void
+fbtime_init(void)
+{
+	hrtime_t first, prev, now;
+	hrtime_t step, minstep = 0;
+	int backwards = 0;
+	int i;
+
+	first = prev = gethrtime();
+	for (i = 0; i < FBTIME_CALLS; i++) {
+		now = gethrtime();
+		if (now < prev) {
+			backwards++;
+		} else {
+			step = now - prev;
+			if (step && (!minstep || step < minstep))
+				minstep = step;
+		}
+		prev = now;
+	}
+
+	if (backwards)
+		filebench_log(LOG_ERROR, "Clock %s went backwards %d times "
+		    "in %d calls", fbtime_clockname(), backwards,
+		    FBTIME_CALLS);
+
+	filebench_log(LOG_INFO, "Clock %s: smallest step %lluns, "
+	    "%.1fns per gethrtime() call", fbtime_clockname(),
+	    (unsigned long long)minstep,
+	    (double)(prev - first) / FBTIME_CALLS);
+}
@@ -12,6 +12,8 @@ typedef uint64_t hrtime_t;
 hrtime_t gethrtime(void);
 #endif
 
+void fbtime_init(void);
+
 #define	SEC2NS_FLOAT (double)1000000000.0
 #define	SEC2MS_FLOAT (double)1000000.0
 
@@ -100,6 +100,8 @@ typedef unsigned int uint_t;
 #endif
 #ifndef HAVE_AIO_WRITE64
 	#define aio_write64 aio_write
+	#define aio_read64 aio_read
+	#define aio_suspend64 aio_suspend
 	#define aiocb64 aiocb
 #endif
 #ifndef HAVE_AIO_RETURN64
@@ -114,6 +116,9 @@ typedef unsigned int uint_t;
 #ifndef HAVE_FSTAT64
 	#define fstat64 fstat
 #endif
+#ifndef HAVE_FSTATAT64
+	#define fstatat64 fstatat
+#endif
 #ifndef HAVE_LSEEK64
 	#define lseek64 lseek
 #endif
@@ -132,10 +137,10 @@ typedef unsigned int uint_t;
 #include "procflow.h"
 #include "misc.h"
 #include "fsplug.h"
+#include "fb_random.h"
 #include "fileset.h"
 #include "threadflow.h"
 #include "flowop.h"
-#include "fb_random.h"
 #include "ipc.h"
 
 extern pid_t my_pid;		/* this process' process id */
@@ -39,6 +39,11 @@
 #include "utils.h"
 #include "fsplug.h"
 
+#ifdef HAVE_FICLONERANGE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 static int filecreate_done;
 
 /*
@@ -65,9 +70,60 @@ static int filecreate_done;
  * instantiate all the files in the fileset before trying to use them.
  */
 
-/* maximum parallel allocation control */
+/* number of threads doing parallel allocation */
 #define	MAX_PARALLOC_THREADS 32
 
+/*
+ * With paralloc set, the directory tree of a fileset is removed and
+ * created, and its files and leaf directories pre-allocated, by a fixed
+ * pool of threads serving a bounded queue of tasks. Entries are batched,
+ * so that a task carries up to FILESET_ALLOC_BATCH entries or, for files,
+ * FILE_ALLOC_BLOCK bytes, whichever comes first. Each thread owns one
+ * aligned write buffer for the whole run.
+ */
+#define	FILESET_ALLOC_BATCH	64
+#define	FILESET_ALLOC_QUEUE	(2 * MAX_PARALLOC_THREADS)
+
+/* task operations */
+#define	FILESET_TASK_FILE	0	/* pre-allocate files */
+#define	FILESET_TASK_LEAFDIR	1	/* pre-allocate leaf directories */
+#define	FILESET_TASK_MKDIR	2	/* create directories */
+#define	FILESET_TASK_RMTREE	3	/* remove a subtree */
+
+/*
+ * Levels of an old tree below its root that are listed to find subtrees
+ * to remove in parallel.
+ */
+#define	FILESET_RMTREE_SPLIT	2
+
+typedef struct fileset_alloc_task {
+	int		at_op;		/* FILESET_TASK_* */
+	int		at_nentries;
+	off64_t		at_bytes;
+	filesetentry_t	*at_entries[FILESET_ALLOC_BATCH];
+	char		*at_path;	/* malloc'ed, for FILESET_TASK_RMTREE */
+} fileset_alloc_task_t;
+
+static struct fileset_allocpool {
+	pthread_mutex_t	ap_lock;
+	pthread_cond_t	ap_work_cv;	/* tasks queued or shutting down */
+	pthread_cond_t	ap_done_cv;	/* queue space freed or task done */
+	int		ap_nthreads;
+	int		ap_head;	/* next task to take */
+	int		ap_count;	/* queued tasks */
+	int		ap_active;	/* tasks being worked on */
+	int		ap_shutdown;
+	int		ap_error;
+	pthread_t	ap_threads[MAX_PARALLOC_THREADS];
+	char		*ap_bufs[MAX_PARALLOC_THREADS];
+	fileset_alloc_task_t ap_pending; /* batch being filled */
+	fileset_alloc_task_t ap_queue[FILESET_ALLOC_QUEUE];
+} fileset_allocpool = {
+	.ap_lock = PTHREAD_MUTEX_INITIALIZER,
+	.ap_work_cv = PTHREAD_COND_INITIALIZER,
+	.ap_done_cv = PTHREAD_COND_INITIALIZER
+};
+
 /*
  * returns pointer to file or fileset
  * string, as appropriate
@@ -104,32 +160,169 @@ trunc_dirname(char *dir)
 }
 
 /*
- * Creates a path string from the filesetentry_t "*entry"
- * and all of its parent's path names. The resulting path
- * is a concatination of all the individual parent paths.
- * Allocates memory for the path string and returns a
- * pointer to it.
+ * Writes the full pathname of the filesetentry_t "*entry", that is the
+ * fileset's path and name followed by the entry's path within the
+ * fileset, into the "len" bytes at "path". Directory entries keep their
+ * whole path within the fileset in fse_path, and files and leaf
+ * directories just their own name, so this never has to walk up the
+ * tree or allocate memory. Returns FILEBENCH_ERROR if the path does not
+ * fit, FILEBENCH_OK otherwise.
+ */
+int
+fileset_fullpath(filesetentry_t *entry, char *path, size_t len)
+{
+	fileset_t *fileset = entry->fse_fileset;
+	int n;
+
+	if ((entry->fse_flags & FSE_TYPE_MASK) == FSE_TYPE_DIR)
+		n = snprintf(path, len, "%s/%s%s",
+		    avd_get_str(fileset->fs_path),
+		    avd_get_str(fileset->fs_name), entry->fse_path);
+	else
+		n = snprintf(path, len, "%s/%s%s/%s",
+		    avd_get_str(fileset->fs_path),
+		    avd_get_str(fileset->fs_name),
+		    entry->fse_parent->fse_path, entry->fse_path);
+
+	if (n < 0 || n >= len) {
+		filebench_log(LOG_ERROR, "Path of %s is too long",
+		    entry->fse_path);
+		return (FILEBENCH_ERROR);
+	}
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Fills in the path of the manifest of a fileset, which lives next to
+ * the fileset's root directory. See fileset_manifest_write().
+ */
+static int
+fileset_manifest_path(fileset_t *fileset, char *path, size_t len)
+{
+	int n;
+
+	n = snprintf(path, len, "%s/.%s.fbmanifest",
+	    avd_get_str(fileset->fs_path), avd_get_str(fileset->fs_name));
+
+	return (((n < 0) || (n >= len)) ? FILEBENCH_ERROR : FILEBENCH_OK);
+}
+
+/*
+ * Removes the manifest of a fileset once entries are created or deleted,
+ * as it no longer describes what is on the storage. Only the first call
+ * after the manifest was written or loaded does anything.
+ */
+static void
+fileset_manifest_invalidate(fileset_t *fileset)
+{
+	char path[MAXPATHLEN];
+
+	if (!__atomic_exchange_n(&fileset->fs_manifest_armed, 0,
+	    __ATOMIC_RELAXED))
+		return;
+
+	if (fileset_manifest_path(fileset, path, sizeof (path)) == FILEBENCH_OK)
+		(void) unlink(path);
+}
+
+/*
+ * Per process cache of open directory fds, one table per fileset indexed
+ * by the directory's fse_index. Slots hold fd + 1 so that zero means not
+ * yet opened. Descriptors are opened on first use and kept open for the
+ * life of the process.
+ */
+static int *fileset_dirfd_cache[FILEBENCH_NFILESETS];
+
+/*
+ * Returns a cached fd for the supplied directory entry, opening it if this
+ * is the first use in this process. Returns -1 if the directory can not
+ * be opened, e.g. because it does not exist yet or we ran out of fds; the
+ * caller then falls back to full paths.
  */
-char *
-fileset_resolvepath(filesetentry_t *entry)
+static int
+fileset_dirfd(filesetentry_t *dir)
 {
-	filesetentry_t *fsep = entry;
+	fileset_t *fileset = dir->fse_fileset;
 	char path[MAXPATHLEN];
-	char pathtmp[MAXPATHLEN];
-	char *s;
+	int **tablep;
+	int *table;
+	int expect = 0;
+	int fd;
+
+	tablep = &fileset_dirfd_cache[fileset - filebench_shm->shm_fileset];
+	table = __atomic_load_n(tablep, __ATOMIC_ACQUIRE);
+	if (table == NULL) {
+		int *newtable;
+
+		newtable = calloc(fileset->fs_realdirs, sizeof (int));
+		if (newtable == NULL)
+			return (-1);
+		if (__atomic_compare_exchange_n(tablep, &table, newtable,
+		    FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			table = newtable;
+		else
+			free(newtable);
+	}
+
+	if (dir->fse_index >= fileset->fs_realdirs)
+		return (-1);
+
+	fd = __atomic_load_n(&table[dir->fse_index], __ATOMIC_RELAXED);
+	if (fd)
+		return (fd - 1);
+
+	if (fileset_fullpath(dir, path, sizeof (path)) == FILEBENCH_ERROR)
+		return (-1);
+#ifdef O_DIRECTORY
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+#else
+	fd = open(path, O_RDONLY);
+#endif
+	if (fd < 0)
+		return (-1);
+
+	/* another thread may have beaten us to it */
+	if (!__atomic_compare_exchange_n(&table[dir->fse_index], &expect,
+	    fd + 1, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		(void) close(fd);
+		return (expect - 1);
+	}
+
+	return (fd);
+}
 
-	path[0] = '\0';
-	while (fsep->fse_parent) {
-		(void) strcpy(pathtmp, "/");
-		(void) fb_strlcat(pathtmp, fsep->fse_path, MAXPATHLEN);
-		(void) fb_strlcat(pathtmp, path, MAXPATHLEN);
-		(void) fb_strlcpy(path, pathtmp, MAXPATHLEN);
-		fsep = fsep->fse_parent;
+/*
+ * Works out how to reach the supplied entry. If the fileset has the
+ * "dirfds" attribute set and its parent directory can be opened, then
+ * *dirfdp is set to the cached fd of the parent and *namep to the entry's
+ * name within it, ready for the FB_*AT() calls. Otherwise *dirfdp is set
+ * to AT_FDCWD and *namep to the entry's full path, built in "path".
+ * Returns FILEBENCH_ERROR if the full path does not fit, FILEBENCH_OK
+ * otherwise.
+ */
+int
+fileset_locate(filesetentry_t *entry, char *path, size_t len,
+    int *dirfdp, char **namep)
+{
+	fileset_t *fileset = entry->fse_fileset;
+	filesetentry_t *parent = entry->fse_parent;
+	char *name;
+	int dirfd;
+
+	if (parent && fileset->fs_dirfds && avd_get_bool(fileset->fs_dirfds) &&
+	    ((dirfd = fileset_dirfd(parent)) >= 0)) {
+		name = entry->fse_path;
+		if ((entry->fse_flags & FSE_TYPE_MASK) == FSE_TYPE_DIR)
+			name = strrchr(name, '/') + 1;
+		*dirfdp = dirfd;
+		*namep = name;
+		return (FILEBENCH_OK);
 	}
 
-	s = malloc(strlen(path) + 1);
-	(void) fb_strlcpy(s, path, MAXPATHLEN);
-	return (s);
+	*dirfdp = AT_FDCWD;
+	*namep = path;
+	return (fileset_fullpath(entry, path, len));
 }
 
 /*
@@ -189,30 +382,22 @@ null_str:
 }
 
 /*
- * creates the subdirectory tree for a fileset.
+ * Creates the directory of a fileset directory entry. Its parent usually
+ * exists already, so a plain mkdir is tried first.
  */
 static int
-fileset_create_subdirs(fileset_t *fileset, char *filesetpath)
+fileset_create_dir(filesetentry_t *direntry)
 {
-	filesetentry_t *direntry;
-	char full_path[MAXPATHLEN];
-	char *part_path;
+	char path[MAXPATHLEN];
 
-	/* walk the subdirectory list, enstanciating subdirs */
-	direntry = fileset->fs_dirlist;
-	while (direntry) {
-		(void) fb_strlcpy(full_path, filesetpath, MAXPATHLEN);
-		part_path = fileset_resolvepath(direntry);
-		(void) fb_strlcat(full_path, part_path, MAXPATHLEN);
-		free(part_path);
-
-		/* now create this portion of the subdirectory tree */
-		if (fileset_mkdir(full_path, 0755) == FILEBENCH_ERROR)
-			return (FILEBENCH_ERROR);
+	if (fileset_fullpath(direntry, path, sizeof (path)) == FILEBENCH_ERROR)
+		return (FILEBENCH_ERROR);
 
-		direntry = direntry->fse_nextoftype;
-	}
-	return (FILEBENCH_OK);
+	if ((FB_MKDIR(path, 0755) == 0) || (errno == EEXIST))
+		return (FILEBENCH_OK);
+
+	/* now create this portion of the subdirectory tree */
+	return (fileset_mkdir(path, 0755));
 }
 
 /*
@@ -234,18 +419,13 @@ fileset_move_entry(avl_tree_t *src_tree, avl_tree_t *dst_tree,
 static int
 fileset_alloc_leafdir(filesetentry_t *entry)
 {
-	fileset_t *fileset;
 	char path[MAXPATHLEN];
 	struct stat64 sb;
-	char *pathtmp;
 
-	fileset = entry->fse_fileset;
-	(void) fb_strlcpy(path, avd_get_str(fileset->fs_path), MAXPATHLEN);
-	(void) fb_strlcat(path, "/", MAXPATHLEN);
-	(void) fb_strlcat(path, avd_get_str(fileset->fs_name), MAXPATHLEN);
-	pathtmp = fileset_resolvepath(entry);
-	(void) fb_strlcat(path, pathtmp, MAXPATHLEN);
-	free(pathtmp);
+	if (fileset_fullpath(entry, path, sizeof (path)) == FILEBENCH_ERROR) {
+		fileset_unbusy(entry, TRUE, FALSE, 0);
+		return (FILEBENCH_ERROR);
+	}
 
 	filebench_log(LOG_DEBUG_IMPL, "Populated %s", entry->fse_path);
 
@@ -267,30 +447,281 @@ fileset_alloc_leafdir(filesetentry_t *entry)
 	return (FILEBENCH_OK);
 }
 
+/*
+ * Allocates a FILE_ALLOC_BLOCK sized, page aligned buffer to write
+ * pre-allocation data from. Returns NULL on failure.
+ */
+static char *
+fileset_alloc_buf(void)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, FILE_ALLOC_BLOCK) != 0) {
+		filebench_log(LOG_ERROR,
+		    "Failed to allocate pre-allocation buffer");
+		return (NULL);
+	}
+
+	(void) memset(buf, 0, FILE_ALLOC_BLOCK);
+	return ((char *)buf);
+}
+
+/*
+ * Maps the allocmode attribute of a fileset onto FILESET_ALLOC_*.
+ * Returns -1 for unknown modes.
+ */
+static int
+fileset_allocmethod(fileset_t *fileset)
+{
+	char *mode = NULL;
+
+	if (fileset->fs_allocmode)
+		mode = avd_get_str(fileset->fs_allocmode);
+
+	if ((mode == NULL) || (strcmp(mode, "write") == 0))
+		return (FILESET_ALLOC_WRITE);
+	if (strcmp(mode, "fallocate") == 0)
+		return (FILESET_ALLOC_FALLOCATE);
+	if (strcmp(mode, "zero") == 0)
+		return (FILESET_ALLOC_ZERO);
+	if (strcmp(mode, "sparse") == 0)
+		return (FILESET_ALLOC_SPARSE);
+	if (strcmp(mode, "clone") == 0)
+		return (FILESET_ALLOC_CLONE);
+
+	filebench_log(LOG_ERROR, "%s %s: unknown allocmode %s",
+	    fileset_entity_name(fileset), avd_get_str(fileset->fs_name), mode);
+	return (-1);
+}
+
+/*
+ * Opens the template file that the files of an allocmode=clone fileset
+ * are cloned from. It lives, unlinked, in the fileset's root directory
+ * "dirpath" so that it is on the same file system as the files.
+ */
+static int
+fileset_clonesrc_open(fileset_t *fileset, char *dirpath)
+{
+	char path[MAXPATHLEN];
+	struct stat64 sb;
+	int fd;
+
+	(void) snprintf(path, sizeof (path), "%s/.fbclone.%d",
+	    dirpath, (int)getpid());
+
+	if ((fd = open64(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		filebench_log(LOG_ERROR, "Failed to create clone template %s: %s",
+		    path, strerror(errno));
+		return (FILEBENCH_ERROR);
+	}
+	(void) unlink(path);
+
+	if (fstat64(fd, &sb) != 0) {
+		(void) close(fd);
+		return (FILEBENCH_ERROR);
+	}
+
+	(void) pthread_mutex_init(&fileset->fs_clone_lock,
+	    ipc_mutexattr(IPC_MUTEX_NORMAL));
+	fileset->fs_clonefd = fd;
+	fileset->fs_clonesize = 0;
+	fileset->fs_cloneblksize = sb.st_blksize;
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Closes the clone template of a fileset, if it has one.
+ */
+static void
+fileset_clonesrc_close(fileset_t *fileset)
+{
+	if (fileset->fs_clonefd < 0)
+		return;
+
+	(void) close(fileset->fs_clonefd);
+	fileset->fs_clonefd = -1;
+}
+
+/*
+ * Makes sure the clone template holds at least "size" bytes, writing
+ * more of "buf" into it as needed.
+ */
+static int
+fileset_clonesrc_grow(fileset_t *fileset, off64_t size, char *buf)
+{
+	int ret = FILEBENCH_OK;
+
+	(void) pthread_mutex_lock(&fileset->fs_clone_lock);
+	while (fileset->fs_clonesize < size) {
+		if (pwrite64(fileset->fs_clonefd, buf, FILE_ALLOC_BLOCK,
+		    fileset->fs_clonesize) != FILE_ALLOC_BLOCK) {
+			filebench_log(LOG_ERROR,
+			    "Failed to write clone template: %s",
+			    strerror(errno));
+			ret = FILEBENCH_ERROR;
+			break;
+		}
+		fileset->fs_clonesize += FILE_ALLOC_BLOCK;
+	}
+	(void) pthread_mutex_unlock(&fileset->fs_clone_lock);
+
+	return (ret);
+}
+
+/*
+ * Writes zeroed data from "buf" to the file, from offset "seek", which
+ * must be the file's current offset, up to "size".
+ */
+static int
+fileset_alloc_write(fb_fdesc_t *fdesc, off64_t seek, off64_t size, char *buf)
+{
+	while (seek < size) {
+		off64_t wsize;
+
+		/*
+		 * Write FILE_ALLOC_BLOCK's worth,
+		 * except on last write
+		 */
+		wsize = MIN(size - seek, FILE_ALLOC_BLOCK);
+
+		if (FB_WRITE(fdesc, buf, wsize) != wsize)
+			return (FILEBENCH_ERROR);
+		seek += wsize;
+	}
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Fills the file with "size" bytes copied from the fileset's clone
+ * template, sharing the template's extents where the file system allows.
+ * Returns FILEBENCH_NORSC if the file system can neither clone nor copy
+ * between the two files.
+ */
+static int
+fileset_alloc_clone(fileset_t *fileset, fb_fdesc_t *fdesc, off64_t size,
+    char *buf)
+{
+	if (fileset_clonesrc_grow(fileset, size, buf) == FILEBENCH_ERROR)
+		return (FILEBENCH_ERROR);
+
+#ifdef HAVE_FICLONERANGE
+	{
+		struct file_clone_range fcr;
+		off64_t aligned;
+
+		/* only whole blocks can be cloned, write the rest */
+		aligned = size - (size % fileset->fs_cloneblksize);
+		fcr.src_fd = fileset->fs_clonefd;
+		fcr.src_offset = 0;
+		fcr.src_length = aligned;
+		fcr.dest_offset = 0;
+		if ((aligned > 0) &&
+		    (ioctl(fdesc->fd_num, FICLONERANGE, &fcr) == 0)) {
+			if (FB_LSEEK(fdesc, aligned, SEEK_SET) < 0)
+				return (FILEBENCH_ERROR);
+			return (fileset_alloc_write(fdesc, aligned, size, buf));
+		}
+	}
+#endif /* HAVE_FICLONERANGE */
+
+#ifdef HAVE_COPY_FILE_RANGE
+	{
+		loff_t in = 0;
+		loff_t out = 0;
+		ssize_t ret = 0;
+
+		while (out < size) {
+			ret = copy_file_range(fileset->fs_clonefd, &in,
+			    fdesc->fd_num, &out, size - out, 0);
+			if (ret <= 0)
+				break;
+		}
+
+		if (out == size)
+			return (FILEBENCH_OK);
+		if ((out > 0) || (ret == 0))
+			return (FILEBENCH_ERROR);
+	}
+#endif /* HAVE_COPY_FILE_RANGE */
+
+	return (FILEBENCH_NORSC);
+}
+
+/*
+ * Pre-allocates "size" bytes of data for a newly created, or too short,
+ * file the way the fileset's allocmode asks for. If that is not supported
+ * here, logs so once and falls back to writing the data.
+ */
+static int
+fileset_alloc_data(fileset_t *fileset, fb_fdesc_t *fdesc, off64_t size,
+    char *buf)
+{
+	int method = fileset->fs_allocmethod;
+	int ret = FILEBENCH_NORSC;
+
+	switch (method) {
+	case FILESET_ALLOC_WRITE:
+		return (fileset_alloc_write(fdesc, 0, size, buf));
+	case FILESET_ALLOC_SPARSE:
+		if (FB_FTRUNC(fdesc, size) != 0)
+			return (FILEBENCH_ERROR);
+		return (FILEBENCH_OK);
+#ifdef HAVE_FALLOCATE
+	case FILESET_ALLOC_FALLOCATE:
+		if (fallocate(fdesc->fd_num, 0, 0, size) == 0)
+			return (FILEBENCH_OK);
+		if ((errno != EOPNOTSUPP) && (errno != ENOSYS))
+			return (FILEBENCH_ERROR);
+		break;
+#ifdef FALLOC_FL_ZERO_RANGE
+	case FILESET_ALLOC_ZERO:
+		if (fallocate(fdesc->fd_num, FALLOC_FL_ZERO_RANGE, 0, size) == 0)
+			return (FILEBENCH_OK);
+		if ((errno != EOPNOTSUPP) && (errno != ENOSYS))
+			return (FILEBENCH_ERROR);
+		break;
+#endif /* FALLOC_FL_ZERO_RANGE */
+#endif /* HAVE_FALLOCATE */
+	case FILESET_ALLOC_CLONE:
+		ret = fileset_alloc_clone(fileset, fdesc, size, buf);
+		break;
+	}
+
+	if (ret != FILEBENCH_NORSC)
+		return (ret);
+
+	if (__atomic_exchange_n(&fileset->fs_allocmethod, FILESET_ALLOC_WRITE,
+	    __ATOMIC_RELAXED) == method)
+		filebench_log(LOG_INFO, "allocmode %s is not supported for %s,"
+		    " writing the data instead",
+		    avd_get_str(fileset->fs_allocmode),
+		    avd_get_str(fileset->fs_name));
+
+	return (fileset_alloc_write(fdesc, 0, size, buf));
+}
+
 /*
  * given a fileset entry, determines if the associated file
- * needs to be allocated or not, and if so does the allocation.
+ * needs to be allocated or not, and if so does the allocation,
+ * writing from the supplied FILE_ALLOC_BLOCK sized buffer.
  */
 static int
-fileset_alloc_file(filesetentry_t *entry)
+fileset_alloc_file(filesetentry_t *entry, char *buf)
 {
 	fileset_t *fileset;
 	char path[MAXPATHLEN];
-	char *buf;
 	struct stat64 sb;
-	char *pathtmp;
-	off64_t seek;
 	fb_fdesc_t fdesc;
 	int trust_tree;
 	int fs_readonly;
 
 	fileset = entry->fse_fileset;
-	(void) fb_strlcpy(path, avd_get_str(fileset->fs_path), MAXPATHLEN);
-	(void) fb_strlcat(path, "/", MAXPATHLEN);
-	(void) fb_strlcat(path, avd_get_str(fileset->fs_name), MAXPATHLEN);
-	pathtmp = fileset_resolvepath(entry);
-	(void) fb_strlcat(path, pathtmp, MAXPATHLEN);
-	free(pathtmp);
+	if (fileset_fullpath(entry, path, sizeof (path)) == FILEBENCH_ERROR) {
+		fileset_unbusy(entry, TRUE, FALSE, 0);
+		return (FILEBENCH_ERROR);
+	}
 
 	filebench_log(LOG_DEBUG_IMPL, "Populated %s", entry->fse_path);
 
@@ -347,39 +778,18 @@ fileset_alloc_file(filesetentry_t *entry)
 		}
 	}
 
-	if ((buf = (char *)malloc(FILE_ALLOC_BLOCK)) == NULL) {
-		/* unbusy the unallocated entry */
+	if (fileset_alloc_data(fileset, &fdesc, entry->fse_size, buf)
+	    == FILEBENCH_ERROR) {
+		filebench_log(LOG_ERROR,
+		    "Failed to pre-allocate file %s: %s",
+		    path, strerror(errno));
+		(void) FB_CLOSE(&fdesc);
 		fileset_unbusy(entry, TRUE, FALSE, 0);
 		return (FILEBENCH_ERROR);
 	}
 
-	for (seek = 0; seek < entry->fse_size; ) {
-		off64_t wsize;
-		int ret = 0;
-
-		/*
-		 * Write FILE_ALLOC_BLOCK's worth,
-		 * except on last write
-		 */
-		wsize = MIN(entry->fse_size - seek, FILE_ALLOC_BLOCK);
-
-		ret = FB_WRITE(&fdesc, buf, wsize);
-		if (ret != wsize) {
-			filebench_log(LOG_ERROR,
-			    "Failed to pre-allocate file %s: %s",
-			    path, strerror(errno));
-			(void) FB_CLOSE(&fdesc);
-			free(buf);
-			fileset_unbusy(entry, TRUE, FALSE, 0);
-			return (FILEBENCH_ERROR);
-		}
-		seek += wsize;
-	}
-
 	(void) FB_CLOSE(&fdesc);
 
-	free(buf);
-
 	/* unbusy the allocated entry */
 	fileset_unbusy(entry, TRUE, TRUE, 0);
 
@@ -391,76 +801,445 @@ fileset_alloc_file(filesetentry_t *entry)
 }
 
 /*
- * given a fileset entry, determines if the associated file
- * needs to be allocated or not, and if so does the allocation.
- * Sets shm_fsparalloc_count to -1 on error.
+ * Carries out one task of the allocation threads, writing file data from
+ * "buf". Once "error" is set, only cleans up after the task: busy entries
+ * are unbusied and the path freed. Returns non-zero if the task failed or
+ * "error" was set.
  */
-static void *
-fileset_alloc_thread(filesetentry_t *entry)
+static int
+fileset_alloc_task(fileset_alloc_task_t *task, char *buf, int error)
 {
-	if (fileset_alloc_file(entry) == FILEBENCH_ERROR) {
-		(void) pthread_mutex_lock(&filebench_shm->shm_fsparalloc_lock);
-		filebench_shm->shm_fsparalloc_count = -1;
-	} else {
-		(void) pthread_mutex_lock(&filebench_shm->shm_fsparalloc_lock);
-		filebench_shm->shm_fsparalloc_count--;
+	filesetentry_t *entry;
+	int i;
+
+	if (task->at_op == FILESET_TASK_RMTREE) {
+		if (!error)
+			FB_RECUR_RM(task->at_path);
+		free(task->at_path);
+		return (error);
 	}
 
-	(void) pthread_cond_signal(&filebench_shm->shm_fsparalloc_cv);
-	(void) pthread_mutex_unlock(&filebench_shm->shm_fsparalloc_lock);
+	for (i = 0; i < task->at_nentries; i++) {
+		switch (task->at_op) {
+		case FILESET_TASK_FILE:
+			entry = task->at_entries[i];
+			if (error)
+				fileset_unbusy(entry, TRUE, FALSE, 0);
+			else if (fileset_alloc_file(entry, buf) ==
+			    FILEBENCH_ERROR)
+				error = 1;
+			break;
+		case FILESET_TASK_LEAFDIR:
+			entry = task->at_entries[i];
+			if (error)
+				fileset_unbusy(entry, TRUE, FALSE, 0);
+			else if (fileset_alloc_leafdir(entry) ==
+			    FILEBENCH_ERROR)
+				error = 1;
+			break;
+		case FILESET_TASK_MKDIR:
+			/* the dir list has children first, so go backwards */
+			entry = task->at_entries[task->at_nentries - 1 - i];
+			if (!error && (fileset_create_dir(entry) ==
+			    FILEBENCH_ERROR))
+				error = 1;
+			break;
+		}
+	}
 
-	pthread_exit(NULL);
-	return (NULL);
+	return (error);
 }
 
-
 /*
- * First creates the parent directories of the file using
- * fileset_mkdir(). Then Optionally sets the O_DSYNC flag
- * and opens the file with open64(). It unlocks the fileset
- * entry lock, sets the DIRECTIO_ON or DIRECTIO_OFF flags
- * as requested, and returns the file descriptor integer
- * for the opened file in the supplied filebench file descriptor.
- * Returns FILEBENCH_ERROR on error, and FILEBENCH_OK on success.
+ * Body of the parallel allocation threads. Takes tasks off the queue and
+ * carries them out, until told to shut down and the queue is empty.
  */
-int
-fileset_openfile(fb_fdesc_t *fdesc, fileset_t *fileset,
-    filesetentry_t *entry, int flag, int filemode, int attrs)
+static void *
+fileset_alloc_thread(void *arg)
 {
-	char path[MAXPATHLEN];
-	char dir[MAXPATHLEN];
-	char *pathtmp;
-	struct stat64 sb;
-	int open_attrs = 0;
+	struct fileset_allocpool *ap = &fileset_allocpool;
+	char *buf = (char *)arg;
+	fileset_alloc_task_t task;
+	int error;
 
-	(void) fb_strlcpy(path, avd_get_str(fileset->fs_path), MAXPATHLEN);
-	(void) fb_strlcat(path, "/", MAXPATHLEN);
-	(void) fb_strlcat(path, avd_get_str(fileset->fs_name), MAXPATHLEN);
-	pathtmp = fileset_resolvepath(entry);
-	(void) fb_strlcat(path, pathtmp, MAXPATHLEN);
-	(void) fb_strlcpy(dir, path, MAXPATHLEN);
-	free(pathtmp);
-	(void) trunc_dirname(dir);
-
-	/* If we are going to create a file, create the parent dirs */
-	if ((flag & O_CREAT) && (stat64(dir, &sb) != 0)) {
-		if (fileset_mkdir(dir, 0755) == FILEBENCH_ERROR)
-			return (FILEBENCH_ERROR);
-	}
+	(void) pthread_mutex_lock(&ap->ap_lock);
+	for (;;) {
+		while ((ap->ap_count == 0) && !ap->ap_shutdown)
+			(void) pthread_cond_wait(&ap->ap_work_cv, &ap->ap_lock);
 
-	if (attrs & FLOW_ATTR_DSYNC)
-		open_attrs |= O_SYNC;
+		if (ap->ap_count == 0)
+			break;
 
-#ifdef HAVE_O_DIRECT
-	if (attrs & FLOW_ATTR_DIRECTIO)
-		open_attrs |= O_DIRECT;
-#endif /* HAVE_O_DIRECT */
+		task = ap->ap_queue[ap->ap_head];
+		ap->ap_head = (ap->ap_head + 1) % FILESET_ALLOC_QUEUE;
+		ap->ap_count--;
+		ap->ap_active++;
+		error = ap->ap_error;
+		(void) pthread_mutex_unlock(&ap->ap_lock);
 
-	if (FB_OPEN(fdesc, path, flag | open_attrs, filemode)
-	    == FILEBENCH_ERROR) {
-		filebench_log(LOG_ERROR,
+		/* let the producer queue the next task */
+		(void) pthread_cond_signal(&ap->ap_done_cv);
+
+		error = fileset_alloc_task(&task, buf, error);
+
+		(void) pthread_mutex_lock(&ap->ap_lock);
+		ap->ap_active--;
+		if (error)
+			ap->ap_error = 1;
+		(void) pthread_cond_broadcast(&ap->ap_done_cv);
+	}
+	(void) pthread_mutex_unlock(&ap->ap_lock);
+
+	return (NULL);
+}
+
+/*
+ * Starts the parallel allocation threads, unless already running.
+ * Returns FILEBENCH_ERROR if they could not be started.
+ */
+static int
+fileset_allocpool_start(void)
+{
+	struct fileset_allocpool *ap = &fileset_allocpool;
+
+	if (ap->ap_nthreads)
+		return (FILEBENCH_OK);
+
+	ap->ap_head = 0;
+	ap->ap_count = 0;
+	ap->ap_active = 0;
+	ap->ap_shutdown = 0;
+	ap->ap_error = 0;
+	ap->ap_pending.at_nentries = 0;
+	ap->ap_pending.at_bytes = 0;
+	ap->ap_pending.at_path = NULL;
+
+	while (ap->ap_nthreads < MAX_PARALLOC_THREADS) {
+		char *buf;
+
+		if ((buf = fileset_alloc_buf()) == NULL)
+			break;
+
+		if (pthread_create(&ap->ap_threads[ap->ap_nthreads], NULL,
+		    fileset_alloc_thread, buf) != 0) {
+			free(buf);
+			break;
+		}
+
+		ap->ap_bufs[ap->ap_nthreads++] = buf;
+	}
+
+	if (ap->ap_nthreads == 0) {
+		filebench_log(LOG_ERROR, "File prealloc thread create failed");
+		return (FILEBENCH_ERROR);
+	}
+
+	if (ap->ap_nthreads < MAX_PARALLOC_THREADS)
+		filebench_log(LOG_INFO, "Only %d pre-allocation threads "
+		    "could be started", ap->ap_nthreads);
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Queues the task being filled, waiting for room in the queue if needed.
+ * If an allocation thread has failed, the task is dropped and
+ * FILEBENCH_ERROR returned.
+ */
+static int
+fileset_allocpool_flush(void)
+{
+	struct fileset_allocpool *ap = &fileset_allocpool;
+	fileset_alloc_task_t *task = &ap->ap_pending;
+	int error;
+
+	if ((task->at_nentries == 0) && (task->at_path == NULL))
+		return (FILEBENCH_OK);
+
+	(void) pthread_mutex_lock(&ap->ap_lock);
+	while ((ap->ap_count == FILESET_ALLOC_QUEUE) && !ap->ap_error)
+		(void) pthread_cond_wait(&ap->ap_done_cv, &ap->ap_lock);
+
+	if (!(error = ap->ap_error)) {
+		ap->ap_queue[(ap->ap_head + ap->ap_count) %
+		    FILESET_ALLOC_QUEUE] = *task;
+		ap->ap_count++;
+		(void) pthread_cond_signal(&ap->ap_work_cv);
+	}
+	(void) pthread_mutex_unlock(&ap->ap_lock);
+
+	if (error)
+		(void) fileset_alloc_task(task, NULL, error);
+
+	task->at_nentries = 0;
+	task->at_bytes = 0;
+	task->at_path = NULL;
+
+	return (error ? FILEBENCH_ERROR : FILEBENCH_OK);
+}
+
+/*
+ * Hands an entry over to the parallel allocation threads, to be dealt
+ * with as "op" says. File and leaf directory entries must be busy.
+ */
+static int
+fileset_allocpool_add(int op, filesetentry_t *entry)
+{
+	fileset_alloc_task_t *task = &fileset_allocpool.ap_pending;
+
+	if ((task->at_nentries > 0) && (task->at_op != op) &&
+	    (fileset_allocpool_flush() == FILEBENCH_ERROR))
+		return (FILEBENCH_ERROR);
+
+	task->at_op = op;
+	task->at_entries[task->at_nentries++] = entry;
+	if (op == FILESET_TASK_FILE)
+		task->at_bytes += entry->fse_size;
+
+	if ((task->at_nentries == FILESET_ALLOC_BATCH) ||
+	    (task->at_bytes >= FILE_ALLOC_BLOCK))
+		return (fileset_allocpool_flush());
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Has the allocation threads remove the file or directory tree at "path".
+ */
+static int
+fileset_allocpool_rmtree(char *path)
+{
+	fileset_alloc_task_t *task = &fileset_allocpool.ap_pending;
+
+	if (fileset_allocpool_flush() == FILEBENCH_ERROR)
+		return (FILEBENCH_ERROR);
+
+	if ((task->at_path = strdup(path)) == NULL) {
+		filebench_log(LOG_ERROR, "Out of memory removing %s", path);
+		return (FILEBENCH_ERROR);
+	}
+	task->at_op = FILESET_TASK_RMTREE;
+
+	return (fileset_allocpool_flush());
+}
+
+/*
+ * Queues any partial task and waits for the allocation threads to finish
+ * all queued work. Returns FILEBENCH_ERROR if any of the tasks failed.
+ */
+static int
+fileset_allocpool_drain(void)
+{
+	struct fileset_allocpool *ap = &fileset_allocpool;
+	int error;
+
+	(void) fileset_allocpool_flush();
+
+	(void) pthread_mutex_lock(&ap->ap_lock);
+	while (ap->ap_count || ap->ap_active)
+		(void) pthread_cond_wait(&ap->ap_done_cv, &ap->ap_lock);
+	error = ap->ap_error;
+	(void) pthread_mutex_unlock(&ap->ap_lock);
+
+	return (error ? FILEBENCH_ERROR : FILEBENCH_OK);
+}
+
+/*
+ * Waits for the allocation threads to finish all queued work and shuts
+ * them down. Returns FILEBENCH_ERROR if any of the tasks failed.
+ */
+static int
+fileset_allocpool_wait(void)
+{
+	struct fileset_allocpool *ap = &fileset_allocpool;
+	int error;
+	int i;
+
+	if (ap->ap_nthreads == 0)
+		return (FILEBENCH_OK);
+
+	error = (fileset_allocpool_drain() == FILEBENCH_ERROR);
+
+	(void) pthread_mutex_lock(&ap->ap_lock);
+	ap->ap_shutdown = 1;
+	(void) pthread_cond_broadcast(&ap->ap_work_cv);
+	(void) pthread_mutex_unlock(&ap->ap_lock);
+
+	for (i = 0; i < ap->ap_nthreads; i++) {
+		(void) pthread_join(ap->ap_threads[i], NULL);
+		free(ap->ap_bufs[i]);
+	}
+	ap->ap_nthreads = 0;
+
+	return (error ? FILEBENCH_ERROR : FILEBENCH_OK);
+}
+
+
+/*
+ * Creates the subdirectory tree for a fileset, in parallel if paralloc
+ * is set. The directory list is in depth first order, so the batches
+ * handed to the allocation threads mostly hold whole subtrees.
+ */
+static int
+fileset_create_subdirs(fileset_t *fileset, int paralloc)
+{
+	filesetentry_t *direntry;
+	hrtime_t start = gethrtime();
+	double secs;
+
+	/* walk the subdirectory list, enstanciating subdirs */
+	for (direntry = fileset->fs_dirlist; direntry;
+	    direntry = direntry->fse_nextoftype) {
+		if (paralloc) {
+			if (fileset_allocpool_add(FILESET_TASK_MKDIR, direntry)
+			    == FILEBENCH_ERROR)
+				return (FILEBENCH_ERROR);
+		} else if (fileset_create_dir(direntry) == FILEBENCH_ERROR) {
+			return (FILEBENCH_ERROR);
+		}
+	}
+
+	/* files go into these directories, so wait for all of them */
+	if (paralloc && (fileset_allocpool_drain() == FILEBENCH_ERROR))
+		return (FILEBENCH_ERROR);
+
+	secs = (double)(gethrtime() - start) / SEC2NS_FLOAT;
+	filebench_log(LOG_INFO,
+	    "Created %d directories in %s tree in %.3f seconds (%.0f/s)",
+	    fileset->fs_realdirs, avd_get_str(fileset->fs_name), secs,
+	    secs > 0 ? fileset->fs_realdirs / secs : 0);
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Hands the entries FILESET_RMTREE_SPLIT levels below "path" (and
+ * anything but directories above that) to the allocation threads for
+ * removal. Returns the number of entries handed over, or -1 on error.
+ */
+static int
+fileset_remove_split(char *path, int level)
+{
+	char subpath[MAXPATHLEN];
+	struct dirent *direntp;
+	struct stat sb;
+	DIR *dirp;
+	int count = 0;
+	int ret;
+
+	if ((dirp = FB_OPENDIR(path)) == NULL)
+		return (0);
+
+	while ((direntp = FB_READDIR(dirp)) != NULL) {
+		if ((strcmp(direntp->d_name, ".") == 0) ||
+		    (strcmp(direntp->d_name, "..") == 0))
+			continue;
+
+		(void) snprintf(subpath, sizeof (subpath), "%s/%s",
+		    path, direntp->d_name);
+
+		if ((level < FILESET_RMTREE_SPLIT) &&
+		    (lstat(subpath, &sb) == 0) && S_ISDIR(sb.st_mode))
+			ret = fileset_remove_split(subpath, level + 1);
+		else
+			ret = (fileset_allocpool_rmtree(subpath) ==
+			    FILEBENCH_ERROR) ? -1 : 1;
+
+		if (ret < 0) {
+			count = -1;
+			break;
+		}
+		count += ret;
+	}
+
+	(void) FB_CLOSEDIR(dirp);
+	return (count);
+}
+
+/*
+ * Removes the tree of a fileset at "path" from the storage subsystem.
+ * With paralloc set, the subtrees a few levels down are removed in
+ * parallel by the allocation threads, and only the emptied top of the
+ * tree is left to remove afterwards.
+ */
+static int
+fileset_remove_tree(fileset_t *fileset, char *path)
+{
+	hrtime_t start = gethrtime();
+	int subtrees = 0;
+
+	if (avd_get_bool(fileset->fs_paralloc) &&
+	    (fileset_allocpool_start() == FILEBENCH_OK)) {
+		subtrees = fileset_remove_split(path, 1);
+		if ((subtrees < 0) ||
+		    (fileset_allocpool_drain() == FILEBENCH_ERROR))
+			return (FILEBENCH_ERROR);
+	}
+
+	FB_RECUR_RM(path);
+
+	filebench_log(LOG_INFO, "Removed %s tree in %.3f seconds"
+	    " (%d subtrees in parallel)", avd_get_str(fileset->fs_name),
+	    (double)(gethrtime() - start) / SEC2NS_FLOAT, subtrees);
+
+	return (FILEBENCH_OK);
+}
+
+
+/*
+ * First creates the parent directories of the file using
+ * fileset_mkdir(). Then Optionally sets the O_DSYNC flag
+ * and opens the file with open64(). It unlocks the fileset
+ * entry lock, sets the DIRECTIO_ON or DIRECTIO_OFF flags
+ * as requested, and returns the file descriptor integer
+ * for the opened file in the supplied filebench file descriptor.
+ * Returns FILEBENCH_ERROR on error, and FILEBENCH_OK on success.
+ */
+int
+fileset_openfile(fb_fdesc_t *fdesc, fileset_t *fileset,
+    filesetentry_t *entry, int flag, int filemode, int attrs)
+{
+	char path[MAXPATHLEN];
+	char dir[MAXPATHLEN];
+	struct stat64 sb;
+	int open_attrs = 0;
+	int dirfd;
+	char *name;
+
+	if (fileset_locate(entry, path, sizeof (path), &dirfd, &name)
+	    == FILEBENCH_ERROR)
+		return (FILEBENCH_ERROR);
+
+	/*
+	 * If we are going to create a file, create the parent dirs. If we
+	 * have an fd for the parent, it exists already.
+	 */
+	if ((flag & O_CREAT) && (dirfd == AT_FDCWD)) {
+		(void) fb_strlcpy(dir, path, MAXPATHLEN);
+		(void) trunc_dirname(dir);
+		if ((stat64(dir, &sb) != 0) &&
+		    (fileset_mkdir(dir, 0755) == FILEBENCH_ERROR))
+			return (FILEBENCH_ERROR);
+	}
+
+	if (attrs & FLOW_ATTR_DSYNC)
+		open_attrs |= O_SYNC;
+
+#ifdef HAVE_O_DIRECT
+	if (attrs & FLOW_ATTR_DIRECTIO)
+		open_attrs |= O_DIRECT;
+#endif /* HAVE_O_DIRECT */
+
+	if (FB_OPENAT(fdesc, dirfd, name, flag | open_attrs, filemode)
+	    == FILEBENCH_ERROR) {
+		int err = errno;
+
+		/* log the full path, not just the name within the parent */
+		if (dirfd != AT_FDCWD)
+			(void) fileset_fullpath(entry, path, sizeof (path));
+		filebench_log(LOG_ERROR,
 		    "Failed to open file %d, %s, with status %x: %s",
-		    entry->fse_index, path, entry->fse_flags, strerror(errno));
+		    entry->fse_index, path, entry->fse_flags, strerror(err));
 
 		fileset_unbusy(entry, FALSE, FALSE, 0);
 		return (FILEBENCH_ERROR);
@@ -481,9 +1260,14 @@ fileset_openfile(fb_fdesc_t *fdesc, fileset_t *fileset,
 #ifdef HAVE_FADVISE
 		if (posix_fadvise(fdesc->fd_num, 0, 0, POSIX_FADV_RANDOM) 
 			!= FILEBENCH_OK) {
+			int err = errno;
+
+			if (dirfd != AT_FDCWD)
+				(void) fileset_fullpath(entry, path,
+				    sizeof (path));
 			filebench_log(LOG_ERROR,
 				"Failed to disable read ahead for file %s, with status %s", 
-			    	path, strerror(errno));
+			    	path, strerror(err));
 			fileset_unbusy(entry, FALSE, FALSE, 0);
 			return (FILEBENCH_ERROR);
 		}
@@ -503,73 +1287,181 @@ fileset_openfile(fb_fdesc_t *fdesc, fileset_t *fileset,
 }
 
 /*
- * removes all filesetentries from their respective btrees, and puts them
- * on the free list. The supplied argument indicates which free list to
- * use.
+ * returns the pick shard that holds the supplied filesetentry
+ */
+static fileset_shard_t *
+fileset_entry_shard(filesetentry_t *entry)
+{
+	fileset_t *fileset = entry->fse_fileset;
+
+	return (&fileset->fs_shards[entry->fse_index % fileset->fs_nshards]);
+}
+
+/*
+ * returns the btree of the shard that a non busy filesetentry belongs on,
+ * given its type and its FSE_FREE and FSE_EXISTS flags.
+ */
+static avl_tree_t *
+fileset_entry_tree(fileset_shard_t *shard, filesetentry_t *entry)
+{
+	switch (entry->fse_flags & FSE_TYPE_MASK) {
+	case FSE_TYPE_DIR:
+		return (&shard->fsh_dirs);
+
+	case FSE_TYPE_LEAFDIR:
+		if (entry->fse_flags & FSE_FREE)
+			return (&shard->fsh_free_leaf_dirs);
+		if (entry->fse_flags & FSE_EXISTS)
+			return (&shard->fsh_exist_leaf_dirs);
+		return (&shard->fsh_noex_leaf_dirs);
+
+	default:
+		if (entry->fse_flags & FSE_FREE)
+			return (&shard->fsh_free_files);
+		if (entry->fse_flags & FSE_EXISTS)
+			return (&shard->fsh_exist_files);
+		return (&shard->fsh_noex_files);
+	}
+}
+
+/*
+ * returns the btree of the shard that fileset_pick() should search,
+ * given the pick flags.
+ */
+static avl_tree_t *
+fileset_pick_tree(fileset_shard_t *shard, int flags)
+{
+	switch (flags & FILESET_PICKMASK) {
+	case FILESET_PICKDIR:
+		return (&shard->fsh_dirs);
+
+	case FILESET_PICKLEAFDIR:
+		if (flags & FILESET_PICKUNIQUE)
+			return (&shard->fsh_free_leaf_dirs);
+		if (flags & FILESET_PICKNOEXIST)
+			return (&shard->fsh_noex_leaf_dirs);
+		return (&shard->fsh_exist_leaf_dirs);
+
+	default:
+		if (flags & FILESET_PICKUNIQUE)
+			return (&shard->fsh_free_files);
+		if (flags & FILESET_PICKNOEXIST)
+			return (&shard->fsh_noex_files);
+		return (&shard->fsh_exist_files);
+	}
+}
+
+/*
+ * returns a pointer to the idle count and condition variable of the
+ * fileset for the supplied entry type.
+ */
+static int64_t *
+fileset_idle_count(fileset_t *fileset, int entry_type, pthread_cond_t **cvp)
+{
+	switch (entry_type & FSE_TYPE_MASK) {
+	case FSE_TYPE_DIR:
+		*cvp = &fileset->fs_idle_dirs_cv;
+		return (&fileset->fs_idle_dirs);
+	case FSE_TYPE_LEAFDIR:
+		*cvp = &fileset->fs_idle_leafdirs_cv;
+		return (&fileset->fs_idle_leafdirs);
+	default:
+		*cvp = &fileset->fs_idle_files_cv;
+		return (&fileset->fs_idle_files);
+	}
+}
+
+/*
+ * Called with the entry's shard lock held on an entry that has just
+ * been taken out of its btree. Marks it busy and drops the idle count.
  */
 static void
-fileset_pickreset(fileset_t *fileset, int entry_type)
+fileset_entry_setbusy(filesetentry_t *entry)
 {
-	filesetentry_t	*entry;
+	pthread_cond_t *cv;
+	int64_t *idlep;
 
-	switch (entry_type & FILESET_PICKMASK) {
-	case FILESET_PICKFILE:
-		entry = (filesetentry_t *)avl_first(&fileset->fs_noex_files);
-
-		/* make sure non-existing files are marked free */
-		while (entry) {
-			entry->fse_flags |= FSE_FREE;
-			entry->fse_open_cnt = 0;
-			fileset_move_entry(&fileset->fs_noex_files,
-			    &fileset->fs_free_files, entry);
-			entry =  AVL_NEXT(&fileset->fs_noex_files, entry);
-		}
+	entry->fse_flags |= FSE_BUSY;
+	idlep = fileset_idle_count(entry->fse_fileset, entry->fse_flags, &cv);
+	(void) __atomic_sub_fetch(idlep, 1, __ATOMIC_SEQ_CST);
+}
 
-		/* free up any existing files */
-		entry = (filesetentry_t *)avl_first(&fileset->fs_exist_files);
+/*
+ * Sleeps until at least one entry of the supplied type is idle. The
+ * waiter count is raised before the idle count is rechecked, and
+ * fileset_unbusy() raises the idle count before checking the waiter
+ * count, so at least one of the two sides always sees the other.
+ */
+static void
+fileset_wait_idle(fileset_t *fileset, int entry_type)
+{
+	pthread_cond_t *cv;
+	int64_t *idlep;
 
-		while (entry) {
-			entry->fse_flags |= FSE_FREE;
-			entry->fse_open_cnt = 0;
-			fileset_move_entry(&fileset->fs_exist_files,
-			    &fileset->fs_free_files, entry);
+	idlep = fileset_idle_count(fileset, entry_type, &cv);
+	if (__atomic_load_n(idlep, __ATOMIC_SEQ_CST) > 0)
+		return;
 
-			entry =  AVL_NEXT(&fileset->fs_exist_files, entry);
-		}
+	(void) ipc_mutex_lock(&fileset->fs_pick_lock);
+	(void) __atomic_add_fetch(&fileset->fs_pick_waiters, 1,
+	    __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(idlep, __ATOMIC_SEQ_CST) <= 0)
+		(void) pthread_cond_wait(cv, &fileset->fs_pick_lock);
+	(void) __atomic_sub_fetch(&fileset->fs_pick_waiters, 1,
+	    __ATOMIC_SEQ_CST);
+	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
+}
 
-		break;
+/*
+ * removes all filesetentries from their respective btrees, and puts them
+ * on the free list. The supplied argument indicates which free list to
+ * use.
+ */
+static void
+fileset_pickreset(fileset_t *fileset, int entry_type)
+{
+	filesetentry_t	*entry, *next;
+	fileset_shard_t	*shard;
+	avl_tree_t	*free_tree;
+	avl_tree_t	*trees[2];
+	int		i, t;
 
-	case FILESET_PICKDIR:
-		/* nothing to reset, as all (sub)dirs always exist */
-		break;
+	for (i = 0; i < fileset->fs_nshards; i++) {
+		shard = &fileset->fs_shards[i];
 
-	case FILESET_PICKLEAFDIR:
-		entry = (filesetentry_t *)
-		    avl_first(&fileset->fs_noex_leaf_dirs);
-
-		/* make sure non-existing leaf dirs are marked free */
-		while (entry) {
-			entry->fse_flags |= FSE_FREE;
-			entry->fse_open_cnt = 0;
-			fileset_move_entry(&fileset->fs_noex_leaf_dirs,
-			    &fileset->fs_free_leaf_dirs, entry);
-			entry =  AVL_NEXT(&fileset->fs_noex_leaf_dirs, entry);
-		}
+		switch (entry_type & FILESET_PICKMASK) {
+		case FILESET_PICKFILE:
+			free_tree = &shard->fsh_free_files;
+			trees[0] = &shard->fsh_noex_files;
+			trees[1] = &shard->fsh_exist_files;
+			break;
 
-		/* free up any existing leaf dirs */
-		entry = (filesetentry_t *)
-		    avl_first(&fileset->fs_exist_leaf_dirs);
+		case FILESET_PICKLEAFDIR:
+			free_tree = &shard->fsh_free_leaf_dirs;
+			trees[0] = &shard->fsh_noex_leaf_dirs;
+			trees[1] = &shard->fsh_exist_leaf_dirs;
+			break;
 
-		while (entry) {
-			entry->fse_flags |= FSE_FREE;
-			entry->fse_open_cnt = 0;
-			fileset_move_entry(&fileset->fs_exist_leaf_dirs,
-			    &fileset->fs_free_leaf_dirs, entry);
+		default:
+			/* nothing to reset, as all (sub)dirs always exist */
+			return;
+		}
 
-			entry =  AVL_NEXT(&fileset->fs_exist_leaf_dirs, entry);
+		(void) ipc_mutex_lock(&shard->fsh_lock);
+
+		/* free up both non-existing and existing entries */
+		for (t = 0; t < 2; t++) {
+			entry = (filesetentry_t *)avl_first(trees[t]);
+			while (entry) {
+				next = AVL_NEXT(trees[t], entry);
+				entry->fse_flags |= FSE_FREE;
+				entry->fse_open_cnt = 0;
+				fileset_move_entry(trees[t], free_tree, entry);
+				entry = next;
+			}
 		}
 
-		break;
+		(void) ipc_mutex_unlock(&shard->fsh_lock);
 	}
 }
 
@@ -598,6 +1490,79 @@ fileset_find_entry(avl_tree_t *atp, uint_t index)
 	return (found_fse);
 }
 
+/*
+ * Takes the entry at or after the supplied index out of the first shard,
+ * starting with the shard that index maps to, whose btree for the pick
+ * flags is not empty. Returns the entry marked busy, or NULL if all those
+ * btrees were empty when they were looked at. The shards are locked one
+ * at a time, so an entry put back into a shard already passed is missed.
+ */
+static filesetentry_t *
+fileset_pick_shards(fileset_t *fileset, int flags, uint_t index)
+{
+	filesetentry_t *entry;
+	fileset_shard_t *shard;
+	avl_tree_t *atp;
+	int nshards = fileset->fs_nshards;
+	int i;
+
+	for (i = 0; i < nshards; i++) {
+		shard = &fileset->fs_shards[(index + i) % nshards];
+		atp = fileset_pick_tree(shard, flags);
+
+		(void) ipc_mutex_lock(&shard->fsh_lock);
+		if (avl_is_empty(atp)) {
+			(void) ipc_mutex_unlock(&shard->fsh_lock);
+			continue;
+		}
+
+		entry = fileset_find_entry(atp, index);
+		avl_remove(atp, entry);
+		fileset_entry_setbusy(entry);
+		(void) ipc_mutex_unlock(&shard->fsh_lock);
+		return (entry);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Like fileset_pick_shards(), but holds the locks of all shards, taken
+ * in shard order, while it looks, so a NULL return means that the btrees
+ * for the pick flags were all empty at the same time. Only used when the
+ * unlocked scan found nothing, so the picks of other threads are not
+ * held up in the common case.
+ */
+static filesetentry_t *
+fileset_pick_allshards(fileset_t *fileset, int flags, uint_t index)
+{
+	filesetentry_t *entry = NULL;
+	fileset_shard_t *shard;
+	avl_tree_t *atp;
+	int nshards = fileset->fs_nshards;
+	int i;
+
+	for (i = 0; i < nshards; i++)
+		(void) ipc_mutex_lock(&fileset->fs_shards[i].fsh_lock);
+
+	for (i = 0; i < nshards; i++) {
+		shard = &fileset->fs_shards[(index + i) % nshards];
+		atp = fileset_pick_tree(shard, flags);
+		if (avl_is_empty(atp))
+			continue;
+
+		entry = fileset_find_entry(atp, index);
+		avl_remove(atp, entry);
+		fileset_entry_setbusy(entry);
+		break;
+	}
+
+	for (i = nshards - 1; i >= 0; i--)
+		(void) ipc_mutex_unlock(&fileset->fs_shards[i].fsh_lock);
+
+	return (entry);
+}
+
 /*
  * Selects a fileset entry from a fileset. If the
  * FILESET_PICKLEAFDIR flag is set it will pick a leaf directory entry,
@@ -617,81 +1582,52 @@ filesetentry_t *
 fileset_pick(fileset_t *fileset, int flags, int tid, int index)
 {
 	filesetentry_t *entry = NULL;
-	filesetentry_t *start_point;
-	avl_tree_t *atp = NULL;
+	pthread_cond_t *cv;
+	int64_t *idlep;
+	uint_t *rotor = NULL;
 	fbint_t max_entries = 0;
+	int entry_type;
+	uint_t start;
 
-	(void) ipc_mutex_lock(&fileset->fs_pick_lock);
-
-	/* see if we have to wait for available files or directories */
+	/* see if there is anything at all to pick from */
 	switch (flags & FILESET_PICKMASK) {
 	case FILESET_PICKFILE:
-
 		filebench_log(LOG_DEBUG_SCRIPT, "Picking file");
-
 		if (fileset->fs_filelist == NULL)
 			goto empty;
 
-		while (fileset->fs_idle_files == 0) {
-			(void) pthread_cond_wait(&fileset->fs_idle_files_cv,
-			    &fileset->fs_pick_lock);
-		}
-
+		entry_type = FSE_TYPE_FILE;
 		max_entries = fileset->fs_constentries;
-		if (flags & FILESET_PICKUNIQUE) {
-			filebench_log(LOG_DEBUG_SCRIPT, "Picking unique");
-			atp = &fileset->fs_free_files;
-		} else if (flags & FILESET_PICKNOEXIST) {
-			filebench_log(LOG_DEBUG_SCRIPT, "Picking not existing");
-			atp = &fileset->fs_noex_files;
-		} else {
-			filebench_log(LOG_DEBUG_SCRIPT, "Picking existing");
-			atp = &fileset->fs_exist_files;
-		}
+		if (flags & FILESET_PICKNOEXIST)
+			rotor = &fileset->fs_file_nerotor;
+		else
+			rotor = &fileset->fs_file_exrotor[tid];
 		break;
 
 	case FILESET_PICKDIR:
-
 		filebench_log(LOG_DEBUG_SCRIPT, "Picking directory");
-
 		if (fileset->fs_dirlist == NULL)
 			goto empty;
 
-		while (fileset->fs_idle_dirs == 0) {
-			(void) pthread_cond_wait(&fileset->fs_idle_dirs_cv,
-			    &fileset->fs_pick_lock);
-		}
-
+		entry_type = FSE_TYPE_DIR;
 		max_entries = 1;
-		atp = &fileset->fs_dirs;
+		rotor = &fileset->fs_dirrotor;
 		break;
 
 	case FILESET_PICKLEAFDIR:
-
 		filebench_log(LOG_DEBUG_SCRIPT, "Picking leaf directory");
-
 		if (fileset->fs_leafdirlist == NULL)
 			goto empty;
 
-		while (fileset->fs_idle_leafdirs == 0) {
-			(void) pthread_cond_wait(&fileset->fs_idle_leafdirs_cv,
-			    &fileset->fs_pick_lock);
-		}
-
+		entry_type = FSE_TYPE_LEAFDIR;
 		max_entries = fileset->fs_constleafdirs;
-		if (flags & FILESET_PICKUNIQUE) {
-			atp = &fileset->fs_free_leaf_dirs;
-		} else if (flags & FILESET_PICKNOEXIST) {
-			atp = &fileset->fs_noex_leaf_dirs;
-		} else {
-			atp = &fileset->fs_exist_leaf_dirs;
-		}
+		if (flags & FILESET_PICKNOEXIST)
+			rotor = &fileset->fs_leafdir_nerotor;
+		else
+			rotor = &fileset->fs_leafdir_exrotor;
 		break;
-	}
 
-	/* see if asking for impossible */
-	if (avl_is_empty(atp)) {
-		filebench_log(LOG_DEBUG_SCRIPT, "atp is empty");
+	default:
 		goto empty;
 	}
 
@@ -710,99 +1646,182 @@ fileset_pick(fileset_t *fileset, int flags, int tid, int index)
 		} else {
 			fb_random64(&index64, max_entries, 0, NULL);
 		}
-
-		entry = fileset_find_entry(atp, (int)index64);
-
-		if (entry == NULL)
-			goto empty;
+		start = (uint_t)index64;
+		rotor = NULL;
 
 	} else if (flags & FILESET_PICKBYINDEX) {
 		/* pick by supplied index */
-		entry = fileset_find_entry(atp, index);
+		start = index;
+		rotor = NULL;
 
 	} else {
-		/* pick in rotation */
-		switch (flags & FILESET_PICKMASK) {
-		case FILESET_PICKFILE:
-			if (flags & FILESET_PICKNOEXIST) {
-				entry = fileset_find_entry(atp,
-				    fileset->fs_file_nerotor);
-				fileset->fs_file_nerotor =
-				    entry->fse_index + 1;
-			} else {
-				entry = fileset_find_entry(atp,
-				    fileset->fs_file_exrotor[tid]);
-				fileset->fs_file_exrotor[tid] =
-				    entry->fse_index + 1;
-			}
-			break;
+		/*
+		 * pick in rotation. The rotors are shared without a lock;
+		 * a lost update just makes two threads try the same index.
+		 */
+		start = __atomic_load_n(rotor, __ATOMIC_RELAXED);
+	}
 
-		case FILESET_PICKDIR:
-			entry = fileset_find_entry(atp, fileset->fs_dirrotor);
-			fileset->fs_dirrotor = entry->fse_index + 1;
+	for (;;) {
+		/* see if we have to wait for available files or directories */
+		fileset_wait_idle(fileset, entry_type);
+
+		entry = fileset_pick_shards(fileset, flags, start);
+		if (entry != NULL)
 			break;
 
-		case FILESET_PICKLEAFDIR:
-			if (flags & FILESET_PICKNOEXIST) {
-				entry = fileset_find_entry(atp,
-				    fileset->fs_leafdir_nerotor);
-				fileset->fs_leafdir_nerotor =
-				    entry->fse_index + 1;
-			} else {
-				entry = fileset_find_entry(atp,
-				    fileset->fs_leafdir_exrotor);
-				fileset->fs_leafdir_exrotor =
-				    entry->fse_index + 1;
-			}
+		/* the scan may have raced with an unbusy, look again */
+		entry = fileset_pick_allshards(fileset, flags, start);
+		if (entry != NULL)
 			break;
+
+		/*
+		 * Nothing suitable is idle in any shard. If that is only
+		 * because everything went busy since we waited, wait again;
+		 * otherwise we are asking for the impossible.
+		 */
+		idlep = fileset_idle_count(fileset, entry_type, &cv);
+		if (__atomic_load_n(idlep, __ATOMIC_SEQ_CST) > 0) {
+			filebench_log(LOG_DEBUG_SCRIPT,
+			    "No idle entries to pick from");
+			goto empty;
 		}
 	}
 
-	if (entry == NULL)
-		goto empty;
+	if (rotor)
+		__atomic_store_n(rotor, entry->fse_index + 1, __ATOMIC_RELAXED);
+
+	filebench_log(LOG_DEBUG_SCRIPT, "Picked file %s", entry->fse_path);
+	return (entry);
+
+empty:
+	filebench_log(LOG_DEBUG_SCRIPT, "No file found");
+	return (NULL);
+}
+
+/*
+ * Sets up "fp" for picking files of "fileset" according to the supplied
+ * popularity attributes: the model ("uniform", "zipf" or "hotcold"), the
+ * Zipf exponent times 1000, the percentage of files in the hot set, the
+ * percentage of picks that go to the hot set, and the percentage of picks
+ * that just take the previously picked file again. Must be called after
+ * the fileset has been populated. Returns FILEBENCH_ERROR for unknown
+ * models, FILEBENCH_OK otherwise.
+ */
+int
+fileset_popularity_init(fileset_popularity_t *fp, fileset_t *fileset,
+    avd_t model, avd_t theta, avd_t hotset, avd_t hotaccess, avd_t locality)
+{
+	char *name = NULL;
+
+	(void) memset(fp, 0, sizeof (*fp));
+	fp->fp_n = fileset->fs_constentries;
+	if (fp->fp_n == 0)
+		return (FILEBENCH_OK);
+
+	if (model)
+		name = avd_get_str(model);
+
+	if ((name == NULL) || (strcmp(name, "uniform") == 0)) {
+		fp->fp_model = FILESET_POP_UNIFORM;
+	} else if (strcmp(name, "zipf") == 0) {
+		fp->fp_model = FILESET_POP_ZIPF;
+	} else if (strcmp(name, "hotcold") == 0) {
+		fp->fp_model = FILESET_POP_HOTCOLD;
+	} else {
+		filebench_log(LOG_ERROR, "%s %s: unknown popularity %s",
+		    fileset_entity_name(fileset),
+		    avd_get_str(fileset->fs_name), name);
+		return (FILEBENCH_ERROR);
+	}
+
+	if (locality)
+		fp->fp_locality = avd_get_int(locality) / 100.0;
+
+	fp->fp_stride = fb_coprime_stride(fp->fp_n);
+
+	switch (fp->fp_model) {
+	case FILESET_POP_ZIPF:
+		fb_zipf_init(&fp->fp_zipf, fp->fp_n,
+		    theta ? avd_get_int(theta) / 1000.0 : 0.99);
+		break;
+
+	case FILESET_POP_HOTCOLD:
+		fp->fp_nhot = (fp->fp_n * (hotset ? avd_get_int(hotset) : 20))
+		    / 100;
+		fp->fp_nhot = MAX(MIN(fp->fp_nhot, fp->fp_n), 1);
+		fp->fp_hotprob = (hotaccess ? avd_get_int(hotaccess) : 80) /
+		    100.0;
+		break;
+	}
+
+	fp->fp_active = (fp->fp_model != FILESET_POP_UNIFORM) ||
+	    (fp->fp_locality > 0.0);
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Returns the index of the file to pick next according to "fp". "lastp"
+ * holds one more than the index of the caller's previous pick, or zero.
+ */
+uint_t
+fileset_popularity_pick(fileset_popularity_t *fp, uint_t *lastp)
+{
+	uint64_t rank = 0;
+	uint64_t n = fp->fp_n;
 
-	/* see if entry in use */
-	start_point = entry;
-	while (entry->fse_flags & FSE_BUSY) {
+	if (*lastp && (fp->fp_locality > 0.0) &&
+	    (fb_random_probability() < fp->fp_locality))
+		return (*lastp - 1);
 
-		/* it is, so try next */
-		entry = AVL_NEXT(atp, entry);
-		if (entry == NULL)
-			entry = avl_first(atp);
+	switch (fp->fp_model) {
+	case FILESET_POP_ZIPF:
+		rank = fb_zipf_next(&fp->fp_zipf, NULL) - 1;
+		break;
 
-		/* see if we have wrapped around */
-		if ((entry == NULL) || (entry == start_point)) {
-			filebench_log(LOG_DEBUG_SCRIPT,
-			    "All %d files are busy", avl_numnodes(atp));
-			goto empty;
+	case FILESET_POP_HOTCOLD:
+		if ((fp->fp_nhot == n) ||
+		    (fb_random_probability() < fp->fp_hotprob)) {
+			fb_random64(&rank, fp->fp_nhot, 0, NULL);
+			rank = MIN(rank, fp->fp_nhot - 1);
+		} else {
+			fb_random64(&rank, n - fp->fp_nhot, 0, NULL);
+			rank += fp->fp_nhot;
 		}
+		break;
 
+	default:
+		fb_random64(&rank, n, 0, NULL);
+		return ((uint_t)MIN(rank, n - 1));
 	}
 
-	/* update file or directory idle counts */
-	switch (flags & FILESET_PICKMASK) {
-	case FILESET_PICKFILE:
-		fileset->fs_idle_files--;
-		break;
-	case FILESET_PICKDIR:
-		fileset->fs_idle_dirs--;
-		break;
-	case FILESET_PICKLEAFDIR:
-		fileset->fs_idle_leafdirs--;
-		break;
-	}
+	rank = MIN(rank, n - 1);
 
-	/* Indicate that file or directory is now busy */
-	entry->fse_flags |= FSE_BUSY;
+	/* spread the ranks over the files, indexes fit in a uint_t */
+	return ((uint_t)((rank * fp->fp_stride) % n));
+}
 
-	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
-	filebench_log(LOG_DEBUG_SCRIPT, "Picked file %s", entry->fse_path);
-	return (entry);
+/*
+ * Waits for a specific filesetentry to leave the "FSE_BUSY" state, then
+ * makes it busy for the caller, taking it out of the pick btrees until
+ * the caller hands it back with fileset_unbusy().
+ */
+void
+fileset_busy(filesetentry_t *entry)
+{
+	fileset_shard_t *shard = fileset_entry_shard(entry);
 
-empty:
-	filebench_log(LOG_DEBUG_SCRIPT, "No file found");
-	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
-	return (NULL);
+	(void) ipc_mutex_lock(&shard->fsh_lock);
+	while (entry->fse_flags & FSE_BUSY) {
+		entry->fse_flags |= FSE_THRD_WAITNG;
+		(void) pthread_cond_wait(&shard->fsh_thrd_wait_cv,
+		    &shard->fsh_lock);
+	}
+
+	avl_remove(fileset_entry_tree(shard, entry), entry);
+	fileset_entry_setbusy(entry);
+	(void) ipc_mutex_unlock(&shard->fsh_lock);
 }
 
 /*
@@ -815,6 +1834,11 @@ fileset_unbusy(filesetentry_t *entry, int update_exist,
     int new_exist_val, int open_cnt_incr)
 {
 	fileset_t *fileset = NULL;
+	fileset_shard_t *shard;
+	pthread_cond_t *cv;
+	int64_t *idlep;
+	int wasbusy;
+	int changed = 0;
 
 	if (entry)
 		fileset = entry->fse_fileset;
@@ -824,143 +1848,55 @@ fileset_unbusy(filesetentry_t *entry, int update_exist,
 		return;
 	}
 
-	(void) ipc_mutex_lock(&fileset->fs_pick_lock);
+	shard = fileset_entry_shard(entry);
+	(void) ipc_mutex_lock(&shard->fsh_lock);
+
+	/* busy entries are not on any btree, idle ones may have to move */
+	wasbusy = entry->fse_flags & FSE_BUSY;
+	if (!wasbusy)
+		avl_remove(fileset_entry_tree(shard, entry), entry);
 
 	/* modify FSE_EXIST flag and actual dirs/files count, if requested */
 	if (update_exist) {
+		changed = ((entry->fse_flags & FSE_EXISTS) != 0) !=
+		    (new_exist_val == TRUE);
 		if (new_exist_val == TRUE) {
-			if (entry->fse_flags & FSE_FREE) {
-
-				/* asked to set and it was free */
-				entry->fse_flags |= FSE_EXISTS;
-				entry->fse_flags &= (~FSE_FREE);
-				switch (entry->fse_flags & FSE_TYPE_MASK) {
-				case FSE_TYPE_FILE:
-					fileset_move_entry(
-					    &fileset->fs_free_files,
-					    &fileset->fs_exist_files, entry);
-					break;
-
-				case FSE_TYPE_DIR:
-					break;
-
-				case FSE_TYPE_LEAFDIR:
-					fileset_move_entry(
-					    &fileset->fs_free_leaf_dirs,
-					    &fileset->fs_exist_leaf_dirs,
-					    entry);
-					break;
-				}
-
-			} else if (!(entry->fse_flags & FSE_EXISTS)) {
-
-				/* asked to set, and it was clear */
-				entry->fse_flags |= FSE_EXISTS;
-				switch (entry->fse_flags & FSE_TYPE_MASK) {
-				case FSE_TYPE_FILE:
-					fileset_move_entry(
-					    &fileset->fs_noex_files,
-					    &fileset->fs_exist_files, entry);
-					break;
-				case FSE_TYPE_DIR:
-					break;
-				case FSE_TYPE_LEAFDIR:
-					fileset_move_entry(
-					    &fileset->fs_noex_leaf_dirs,
-					    &fileset->fs_exist_leaf_dirs,
-					    entry);
-					break;
-				}
-			}
+			entry->fse_flags |= FSE_EXISTS;
+			entry->fse_flags &= (~FSE_FREE);
 		} else {
-			if (entry->fse_flags & FSE_FREE) {
-				/* asked to clear, and it was free */
-				entry->fse_flags &= (~(FSE_FREE | FSE_EXISTS));
-				switch (entry->fse_flags & FSE_TYPE_MASK) {
-				case FSE_TYPE_FILE:
-					fileset_move_entry(
-					    &fileset->fs_free_files,
-					    &fileset->fs_noex_files, entry);
-					break;
-
-				case FSE_TYPE_DIR:
-					break;
-
-				case FSE_TYPE_LEAFDIR:
-					fileset_move_entry(
-					    &fileset->fs_free_leaf_dirs,
-					    &fileset->fs_noex_leaf_dirs,
-					    entry);
-					break;
-				}
-			} else if (entry->fse_flags & FSE_EXISTS) {
-
-				/* asked to clear, and it was set */
-				entry->fse_flags &= (~FSE_EXISTS);
-				switch (entry->fse_flags & FSE_TYPE_MASK) {
-				case FSE_TYPE_FILE:
-					fileset_move_entry(
-					    &fileset->fs_exist_files,
-					    &fileset->fs_noex_files, entry);
-					break;
-				case FSE_TYPE_DIR:
-					break;
-				case FSE_TYPE_LEAFDIR:
-					fileset_move_entry(
-					    &fileset->fs_exist_leaf_dirs,
-					    &fileset->fs_noex_leaf_dirs,
-					    entry);
-					break;
-				}
-			}
+			entry->fse_flags &= (~(FSE_FREE | FSE_EXISTS));
 		}
 	}
 
 	/* update open count */
 	entry->fse_open_cnt += open_cnt_incr;
 
-	/* increment idle count, clear FSE_BUSY and signal IF it was busy */
-	if (entry->fse_flags & FSE_BUSY) {
+	/* unbusy it and put it back on the btree for its new state */
+	entry->fse_flags &= (~FSE_BUSY);
+	avl_add(fileset_entry_tree(shard, entry), entry);
 
-		/* unbusy it */
-		entry->fse_flags &= (~FSE_BUSY);
+	/* release any threads waiting for unbusy */
+	if (wasbusy && (entry->fse_flags & FSE_THRD_WAITNG)) {
+		entry->fse_flags &= (~FSE_THRD_WAITNG);
+		(void) pthread_cond_broadcast(&shard->fsh_thrd_wait_cv);
+	}
 
-		/* release any threads waiting for unbusy */
-		if (entry->fse_flags & FSE_THRD_WAITNG) {
-			entry->fse_flags &= (~FSE_THRD_WAITNG);
-			(void) pthread_cond_broadcast(
-			    &fileset->fs_thrd_wait_cv);
-		}
+	(void) ipc_mutex_unlock(&shard->fsh_lock);
 
-		/* increment idle count and signal waiting threads */
-		switch (entry->fse_flags & FSE_TYPE_MASK) {
-		case FSE_TYPE_FILE:
-			fileset->fs_idle_files++;
-			if (fileset->fs_idle_files >= 1) {
-				(void) pthread_cond_signal(
-				    &fileset->fs_idle_files_cv);
-			}
-			break;
+	if (changed && fileset->fs_manifest_armed)
+		fileset_manifest_invalidate(fileset);
 
-		case FSE_TYPE_DIR:
-			fileset->fs_idle_dirs++;
-			if (fileset->fs_idle_dirs >= 1) {
-				(void) pthread_cond_signal(
-				    &fileset->fs_idle_dirs_cv);
-			}
-			break;
+	if (!wasbusy)
+		return;
 
-		case FSE_TYPE_LEAFDIR:
-			fileset->fs_idle_leafdirs++;
-			if (fileset->fs_idle_leafdirs >= 1) {
-				(void) pthread_cond_signal(
-				    &fileset->fs_idle_leafdirs_cv);
-			}
-			break;
-		}
+	/* increment idle count and signal waiting threads */
+	idlep = fileset_idle_count(fileset, entry->fse_flags, &cv);
+	(void) __atomic_add_fetch(idlep, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&fileset->fs_pick_waiters, __ATOMIC_SEQ_CST)) {
+		(void) ipc_mutex_lock(&fileset->fs_pick_lock);
+		(void) pthread_cond_broadcast(cv);
+		(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
 	}
-
-	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
 }
 
 /*
@@ -984,9 +1920,11 @@ fileset_create(fileset_t *fileset)
 	hrtime_t start = gethrtime();
 	char *fileset_path;
 	char *fileset_name;
+	char *buf = NULL;
 	int randno;
 	int preallocated = 0;
 	int reusing;
+	int paralloc;
 	uint64_t preallocpercent;
 
 	fileset_path = avd_get_str(fileset->fs_path);
@@ -1007,6 +1945,14 @@ fileset_create(fileset_t *fileset)
 	if (fileset->fs_attrs & FILESET_IS_RAW_DEV)
 		return FILEBENCH_OK;
 
+	if ((fileset->fs_allocmethod = fileset_allocmethod(fileset)) < 0)
+		return (FILEBENCH_ERROR);
+
+	/* hand the work to the allocation threads if paralloc set */
+	paralloc = avd_get_bool(fileset->fs_paralloc);
+	if (paralloc && (fileset_allocpool_start() == FILEBENCH_ERROR))
+		return (FILEBENCH_ERROR);
+
 	/* XXX Add check to see if there is enough space */
 
 	/* set up path to fileset */
@@ -1031,7 +1977,8 @@ fileset_create(fileset_t *fileset)
 		filebench_log(LOG_INFO,
 		    "Removing %s tree (if exists)", fileset_name);
 
-		FB_RECUR_RM(path);
+		if (fileset_remove_tree(fileset, path) == FILEBENCH_ERROR)
+			return (FILEBENCH_ERROR);
 	} else {
 		/* we are re-using */
 		filebench_log(LOG_INFO, "Reusing existing %s tree",
@@ -1045,7 +1992,8 @@ fileset_create(fileset_t *fileset)
 
 		(void) FB_MKDIR(path, 0755);
 
-		if (fileset_create_subdirs(fileset, path) == FILEBENCH_ERROR)
+		if (fileset_create_subdirs(fileset, paralloc) ==
+		    FILEBENCH_ERROR)
 			return (FILEBENCH_ERROR);
 	}
 
@@ -1064,11 +2012,18 @@ fileset_create(fileset_t *fileset)
 
 	randno = ((RAND_MAX * (100 - preallocpercent)) / 100);
 
+	/* files of clone filesets share the data of one template file */
+	if ((fileset->fs_allocmethod == FILESET_ALLOC_CLONE) &&
+	    (fileset_clonesrc_open(fileset, path) == FILEBENCH_ERROR))
+		fileset->fs_allocmethod = FILESET_ALLOC_WRITE;
+
+	if (!paralloc && ((buf = fileset_alloc_buf()) == NULL))
+		return (FILEBENCH_ERROR);
+
 	/* alloc any files, as required */
 	fileset_pickreset(fileset, FILESET_PICKFILE);
 	while ((entry = fileset_pick(fileset,
 	    FILESET_PICKFREE | FILESET_PICKFILE, 0, 0))) {
-		pthread_t tid;
 		int newrand;
 
 		newrand = rand();
@@ -1086,55 +2041,20 @@ fileset_create(fileset_t *fileset)
 		else
 			entry->fse_flags &= (~FSE_REUSING);
 
-		/* fire off allocation threads for each file if paralloc set */
-		if (avd_get_bool(fileset->fs_paralloc)) {
-
-			/* limit total number of simultaneous allocations */
-			(void) pthread_mutex_lock(
-			    &filebench_shm->shm_fsparalloc_lock);
-			while (filebench_shm->shm_fsparalloc_count
-			    >= MAX_PARALLOC_THREADS) {
-				(void) pthread_cond_wait(
-				    &filebench_shm->shm_fsparalloc_cv,
-				    &filebench_shm->shm_fsparalloc_lock);
-			}
-
-			/* quit if any allocation thread reports an error */
-			if (filebench_shm->shm_fsparalloc_count < 0) {
-				(void) pthread_mutex_unlock(
-				    &filebench_shm->shm_fsparalloc_lock);
+		/* allocate now, or queue it for the allocation threads */
+		if (paralloc) {
+			if (fileset_allocpool_add(FILESET_TASK_FILE, entry)
+			    == FILEBENCH_ERROR)
 				return (FILEBENCH_ERROR);
-			}
-
-			filebench_shm->shm_fsparalloc_count++;
-			(void) pthread_mutex_unlock(
-			    &filebench_shm->shm_fsparalloc_lock);
-
-			/*
-			 * Fire off a detached allocation thread per file.
-			 * The thread will self destruct when it finishes
-			 * writing pre-allocation data to the file.
-			 */
-			if (pthread_create(&tid, NULL,
-			    (void *(*)(void*))fileset_alloc_thread,
-			    entry) == 0) {
-				/*
-				 * A thread was created; detach it so it can
-				 * fully quit when finished.
-				 */
-				(void) pthread_detach(tid);
-			} else {
-				filebench_log(LOG_ERROR,
-				    "File prealloc thread create failed");
-				filebench_shutdown(1);
-			}
-
-		} else {
-			if (fileset_alloc_file(entry) == FILEBENCH_ERROR)
-				return FILEBENCH_ERROR;
+		} else if (fileset_alloc_file(entry, buf) == FILEBENCH_ERROR) {
+			free(buf);
+			return (FILEBENCH_ERROR);
 		}
 	}
 
+	if (!paralloc)
+		free(buf);
+
 	/* alloc any leaf directories, as required */
 	fileset_pickreset(fileset, FILESET_PICKLEAFDIR);
 	while ((entry = fileset_pick(fileset,
@@ -1153,10 +2073,19 @@ fileset_create(fileset_t *fileset)
 		else
 			entry->fse_flags &= (~FSE_REUSING);
 
-		if (fileset_alloc_leafdir(entry) == FILEBENCH_ERROR)
+		if (paralloc) {
+			if (fileset_allocpool_add(FILESET_TASK_LEAFDIR, entry)
+			    == FILEBENCH_ERROR)
+				return (FILEBENCH_ERROR);
+		} else if (fileset_alloc_leafdir(entry) == FILEBENCH_ERROR) {
 			return (FILEBENCH_ERROR);
+		}
 	}
 
+	/* queue the last, partial batch; it is waited for with the rest */
+	if (paralloc && (fileset_allocpool_flush() == FILEBENCH_ERROR))
+		return (FILEBENCH_ERROR);
+
 	filebench_log(LOG_VERBOSE,
 	    "Pre-allocated %d of %llu files in %s in %llu seconds",
 	    preallocated,
@@ -1194,7 +2123,7 @@ fileset_delete_storage(fileset_t *fileset)
 	(void) fb_strlcat(path, fileset_name, MAXPATHLEN);
 
 	/* now delete any files and directories on the disk */
-	FB_RECUR_RM(path);
+	(void) fileset_remove_tree(fileset, path);
 }
 
 /*
@@ -1203,25 +2132,23 @@ fileset_delete_storage(fileset_t *fileset)
 static void
 fileset_delete_fileset(fileset_t *fileset)
 {
+	filesetentry_t *lists[3];
 	filesetentry_t *entry, *next_entry;
+	int i;
 
-	/* run down the file list, removing and freeing each filesetentry */
-	for (entry = fileset->fs_filelist; entry; entry = next_entry) {
+	lists[0] = fileset->fs_filelist;
+	lists[1] = fileset->fs_dirlist;
+	lists[2] = fileset->fs_leafdirlist;
 
-		/* free the entry */
-		next_entry = entry->fse_next;
+	/* run down the entry lists, removing and freeing each filesetentry */
+	for (i = 0; i < 3; i++) {
+		for (entry = lists[i]; entry; entry = next_entry) {
 
-		/* return it to the pool */
-		switch (entry->fse_flags & FSE_TYPE_MASK) {
-		case FSE_TYPE_FILE:
-		case FSE_TYPE_LEAFDIR:
-		case FSE_TYPE_DIR:
+			/* free the entry */
+			next_entry = entry->fse_nextoftype;
+
+			/* return it to the pool */
 			ipc_free(FILEBENCH_FILESETENTRY, (void *)entry);
-			break;
-		default:
-			filebench_log(LOG_ERROR,
-			    "Unallocated filesetentry found on list");
-			break;
 		}
 	}
 
@@ -1240,7 +2167,11 @@ fileset_delete_all_filesets(void)
 		fileset_delete_fileset(fileset);
 	}
 
+	/* stop the threads that removed the trees in parallel, if any */
+	(void) fileset_allocpool_wait();
+
 	filebench_shm->shm_filesetlist = NULL;
+	ipc_freepaths();
 }
 /*
  * Adds an entry to the fileset's file list. Single threaded so
@@ -1250,7 +2181,7 @@ static void
 fileset_insfilelist(fileset_t *fileset, filesetentry_t *entry)
 {
 	entry->fse_flags = FSE_TYPE_FILE | FSE_FREE;
-	avl_add(&fileset->fs_free_files, entry);
+	avl_add(fileset_entry_tree(fileset_entry_shard(entry), entry), entry);
 
 	if (fileset->fs_filelist == NULL) {
 		fileset->fs_filelist = entry;
@@ -1269,7 +2200,7 @@ static void
 fileset_insdirlist(fileset_t *fileset, filesetentry_t *entry)
 {
 	entry->fse_flags = FSE_TYPE_DIR | FSE_EXISTS;
-	avl_add(&fileset->fs_dirs, entry);
+	avl_add(fileset_entry_tree(fileset_entry_shard(entry), entry), entry);
 
 	if (fileset->fs_dirlist == NULL) {
 		fileset->fs_dirlist = entry;
@@ -1288,7 +2219,7 @@ static void
 fileset_insleafdirlist(fileset_t *fileset, filesetentry_t *entry)
 {
 	entry->fse_flags = FSE_TYPE_LEAFDIR | FSE_FREE;
-	avl_add(&fileset->fs_free_leaf_dirs, entry);
+	avl_add(fileset_entry_tree(fileset_entry_shard(entry), entry), entry);
 
 	if (fileset->fs_leafdirlist == NULL) {
 		fileset->fs_leafdirlist = entry;
@@ -1433,7 +2364,7 @@ fileset_populate_subdir(fileset_t *fileset, filesetentry_t *parent,
 {
 	double randepth, drand, ranwidth;
 	int isleaf = 0;
-	char tmpname[16];
+	char tmpname[MAXPATHLEN];
 	filesetentry_t *entry;
 	int i;
 	uint_t index;
@@ -1453,7 +2384,16 @@ fileset_populate_subdir(fileset_t *fileset, filesetentry_t *parent,
 	index = fileset->fs_idle_dirs++;
 	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
 
-	(void) snprintf(tmpname, sizeof (tmpname), "%08d", serial);
+	/*
+	 * Directories keep their whole path within the fileset, so that
+	 * resolving a file's path only takes its parent's path and its
+	 * own name. The root directory's path within the fileset is "".
+	 */
+	if (parent)
+		(void) snprintf(tmpname, sizeof (tmpname), "%s/%08d",
+		    parent->fse_path, serial);
+	else
+		tmpname[0] = '\0';
 	if ((entry->fse_path = (char *)ipc_pathalloc(tmpname)) == NULL) {
 		filebench_log(LOG_ERROR,
 		    "fileset_populate_subdir: Can't alloc path string");
@@ -1464,6 +2404,7 @@ fileset_populate_subdir(fileset_t *fileset, filesetentry_t *parent,
 	entry->fse_parent = parent;
 	entry->fse_fileset = fileset;
 	fileset_insdirlist(fileset, entry);
+	fileset->fs_realdirs++;
 
 	if (fileset->fs_dirdepthrv) {
 		randepth = (int)avd_get_int(fileset->fs_dirdepthrv);
@@ -1542,6 +2483,538 @@ fileset_populate_subdir(fileset_t *fileset, filesetentry_t *parent,
 	return (FILEBENCH_OK);
 }
 
+/*
+ * Filesets with the manifest attribute save their tree in a manifest file
+ * once it has been created. A later run reusing the fileset rebuilds the
+ * tree from the manifest instead of from the random variables, and trusts
+ * the files and leaf directories listed as existing to be there, with
+ * their sizes, rather than checking each of them. The manifest is only
+ * used if the attributes of the fileset are unchanged, its root directory
+ * has the same inode and times, and a sample of its files checks out.
+ * It is removed as soon as a run creates or deletes entries.
+ *
+ * The manifest holds a header followed by one record per entry:
+ * directories in the order they were populated (parents first), then
+ * files and then leaf directories, each in fse_index order.
+ */
+#define	FILESET_MANIFEST_MAGIC		0x464d4246	/* "FBMF" */
+#define	FILESET_MANIFEST_VERSION	1
+#define	FILESET_MANIFEST_SAMPLES	64
+
+typedef struct fileset_manifest_hdr {
+	uint32_t	fm_magic;
+	uint32_t	fm_version;
+	uint64_t	fm_config;	/* Hash of the fileset's attributes */
+	uint64_t	fm_ndirs;
+	uint64_t	fm_nfiles;
+	uint64_t	fm_nleafdirs;
+	uint64_t	fm_root_ino;	/* Root directory at write time */
+	int64_t		fm_root_mtime;
+	int64_t		fm_root_ctime;
+} fileset_manifest_hdr_t;
+
+typedef struct fileset_manifest_rec {
+	uint64_t	fr_size;	/* File size */
+	uint32_t	fr_parent;	/* Record number of parent dir + 1 */
+	uint32_t	fr_serial;	/* Name within the parent directory */
+	uint32_t	fr_flags;	/* FSE_TYPE_* and FSE_EXISTS */
+	uint32_t	fr_pad;
+} fileset_manifest_rec_t;
+
+/*
+ * Folds "len" bytes at "buf" into a FNV-1a hash.
+ */
+static uint64_t
+fileset_manifest_fold(uint64_t hash, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return (hash);
+}
+
+static uint64_t
+fileset_manifest_foldstr(uint64_t hash, const char *str)
+{
+	if (str == NULL)
+		str = "";
+
+	/* the terminating NUL keeps consecutive strings apart */
+	return (fileset_manifest_fold(hash, str, strlen(str) + 1));
+}
+
+/*
+ * Folds a fileset attribute into a FNV-1a hash. Random and custom
+ * variables are folded in by their definition, never by drawing a value,
+ * which would differ from run to run and use up the variable's draws.
+ */
+static uint64_t
+fileset_manifest_hash(uint64_t hash, avd_t avd)
+{
+	randdist_t *rndp;
+	cvar_t *cvar;
+	int64_t val = 0;
+
+	if (avd == NULL)
+		return (fileset_manifest_fold(hash, &val, sizeof (val)));
+
+	/* resolve avds bound to variables that were not defined yet */
+	(void) avd_is_constant(avd);
+
+	switch (avd->avd_type) {
+	case AVD_VARVAL_RANDOM:
+		rndp = avd->avd_val.randptr;
+		val = -1;
+		hash = fileset_manifest_fold(hash, &val, sizeof (val));
+		hash = fileset_manifest_fold(hash, &rndp->rnd_type,
+		    sizeof (rndp->rnd_type));
+		hash = fileset_manifest_fold(hash, &rndp->rnd_dbl_mean,
+		    sizeof (rndp->rnd_dbl_mean));
+		hash = fileset_manifest_fold(hash, &rndp->rnd_dbl_gamma,
+		    sizeof (rndp->rnd_dbl_gamma));
+		hash = fileset_manifest_fold(hash, &rndp->rnd_vint_min,
+		    sizeof (rndp->rnd_vint_min));
+		hash = fileset_manifest_fold(hash, &rndp->rnd_vint_round,
+		    sizeof (rndp->rnd_vint_round));
+		if (rndp->rnd_type & RAND_SRC_GENERATOR)
+			hash = fileset_manifest_hash(hash, rndp->rnd_seed);
+		if (rndp->rnd_rft)
+			hash = fileset_manifest_fold(hash, rndp->rnd_rft,
+			    rndp->rnd_nrft * sizeof (randfunc_t));
+		return (hash);
+
+	case AVD_VARVAL_CUSTOM:
+		cvar = avd->avd_val.cvarptr;
+		val = -2;
+		hash = fileset_manifest_fold(hash, &val, sizeof (val));
+		hash = fileset_manifest_foldstr(hash,
+		    cvar->cvar_lib_info ? cvar->cvar_lib_info->type : NULL);
+		hash = fileset_manifest_foldstr(hash, cvar->parameters);
+		hash = fileset_manifest_fold(hash, &cvar->min,
+		    sizeof (cvar->min));
+		hash = fileset_manifest_fold(hash, &cvar->max,
+		    sizeof (cvar->max));
+		return (fileset_manifest_fold(hash, &cvar->round,
+		    sizeof (cvar->round)));
+
+	default:
+		break;
+	}
+
+	if (AVD_IS_BOOL(avd))
+		val = avd_get_bool(avd);
+	else
+		val = (int64_t)avd_get_int(avd);
+
+	return (fileset_manifest_fold(hash, &val, sizeof (val)));
+}
+
+/*
+ * Returns a hash of the attributes that shape the tree of a fileset.
+ */
+static uint64_t
+fileset_manifest_config(fileset_t *fileset)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = fileset_manifest_hash(hash, fileset->fs_entries);
+	hash = fileset_manifest_hash(hash, fileset->fs_leafdirs);
+	hash = fileset_manifest_hash(hash, fileset->fs_dirwidth);
+	hash = fileset_manifest_hash(hash, fileset->fs_dirdepthrv);
+	hash = fileset_manifest_hash(hash, fileset->fs_dirgamma);
+	hash = fileset_manifest_hash(hash, fileset->fs_size);
+	hash = fileset_manifest_hash(hash, fileset->fs_preallocpercent);
+
+	return (hash);
+}
+
+/*
+ * Stats the root directory of a fileset.
+ */
+static int
+fileset_manifest_statroot(fileset_t *fileset, struct stat64 *sb)
+{
+	char path[MAXPATHLEN];
+
+	(void) snprintf(path, sizeof (path), "%s/%s",
+	    avd_get_str(fileset->fs_path), avd_get_str(fileset->fs_name));
+
+	return (stat64(path, sb));
+}
+
+/*
+ * Writes the manifest of a freshly created fileset. Failing to do so is
+ * not fatal, the next run just has to populate and check the tree again.
+ */
+static void
+fileset_manifest_write(fileset_t *fileset)
+{
+	char path[MAXPATHLEN];
+	char tmppath[MAXPATHLEN + 8];
+	fileset_manifest_hdr_t *hdr;
+	fileset_manifest_rec_t *recs, *rec;
+	filesetentry_t *lists[3];
+	uint64_t first[3];
+	filesetentry_t *entry;
+	struct stat64 sb;
+	size_t size;
+	uint64_t nrecs;
+	void *map;
+	char *name;
+	int fd;
+	int i;
+
+	if (fileset_manifest_path(fileset, path, sizeof (path)) ==
+	    FILEBENCH_ERROR)
+		return;
+	(void) snprintf(tmppath, sizeof (tmppath), "%s.tmp", path);
+
+	if (fileset_manifest_statroot(fileset, &sb) != 0)
+		return;
+
+	nrecs = fileset->fs_realdirs + fileset->fs_realfiles +
+	    fileset->fs_realleafdirs;
+	size = sizeof (fileset_manifest_hdr_t) +
+	    nrecs * sizeof (fileset_manifest_rec_t);
+
+	if ((fd = open64(tmppath, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		filebench_log(LOG_ERROR, "Failed to create manifest %s: %s",
+		    tmppath, strerror(errno));
+		return;
+	}
+
+	if (ftruncate(fd, size) != 0 || (map = mmap(NULL, size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		filebench_log(LOG_ERROR, "Failed to write manifest %s: %s",
+		    tmppath, strerror(errno));
+		(void) close(fd);
+		(void) unlink(tmppath);
+		return;
+	}
+	(void) close(fd);
+
+	hdr = (fileset_manifest_hdr_t *)map;
+	hdr->fm_magic = FILESET_MANIFEST_MAGIC;
+	hdr->fm_version = FILESET_MANIFEST_VERSION;
+	hdr->fm_config = fileset_manifest_config(fileset);
+	hdr->fm_ndirs = fileset->fs_realdirs;
+	hdr->fm_nfiles = fileset->fs_realfiles;
+	hdr->fm_nleafdirs = fileset->fs_realleafdirs;
+	hdr->fm_root_ino = sb.st_ino;
+	hdr->fm_root_mtime = sb.st_mtime;
+	hdr->fm_root_ctime = sb.st_ctime;
+	recs = (fileset_manifest_rec_t *)(hdr + 1);
+
+	lists[0] = fileset->fs_dirlist;
+	lists[1] = fileset->fs_filelist;
+	lists[2] = fileset->fs_leafdirlist;
+	first[0] = 0;
+	first[1] = hdr->fm_ndirs;
+	first[2] = hdr->fm_ndirs + hdr->fm_nfiles;
+
+	for (i = 0; i < 3; i++) {
+		for (entry = lists[i]; entry; entry = entry->fse_nextoftype) {
+			rec = &recs[first[i] + entry->fse_index];
+			rec->fr_size = entry->fse_size;
+			rec->fr_parent = entry->fse_parent ?
+			    entry->fse_parent->fse_index + 1 : 0;
+			rec->fr_flags = entry->fse_flags &
+			    (FSE_TYPE_MASK | FSE_EXISTS);
+
+			/* directories keep their whole path */
+			if ((name = strrchr(entry->fse_path, '/')) == NULL)
+				name = entry->fse_path;
+			else
+				name++;
+			rec->fr_serial = entry->fse_parent ? atoi(name) : 1;
+		}
+	}
+
+	(void) munmap(map, size);
+
+	if (rename(tmppath, path) != 0) {
+		(void) unlink(tmppath);
+		return;
+	}
+
+	fileset->fs_manifest_armed = 1;
+	filebench_log(LOG_INFO, "Saved manifest of %s tree to %s",
+	    avd_get_str(fileset->fs_name), path);
+}
+
+/*
+ * Appends the path of a manifest record within the fileset to "path".
+ */
+static void
+fileset_manifest_recpath(fileset_manifest_rec_t *recs, uint64_t i,
+    char *path, size_t len)
+{
+	size_t n;
+
+	/* the root directory's path within the fileset is "" */
+	if (recs[i].fr_parent == 0)
+		return;
+
+	fileset_manifest_recpath(recs, recs[i].fr_parent - 1, path, len);
+	n = strlen(path);
+	(void) snprintf(path + n, len - n, "/%08u", recs[i].fr_serial);
+}
+
+/*
+ * Checks that a mapped manifest of "size" bytes is well formed and
+ * matches both the fileset's attributes and what is on the storage.
+ */
+static int
+fileset_manifest_valid(fileset_t *fileset, fileset_manifest_hdr_t *hdr,
+    size_t size, fbint_t entries, fbint_t leafdirs)
+{
+	fileset_manifest_rec_t *recs = (fileset_manifest_rec_t *)(hdr + 1);
+	uint64_t ndirs, nrecs, nsamples, i, k;
+	char path[MAXPATHLEN];
+	struct stat64 sb;
+	uint32_t type;
+	size_t n;
+
+	if ((size < sizeof (*hdr)) ||
+	    (hdr->fm_magic != FILESET_MANIFEST_MAGIC) ||
+	    (hdr->fm_version != FILESET_MANIFEST_VERSION))
+		return (FALSE);
+
+	ndirs = hdr->fm_ndirs;
+	nrecs = ndirs + hdr->fm_nfiles + hdr->fm_nleafdirs;
+	if ((ndirs == 0) || (ndirs >= UINT32_MAX) ||
+	    (size != sizeof (*hdr) + nrecs * sizeof (*recs)))
+		return (FALSE);
+
+	if ((hdr->fm_config != fileset_manifest_config(fileset)) ||
+	    (hdr->fm_nfiles != entries) || (hdr->fm_nleafdirs != leafdirs)) {
+		filebench_log(LOG_INFO, "Manifest of %s does not match its "
+		    "attributes", avd_get_str(fileset->fs_name));
+		return (FALSE);
+	}
+
+	if ((fileset_manifest_statroot(fileset, &sb) != 0) ||
+	    (sb.st_ino != hdr->fm_root_ino) ||
+	    (sb.st_mtime != hdr->fm_root_mtime) ||
+	    (sb.st_ctime != hdr->fm_root_ctime)) {
+		filebench_log(LOG_INFO, "Manifest of %s is older than its "
+		    "tree", avd_get_str(fileset->fs_name));
+		return (FALSE);
+	}
+
+	/* parents must come before their children and be directories */
+	for (i = 0; i < nrecs; i++) {
+		type = (i < ndirs) ? FSE_TYPE_DIR :
+		    (i < ndirs + hdr->fm_nfiles) ? FSE_TYPE_FILE :
+		    FSE_TYPE_LEAFDIR;
+		if (((recs[i].fr_flags & FSE_TYPE_MASK) != type) ||
+		    ((i == 0) != (recs[i].fr_parent == 0)) ||
+		    (recs[i].fr_parent > MIN(i, ndirs)))
+			return (FALSE);
+	}
+
+	/* sample the files */
+	nsamples = MIN(hdr->fm_nfiles, FILESET_MANIFEST_SAMPLES);
+	for (k = 0; k < nsamples; k++) {
+		i = ndirs + (k * hdr->fm_nfiles) / nsamples;
+
+		n = snprintf(path, sizeof (path), "%s/%s",
+		    avd_get_str(fileset->fs_path),
+		    avd_get_str(fileset->fs_name));
+		fileset_manifest_recpath(recs, i, path + n, sizeof (path) - n);
+
+		if (stat64(path, &sb) != 0) {
+			if (recs[i].fr_flags & FSE_EXISTS)
+				break;
+		} else if (!(recs[i].fr_flags & FSE_EXISTS) ||
+		    (sb.st_size != recs[i].fr_size)) {
+			break;
+		}
+	}
+
+	if (k < nsamples) {
+		filebench_log(LOG_INFO, "Manifest of %s does not match file "
+		    "%s", avd_get_str(fileset->fs_name), path);
+		return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/*
+ * Allocates a fileset entry for a manifest record and puts it on the
+ * fileset's lists. Entries that exist are marked FSE_REUSING, for
+ * fileset_manifest_apply().
+ */
+static filesetentry_t *
+fileset_manifest_entry(fileset_t *fileset, fileset_manifest_rec_t *rec,
+    filesetentry_t *parent)
+{
+	char tmpname[MAXPATHLEN];
+	filesetentry_t *entry;
+
+	if ((entry = (filesetentry_t *)ipc_malloc(FILEBENCH_FILESETENTRY))
+	    == NULL) {
+		filebench_log(LOG_ERROR,
+		    "fileset_manifest_entry: Can't malloc filesetentry");
+		return (NULL);
+	}
+
+	if ((rec->fr_flags & FSE_TYPE_MASK) != FSE_TYPE_DIR)
+		(void) snprintf(tmpname, sizeof (tmpname), "%08u",
+		    rec->fr_serial);
+	else if (parent)
+		(void) snprintf(tmpname, sizeof (tmpname), "%s/%08u",
+		    parent->fse_path, rec->fr_serial);
+	else
+		tmpname[0] = '\0';
+
+	if ((entry->fse_path = (char *)ipc_pathalloc(tmpname)) == NULL) {
+		filebench_log(LOG_ERROR,
+		    "fileset_manifest_entry: Can't alloc path string");
+		return (NULL);
+	}
+
+	entry->fse_parent = parent;
+	entry->fse_fileset = fileset;
+
+	switch (rec->fr_flags & FSE_TYPE_MASK) {
+	case FSE_TYPE_DIR:
+		entry->fse_index = fileset->fs_idle_dirs++;
+		fileset_insdirlist(fileset, entry);
+		fileset->fs_realdirs++;
+		break;
+	case FSE_TYPE_FILE:
+		entry->fse_index = fileset->fs_idle_files++;
+		fileset_insfilelist(fileset, entry);
+		entry->fse_size = (off64_t)rec->fr_size;
+		fileset->fs_bytes += entry->fse_size;
+		fileset->fs_realfiles++;
+		break;
+	case FSE_TYPE_LEAFDIR:
+		entry->fse_index = fileset->fs_idle_leafdirs++;
+		fileset_insleafdirlist(fileset, entry);
+		fileset->fs_realleafdirs++;
+		break;
+	}
+
+	if (rec->fr_flags & FSE_EXISTS)
+		entry->fse_flags |= FSE_REUSING;
+
+	return (entry);
+}
+
+/*
+ * Rebuilds the tree of a fileset from its manifest, if it has a valid
+ * one. Returns FILEBENCH_OK if it did, FILEBENCH_NORSC if there is no
+ * usable manifest, and FILEBENCH_ERROR on failure.
+ */
+static int
+fileset_manifest_load(fileset_t *fileset, fbint_t entries, fbint_t leafdirs)
+{
+	char path[MAXPATHLEN];
+	fileset_manifest_hdr_t *hdr;
+	fileset_manifest_rec_t *recs;
+	filesetentry_t **dirs;
+	filesetentry_t *entry;
+	struct stat64 sb;
+	uint64_t nrecs, i;
+	int ret = FILEBENCH_ERROR;
+	size_t size;
+	void *map;
+	int fd;
+
+	if (fileset_manifest_path(fileset, path, sizeof (path)) ==
+	    FILEBENCH_ERROR)
+		return (FILEBENCH_NORSC);
+
+	if ((fd = open64(path, O_RDONLY)) < 0)
+		return (FILEBENCH_NORSC);
+
+	if ((fstat64(fd, &sb) != 0) || (sb.st_size == 0)) {
+		(void) close(fd);
+		return (FILEBENCH_NORSC);
+	}
+	size = sb.st_size;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	(void) close(fd);
+	if (map == MAP_FAILED)
+		return (FILEBENCH_NORSC);
+
+	hdr = (fileset_manifest_hdr_t *)map;
+	if (!fileset_manifest_valid(fileset, hdr, size, entries, leafdirs)) {
+		(void) munmap(map, size);
+		(void) unlink(path);
+		return (FILEBENCH_NORSC);
+	}
+
+	recs = (fileset_manifest_rec_t *)(hdr + 1);
+	nrecs = hdr->fm_ndirs + hdr->fm_nfiles + hdr->fm_nleafdirs;
+
+	if ((dirs = malloc(hdr->fm_ndirs * sizeof (filesetentry_t *)))
+	    == NULL)
+		goto out;
+
+	for (i = 0; i < nrecs; i++) {
+		entry = fileset_manifest_entry(fileset, &recs[i],
+		    recs[i].fr_parent ? dirs[recs[i].fr_parent - 1] : NULL);
+		if (entry == NULL)
+			goto out;
+		if (i < hdr->fm_ndirs)
+			dirs[i] = entry;
+	}
+
+	fileset->fs_manifest_loaded = 1;
+	ret = FILEBENCH_OK;
+	filebench_log(LOG_INFO, "Loaded %s tree from manifest %s",
+	    avd_get_str(fileset->fs_name), path);
+
+out:
+	free(dirs);
+	(void) munmap(map, size);
+	return (ret);
+}
+
+/*
+ * Stands in for fileset_create() for filesets loaded from a manifest:
+ * the manifest says which files and leaf directories exist, so they are
+ * just marked that way, without touching the storage.
+ */
+static int
+fileset_manifest_apply(fileset_t *fileset)
+{
+	filesetentry_t *entry;
+	int types[2] = { FILESET_PICKFILE, FILESET_PICKLEAFDIR };
+	int existing = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		fileset_pickreset(fileset, types[i]);
+		while ((entry = fileset_pick(fileset,
+		    FILESET_PICKFREE | types[i], 0, 0))) {
+			if (entry->fse_flags & FSE_REUSING) {
+				fileset_unbusy(entry, TRUE, TRUE, 0);
+				existing++;
+			} else {
+				fileset_unbusy(entry, TRUE, FALSE, 0);
+			}
+		}
+	}
+
+	fileset->fs_manifest_armed = 1;
+	filebench_log(LOG_INFO, "Reusing existing %s tree, %d entries exist "
+	    "according to its manifest", avd_get_str(fileset->fs_name),
+	    existing);
+
+	return (FILEBENCH_OK);
+}
+
 /*
  * Populates a fileset with files and subdirectory entries. Uses the supplied
  * fileset_dirwidth and fileset_entries (number of files) to calculate the
@@ -1559,6 +3032,7 @@ fileset_populate(fileset_t *fileset)
 	fbint_t leafdirs = avd_get_int(fileset->fs_leafdirs);
 	int meandirwidth = 0;
 	int ret;
+	int i;
 
 	/* Skip if already populated */
 	if (fileset->fs_bytes > 0)
@@ -1584,29 +3058,45 @@ fileset_populate(fileset_t *fileset)
 	fileset->fs_idle_files = 0;
 	fileset->fs_idle_dirs = 0;
 	fileset->fs_idle_leafdirs = 0;
+	fileset->fs_realdirs = 0;
 
 	/* initialize locks and other condition variables */
 	(void) pthread_mutex_init(&fileset->fs_pick_lock,
 	    ipc_mutexattr(IPC_MUTEX_NORMAL));
 	(void) pthread_mutex_init(&fileset->fs_histo_lock,
 	    ipc_mutexattr(IPC_MUTEX_NORMAL));
-	(void) pthread_cond_init(&fileset->fs_thrd_wait_cv, ipc_condattr());
-
-	/* Initialize avl btrees */
-	avl_create(&(fileset->fs_free_files), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_noex_files), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_exist_files), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_free_leaf_dirs), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_noex_leaf_dirs), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_exist_leaf_dirs), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
-	avl_create(&(fileset->fs_dirs), fileset_entry_compare,
-	    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+	fileset->fs_pick_waiters = 0;
+
+	/* one shard per FILESET_SHARD_MINENTRIES files, within limits */
+	fileset->fs_nshards = (int)MIN(entries / FILESET_SHARD_MINENTRIES,
+	    FILESET_MAXSHARDS);
+	if (fileset->fs_nshards < 1)
+		fileset->fs_nshards = 1;
+
+	/* Initialize the shards and their avl btrees */
+	for (i = 0; i < fileset->fs_nshards; i++) {
+		fileset_shard_t *shard = &fileset->fs_shards[i];
+
+		(void) pthread_mutex_init(&shard->fsh_lock,
+		    ipc_mutexattr(IPC_MUTEX_NORMAL));
+		(void) pthread_cond_init(&shard->fsh_thrd_wait_cv,
+		    ipc_condattr());
+
+		avl_create(&shard->fsh_free_files, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_noex_files, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_exist_files, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_free_leaf_dirs, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_noex_leaf_dirs, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_exist_leaf_dirs, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+		avl_create(&shard->fsh_dirs, fileset_entry_compare,
+		    sizeof (filesetentry_t), FSE_OFFSETOF(fse_link));
+	}
 
 	/* is dirwidth a random variable? */
 	if (AVD_IS_RANDOM(fileset->fs_dirwidth)) {
@@ -1635,7 +3125,15 @@ fileset_populate(fileset_t *fileset)
 		    fileset->fs_meandepth;
 	}
 
-	if ((ret = fileset_populate_subdir(fileset, NULL, 1, 0)) != 0)
+	/* a valid manifest from an earlier run saves building the tree */
+	ret = FILEBENCH_NORSC;
+	if (fileset->fs_manifest && avd_get_bool(fileset->fs_manifest) &&
+	    avd_get_bool(fileset->fs_reuse))
+		ret = fileset_manifest_load(fileset, entries, leafdirs);
+
+	if (ret == FILEBENCH_NORSC)
+		ret = fileset_populate_subdir(fileset, NULL, 1, 0);
+	if (ret != 0)
 		return (ret);
 
 exists:
@@ -1683,6 +3181,7 @@ fileset_define(avd_t name, avd_t path)
 
 	fileset->fs_name = name;
 	fileset->fs_path = path;
+	fileset->fs_clonefd = -1;
 
 	/* Add fileset to global list */
 	(void)ipc_mutex_lock(&filebench_shm->shm_fileset_lock);
@@ -1768,11 +3267,6 @@ fileset_createsets()
 
 	filecreate_done = 1;
 
-	/* Set up for possible parallel pre-allocation */
-	filebench_shm->shm_fsparalloc_count = 0;
-	(void) pthread_cond_init(&filebench_shm->shm_fsparalloc_cv,
-							ipc_condattr());
-
 	filebench_log(LOG_INFO, "Populating and pre-allocating filesets");
 
 	list = filebench_shm->shm_filesetlist;
@@ -1809,7 +3303,10 @@ fileset_createsets()
 		if (ret)
 			return ret;
 
-		ret = fileset_create(list);
+		if (list->fs_manifest_loaded)
+			ret = fileset_manifest_apply(list);
+		else
+			ret = fileset_create(list);
 		if (ret)
 			return ret;
 
@@ -1820,19 +3317,25 @@ fileset_createsets()
 	filebench_log(LOG_INFO, "Waiting for pre-allocation to finish "
 			"(in case of a parallel pre-allocation)");
 
-	(void) pthread_mutex_lock(&filebench_shm->shm_fsparalloc_lock);
-	while (filebench_shm->shm_fsparalloc_count > 0)
-		(void) pthread_cond_wait(
-		    &filebench_shm->shm_fsparalloc_cv,
-		    &filebench_shm->shm_fsparalloc_lock);
-	(void) pthread_mutex_unlock(&filebench_shm->shm_fsparalloc_lock);
+	ret = fileset_allocpool_wait();
 
-	filebench_log(LOG_INFO,
-	    "Population and pre-allocation of filesets completed");
+	/* all files are allocated, drop the clone templates */
+	for (list = filebench_shm->shm_filesetlist; list; list = list->fs_next)
+		fileset_clonesrc_close(list);
 
-	if (filebench_shm->shm_fsparalloc_count < 0)
+	if (ret == FILEBENCH_ERROR)
 		return (FILEBENCH_ERROR);
 
+	/* save the trees of new filesets that asked for it */
+	for (list = filebench_shm->shm_filesetlist; list; list = list->fs_next)
+		if (list->fs_manifest && avd_get_bool(list->fs_manifest) &&
+		    !list->fs_manifest_loaded &&
+		    !(list->fs_attrs & FILESET_IS_RAW_DEV))
+			fileset_manifest_write(list);
+
+	filebench_log(LOG_INFO,
+	    "Population and pre-allocation of filesets completed");
+
 	return 0;
 }
 
@@ -30,6 +30,13 @@
 
 #define	FILE_ALLOC_BLOCK (off64_t)(1024 * 1024)
 
+/* How files are pre-allocated, selected by the allocmode attribute */
+#define	FILESET_ALLOC_WRITE	0	/* write zeroed blocks (default) */
+#define	FILESET_ALLOC_FALLOCATE	1	/* fallocate() the blocks */
+#define	FILESET_ALLOC_ZERO	2	/* fallocate() zeroing the range */
+#define	FILESET_ALLOC_SPARSE	3	/* only ftruncate() to size */
+#define	FILESET_ALLOC_CLONE	4	/* clone from a template file */
+
 #define	FSE_MAXTID 16384
 
 #define	FSE_MAXPATHLEN 16
@@ -43,19 +50,22 @@
 #define	FSE_REUSING		0x20
 #define	FSE_THRD_WAITNG		0x40
 
+/*
+ * Filesets may hold hundreds of millions of entries, so keep this small:
+ * it is 80 bytes on LP64, plus the FSE_MAXPATHLEN sized path name.
+ */
 typedef struct filesetentry {
-	struct filesetentry	*fse_next;	/* master list of entries */
 	struct filesetentry	*fse_parent;	/* link to directory */
 	avl_node_t		fse_link;	/* links in avl btree, prot. */
-						/*    by fs_pick_lock */
-	uint_t			fse_index;	/* file order number */
+						/*    by the shard's fsh_lock */
 	struct filesetentry	*fse_nextoftype; /* List of specific fse */
 	struct fileset		*fse_fileset;	/* Parent fileset */
-	char			*fse_path;
-	int			fse_depth;
+	char			*fse_path;	/* name, or path within */
+						/*    fileset for dirs */
 	off64_t			fse_size;
-	int			fse_open_cnt;	/* protected by fs_pick_lock */
-	int			fse_flags;	/* protected by fs_pick_lock */
+	uint_t			fse_index;	/* file order number */
+	int			fse_open_cnt;	/* protected by fsh_lock */
+	int			fse_flags;	/* protected by fsh_lock */
 } filesetentry_t;
 
 #define	FSE_OFFSETOF(f)	((size_t)(&(((filesetentry_t *)0)->f)))
@@ -73,6 +83,55 @@ typedef struct filesetentry {
 #define	FILESET_PICKBYINDEX 0x40 /* use supplied index number to select file */
 #define	FILESET_PICKFREE    FILESET_PICKUNIQUE
 
+/*
+ * Fileset entries are spread over up to FILESET_MAXSHARDS pick shards by
+ * fse_index, each with its own lock and avl btrees, so that threads
+ * picking files from one large fileset do not all serialize on a single
+ * lock. Small filesets use fewer shards (at least FILESET_SHARD_MINENTRIES
+ * files per shard) so that rotor and unique picks still see the whole set.
+ * Busy entries are taken out of their btree while busy and put back by
+ * fileset_unbusy(), so a pick never has to step over them.
+ */
+#define	FILESET_MAXSHARDS	16
+#define	FILESET_SHARD_MINENTRIES 64
+
+typedef struct fileset_shard {
+	pthread_mutex_t	fsh_lock;	/* protects the btrees and entries */
+	pthread_cond_t	fsh_thrd_wait_cv; /* busy wait cv for one entry */
+	avl_tree_t	fsh_free_files;	/* btree of free files */
+	avl_tree_t	fsh_exist_files; /* btree of files on device */
+	avl_tree_t	fsh_noex_files;	/* btree of files NOT on device */
+	avl_tree_t	fsh_dirs;	/* btree of internal dirs */
+	avl_tree_t	fsh_free_leaf_dirs; /* btree of free leaf dirs */
+	avl_tree_t	fsh_exist_leaf_dirs; /* btree of leaf dirs on device */
+	avl_tree_t	fsh_noex_leaf_dirs; /* btree of leaf dirs NOT */
+					    /* currently on device */
+} FB_CACHE_ALIGNED fileset_shard_t;
+
+/*
+ * Models of how popular each file of a fileset is, used when flowops pick
+ * existing files. FILESET_POP_UNIFORM keeps picking them in rotation.
+ */
+#define	FILESET_POP_UNIFORM	0
+#define	FILESET_POP_ZIPF	1 /* Zipf(theta) over the files */
+#define	FILESET_POP_HOTCOLD	2 /* hotaccess% of picks hit hotset% */
+
+/*
+ * State for picking files by popularity, set up from the attributes by
+ * fileset_popularity_init(). Ranks are spread over the file indexes with
+ * fp_stride, so that the most popular files are not all neighbours.
+ */
+typedef struct fileset_popularity {
+	int		fp_model;	/* FILESET_POP_* */
+	int		fp_active;	/* Pick by popularity at all */
+	uint64_t	fp_n;		/* Number of files */
+	uint64_t	fp_stride;	/* Rank to index multiplier */
+	double		fp_locality;	/* Probability of re-picking */
+	fb_zipf_t	fp_zipf;	/* Zipf distribution of ranks */
+	uint64_t	fp_nhot;	/* Files in the hot set */
+	double		fp_hotprob;	/* Probability of a hot pick */
+} fileset_popularity_t;
+
 /* fileset attributes */
 #define	FILESET_IS_RAW_DEV  0x01 /* fileset is a raw device */
 #define	FILESET_IS_FILE	    0x02 /* Fileset is emulating a single file */
@@ -102,12 +161,33 @@ typedef struct fileset {
 	avd_t		fs_readonly;	/* Attr */
 	avd_t		fs_writeonly;	/* Attr */
 	avd_t		fs_trust_tree;	/* Attr */
+	avd_t		fs_dirfds;	/* Attr, use cached dir fds */
+	avd_t		fs_allocmode;	/* Attr, how to pre-allocate files */
+	int		fs_allocmethod;	/* FILESET_ALLOC_* from fs_allocmode */
+	avd_t		fs_popularity;	/* Attr, FILESET_POP_* by name */
+	avd_t		fs_theta;	/* Attr, Zipf exponent (* 1000) */
+	avd_t		fs_hotset;	/* Attr, % of files that are hot */
+	avd_t		fs_hotaccess;	/* Attr, % of picks of hot files */
+	avd_t		fs_locality;	/* Attr, % of picks of the last file */
+	avd_t		fs_manifest;	/* Attr, keep a manifest for reuse */
+	int		fs_manifest_loaded; /* Tree was read from manifest */
+	int		fs_manifest_armed; /* Manifest matches the storage */
+	int		fs_clonefd;	/* Template file for ALLOC_CLONE */
+	off64_t		fs_clonesize;	/* Bytes written to the template */
+	off64_t		fs_cloneblksize; /* Clone granularity */
+	pthread_mutex_t	fs_clone_lock;	/* Serializes template growth */
 	double		fs_meandepth;	/* Computed mean depth */
 	double		fs_meanwidth;	/* Specified mean dir width */
 	int		fs_realfiles;	/* Actual files */
 	int		fs_realleafdirs; /* Actual explicit leaf directories */
+	int		fs_realdirs;	/* Actual (non leaf) directories */
 	off64_t		fs_bytes;	/* Total space consumed by files */
 
+	/*
+	 * Idle (not busy) counts are updated atomically outside of any
+	 * lock. fs_pick_lock only serializes threads that have to sleep
+	 * until something becomes idle, and those that wake them up.
+	 */
 	int64_t		fs_idle_files;	/* number of files NOT busy */
 	pthread_cond_t	fs_idle_files_cv; /* idle files condition variable */
 
@@ -117,16 +197,11 @@ typedef struct fileset {
 	int64_t		fs_idle_leafdirs; /* number of dirs NOT busy */
 	pthread_cond_t	fs_idle_leafdirs_cv; /* idle dirs condition variable */
 
-	pthread_mutex_t	fs_pick_lock;	/* per fileset "pick" function lock */
-	pthread_cond_t	fs_thrd_wait_cv; /* per fileset file busy wait cv */
-	avl_tree_t	fs_free_files;	/* btree of free files */
-	avl_tree_t	fs_exist_files;	/* btree of files on device */
-	avl_tree_t	fs_noex_files;	/* btree of files NOT on device */
-	avl_tree_t	fs_dirs;	/* btree of internal dirs */
-	avl_tree_t	fs_free_leaf_dirs; /* btree of free leaf dirs */
-	avl_tree_t	fs_exist_leaf_dirs; /* btree of leaf dirs on device */
-	avl_tree_t	fs_noex_leaf_dirs;  /* btree of leaf dirs NOT */
-					    /* currently on device */
+	pthread_mutex_t	fs_pick_lock;	/* lock for waiting on idle cvs */
+	int		fs_pick_waiters; /* threads waiting on idle cvs */
+
+	int		fs_nshards;	/* number of shards in use */
+	fileset_shard_t	fs_shards[FILESET_MAXSHARDS];
 	filesetentry_t	*fs_filelist;	/* List of files */
 	uint_t		fs_file_exrotor[FSE_MAXTID];	/* next file to */
 							/* select */
@@ -151,9 +226,15 @@ fileset_t *fileset_define(avd_t name, avd_t path);
 fileset_t *fileset_find(char *name);
 filesetentry_t *fileset_pick(fileset_t *fileset, int flags, int tid,
     int index);
-char *fileset_resolvepath(filesetentry_t *entry);
+int fileset_popularity_init(fileset_popularity_t *fp, fileset_t *fileset,
+    avd_t model, avd_t theta, avd_t hotset, avd_t hotaccess, avd_t locality);
+uint_t fileset_popularity_pick(fileset_popularity_t *fp, uint_t *lastp);
+int fileset_fullpath(filesetentry_t *entry, char *path, size_t len);
+int fileset_locate(filesetentry_t *entry, char *path, size_t len,
+    int *dirfdp, char **namep);
 int fileset_iter(int (*cmd)(fileset_t *fileset, int first));
 int fileset_print(fileset_t *fileset, int first);
+void fileset_busy(filesetentry_t *entry);
 void fileset_unbusy(filesetentry_t *entry, int update_exist,
     int new_exist_val, int open_cnt_incr);
 int fileset_dump_histo(fileset_t *fileset, int first);
@@ -29,6 +29,7 @@
 #include <sys/lwp.h>
 #endif
 #include <fcntl.h>
+#include <math.h>
 #include "filebench.h"
 #include "flowop.h"
 #include "stats.h"
@@ -141,73 +142,279 @@ flowop_beginop(threadflow_t *threadflow, flowop_t *flowop)
 	threadflow->tf_stime = gethrtime();
 }
 
-struct flowstats controlstats;
-pthread_mutex_t controlstats_lock;
-static int controlstats_zeroed = 0;
-
-static void
-flowop_populate_distribution(flowop_t *flowop,  unsigned long long ll_delay)
-{
-	unsigned int i;
-	unsigned long long iii;
-
-	iii = 1;
-	for (i = 0; i < OSPROF_BUCKET_NUMBER; i++) {
-		if (ll_delay < iii)
-			break;
-		iii <<= 1;
-	}
-	flowop->fo_stats.fs_distribution[i]++;
-}
-
 /*
  * Updates flowop's latency statistics, using saved start
  * time and current high resolution time. Updates flowop's
  * io count and transferred bytes statistics. Also updates
  * threadflow's and flowop's cumulative read or write byte
- * and io count statistics.
+ * and io count statistics. Only statistics private to the calling
+ * thread are updated, so no locks are taken.
  */
 void
 flowop_endop(threadflow_t *threadflow, flowop_t *flowop, int64_t bytes)
 {
+	struct flowstats *fs = &flowop->fo_stats;
+	struct ctlstats *cs = &threadflow->tf_ctlstats;
 	unsigned long long ll_delay;
 
 	ll_delay = (gethrtime() - threadflow->tf_stime);
 
+	STATS_WRITE_BEGIN(fs);
+
+	/* start over if the statistics were cleared since the last op */
+	if (fs->fs_gen != filebench_shm->shm_stats_gen)
+		stats_reset(fs, filebench_shm->shm_stats_gen);
+
 	/* setting minimum and maximum latencies for this flowop */
-	if (!flowop->fo_stats.fs_minlat || ll_delay < flowop->fo_stats.fs_minlat)
-		flowop->fo_stats.fs_minlat = ll_delay;
+	if (!fs->fs_minlat || ll_delay < fs->fs_minlat)
+		fs->fs_minlat = ll_delay;
 
-	if (ll_delay > flowop->fo_stats.fs_maxlat)
-		flowop->fo_stats.fs_maxlat = ll_delay;
+	if (ll_delay > fs->fs_maxlat)
+		fs->fs_maxlat = ll_delay;
 
-	flowop->fo_stats.fs_total_lat += ll_delay;
-	flowop->fo_stats.fs_count++;
-	flowop->fo_stats.fs_bytes += bytes;
-	(void) ipc_mutex_lock(&controlstats_lock);
+	fs->fs_total_lat += ll_delay;
+	fs->fs_count++;
+	fs->fs_bytes += bytes;
 	if ((flowop->fo_type & FLOW_TYPE_IO) ||
 	    (flowop->fo_type & FLOW_TYPE_AIO)) {
-		controlstats.fs_count++;
-		controlstats.fs_bytes += bytes;
+		cs->cs_count++;
+		cs->cs_bytes += bytes;
 	}
 	if (flowop->fo_attrs & FLOW_ATTR_READ) {
 		threadflow->tf_stats.fs_rbytes += bytes;
 		threadflow->tf_stats.fs_rcount++;
-		flowop->fo_stats.fs_rcount++;
-		controlstats.fs_rbytes += bytes;
-		controlstats.fs_rcount++;
+		fs->fs_rcount++;
+		cs->cs_rbytes += bytes;
+		cs->cs_rcount++;
 	} else if (flowop->fo_attrs & FLOW_ATTR_WRITE) {
 		threadflow->tf_stats.fs_wbytes += bytes;
 		threadflow->tf_stats.fs_wcount++;
-		flowop->fo_stats.fs_wcount++;
-		controlstats.fs_wbytes += bytes;
-		controlstats.fs_wcount++;
+		fs->fs_wcount++;
+		cs->cs_wbytes += bytes;
+		cs->cs_wcount++;
 	}
 
-	if (filebench_shm->lathist_enabled)
-		flowop_populate_distribution(flowop, ll_delay);
+	if (fs->fs_lathist)
+		fs->fs_lathist[stats_lathist_index(ll_delay)]++;
 
-	(void) ipc_mutex_unlock(&controlstats_lock);
+	STATS_WRITE_END(fs);
+}
+
+/*
+ * Adds up the I/O counters of all threads of the calling thread's
+ * process. The counters are read without locking while their threads
+ * keep updating them, so the sum is a close, monotonically growing
+ * approximation, which is all the rate limiters need.
+ */
+void
+flowop_ctlstats(threadflow_t *threadflow, struct ctlstats *sum)
+{
+	threadflow_t *tf;
+
+	(void) memset(sum, 0, sizeof (*sum));
+
+	for (tf = threadflow->tf_process->pf_threads; tf; tf = tf->tf_next) {
+		sum->cs_count += tf->tf_ctlstats.cs_count;
+		sum->cs_bytes += tf->tf_ctlstats.cs_bytes;
+		sum->cs_rcount += tf->tf_ctlstats.cs_rcount;
+		sum->cs_wcount += tf->tf_ctlstats.cs_wcount;
+		sum->cs_rbytes += tf->tf_ctlstats.cs_rbytes;
+		sum->cs_wbytes += tf->tf_ctlstats.cs_wbytes;
+	}
+}
+
+/*
+ * Sets up the random offset state of a flowop instance from its offset
+ * distribution attributes. Returns -1 if the distribution is unknown.
+ */
+static int
+flowop_offsets_init(flowop_t *flowop)
+{
+	flowop_offsets_t *fof = &flowop->fo_off;
+	char *name = NULL;
+
+	(void) memset(fof, 0, sizeof (*fof));
+
+	if (flowop->fo_offsetdist)
+		name = avd_get_str(flowop->fo_offsetdist);
+
+	if ((name == NULL) || (strcmp(name, "uniform") == 0)) {
+		fof->fof_dist = FLOW_OFFSET_UNIFORM;
+		return (0);
+	} else if (strcmp(name, "zipf") == 0) {
+		fof->fof_dist = FLOW_OFFSET_ZIPF;
+	} else if (strcmp(name, "hotspot") == 0) {
+		fof->fof_dist = FLOW_OFFSET_HOTSPOT;
+	} else if (strcmp(name, "normal") == 0) {
+		fof->fof_dist = FLOW_OFFSET_NORMAL;
+	} else if (strcmp(name, "runs") == 0) {
+		fof->fof_dist = FLOW_OFFSET_RUNS;
+	} else {
+		filebench_log(LOG_ERROR, "flowop %s: unknown offsetdist %s",
+		    flowop->fo_name, name);
+		return (-1);
+	}
+
+	fof->fof_theta = avd_get_int(flowop->fo_offsettheta) / 1000.0;
+	fof->fof_hotfrac = avd_get_int(flowop->fo_hotspot) / 100.0;
+	fof->fof_hotprob = avd_get_int(flowop->fo_hotspotaccess) / 100.0;
+	fof->fof_stddev = avd_get_int(flowop->fo_offsetstddev) / 100.0;
+	fof->fof_runlen = (double)avd_get_int(flowop->fo_runlength);
+	if (fof->fof_runlen < 1.0)
+		fof->fof_runlen = 1.0;
+
+	return (0);
+}
+
+/*
+ * Returns the offset of the next random I/O of "iosize" bytes by
+ * "flowop" within a working set of "wss" bytes, which must be at least
+ * iosize, according to the flowop's offset distribution. Offsets are
+ * multiples of iosize, as with fb_random64().
+ */
+uint64_t
+flowop_random_offset(flowop_t *flowop, fbint_t wss, fbint_t iosize)
+{
+	flowop_offsets_t *fof = &flowop->fo_off;
+	fb_rand_t *rng = &flowop->fo_thread->tf_rand;
+	uint64_t nblocks, nhot, block;
+	double u, dev;
+
+	if (iosize == 0)
+		iosize = 1;
+
+	/* the number of blocks only changes with the file */
+	if ((fof->fof_wss != wss) || (fof->fof_iosize != iosize)) {
+		fof->fof_wss = wss;
+		fof->fof_iosize = iosize;
+		fof->fof_nblocks = MAX(wss / iosize, 1);
+		if ((iosize & (iosize - 1)) != 0) {
+			fof->fof_shift = -1;
+		} else {
+#ifdef __GNUC__
+			fof->fof_shift = __builtin_ctzll(iosize);
+#else
+			for (fof->fof_shift = 0;
+			    (iosize >> fof->fof_shift) != 1; fof->fof_shift++)
+				;
+#endif
+		}
+	}
+	nblocks = fof->fof_nblocks;
+
+	if (fof->fof_dist == FLOW_OFFSET_UNIFORM) {
+		block = fb_rand_scale(fb_randring_next(
+		    &flowop->fo_thread->tf_randring), nblocks);
+		if (fof->fof_shift >= 0)
+			return (block << fof->fof_shift);
+		return (block * iosize);
+	}
+
+	switch (fof->fof_dist) {
+	case FLOW_OFFSET_ZIPF:
+		/* set up again for files of another size */
+		if (fof->fof_zipf.fz_n != nblocks) {
+			fb_zipf_init(&fof->fof_zipf, nblocks, fof->fof_theta);
+			fof->fof_stride = fb_coprime_stride(nblocks);
+		}
+
+		/* spread the hot blocks over the working set */
+		block = fb_zipf_next(&fof->fof_zipf, rng) - 1;
+		block = (block * fof->fof_stride) % nblocks;
+		break;
+
+	case FLOW_OFFSET_HOTSPOT:
+		nhot = MAX((uint64_t)(nblocks * fof->fof_hotfrac), 1);
+		if ((nhot >= nblocks) || (fb_rand_double(rng) < fof->fof_hotprob))
+			block = fb_rand_range(rng, MIN(nhot, nblocks));
+		else
+			block = nhot + fb_rand_range(rng, nblocks - nhot);
+		break;
+
+	case FLOW_OFFSET_NORMAL:
+		/* Box-Muller, around a center that moves a block per I/O */
+		u = 1.0 - fb_rand_double(rng);
+		dev = sqrt(-2.0 * log(u)) *
+		    cos(2.0 * M_PI * fb_rand_double(rng));
+		dev = fmod(dev * fof->fof_stddev * nblocks, (double)nblocks);
+		if (dev < 0)
+			dev += nblocks;
+
+		fof->fof_center = (fof->fof_center + 1) % nblocks;
+		block = (fof->fof_center + (uint64_t)dev) % nblocks;
+		break;
+
+	case FLOW_OFFSET_RUNS:
+		/* start a new run of exponentially distributed length */
+		if ((fof->fof_runleft == 0) || (fof->fof_next >= nblocks)) {
+			fof->fof_next = fb_rand_range(rng, nblocks);
+			u = 1.0 - fb_rand_double(rng);
+			fof->fof_runleft = (uint64_t)ceil(-fof->fof_runlen *
+			    log(u));
+			if (fof->fof_runleft == 0)
+				fof->fof_runleft = 1;
+		}
+
+		block = fof->fof_next++;
+		fof->fof_runleft--;
+		break;
+
+	default:
+		block = 0;
+	}
+
+	if (fof->fof_shift >= 0)
+		return (block << fof->fof_shift);
+	return (block * iosize);
+}
+
+/*
+ * Resolves the attributes used on every execution of "flowop" once, so
+ * that executions do not interpret their avds. Integer attributes get a
+ * constant version unless they are random or custom variables, which
+ * must be drawn anew on each use. Boolean attributes always resolve,
+ * into FLOW_ATTR_* flags of fo_attrs.
+ */
+static void
+flowop_resolve_attrs(flowop_t *flowop)
+{
+	int attrs = 0;
+
+	flowop->fo_constattrs = 0;
+
+	if (flowop->fo_iosize == NULL || avd_is_constant(flowop->fo_iosize)) {
+		flowop->fo_constiosize = flowop->fo_iosize ?
+		    avd_get_int(flowop->fo_iosize) : 0;
+		flowop->fo_constattrs |= FLOW_CONST_IOSIZE;
+	}
+
+	if (flowop->fo_iters == NULL || avd_is_constant(flowop->fo_iters)) {
+		flowop->fo_constiters = flowop->fo_iters ?
+		    avd_get_int(flowop->fo_iters) : 1;
+		flowop->fo_constattrs |= FLOW_CONST_ITERS;
+	}
+
+	if (flowop->fo_iodepth == NULL ||
+	    avd_is_constant(flowop->fo_iodepth)) {
+		flowop->fo_constiodepth = flowop->fo_iodepth ?
+		    avd_get_int(flowop->fo_iodepth) : 0;
+		flowop->fo_constattrs |= FLOW_CONST_IODEPTH;
+	}
+
+	if (flowop->fo_random && avd_get_bool(flowop->fo_random))
+		attrs |= FLOW_ATTR_RANDOM;
+	if (flowop->fo_dsync && avd_get_bool(flowop->fo_dsync))
+		attrs |= FLOW_ATTR_DSYNC;
+	if (flowop->fo_blocking && avd_get_bool(flowop->fo_blocking))
+		attrs |= FLOW_ATTR_BLOCKING;
+	if (flowop->fo_directio && avd_get_bool(flowop->fo_directio))
+		attrs |= FLOW_ATTR_DIRECTIO;
+	if (flowop->fo_noreadahead && avd_get_bool(flowop->fo_noreadahead))
+		attrs |= FLOW_ATTR_FADV_RANDOM;
+	if (flowop->fo_rotatefd && avd_get_bool(flowop->fo_rotatefd))
+		attrs |= FLOW_ATTR_ROTATEFD;
+
+	flowop->fo_attrs = (flowop->fo_attrs & ~FLOW_ATTR_RESOLVED) | attrs;
 }
 
 /*
@@ -227,6 +434,11 @@ flowop_initflow(flowop_t *flowop)
 	if (flowop->fo_wss)
 		flowop->fo_constwss = avd_get_int(flowop->fo_wss);
 
+	flowop_resolve_attrs(flowop);
+
+	if (flowop_offsets_init(flowop) < 0)
+		return (-1);
+
 	if ((*flowop->fo_init)(flowop) < 0) {
 		filebench_log(LOG_ERROR, "flowop %s-%d init failed",
 		    flowop->fo_name, flowop->fo_instance);
@@ -339,12 +551,18 @@ flowop_start(threadflow_t *threadflow)
 
 	set_thread_ioprio(threadflow);
 
-	(void) ipc_mutex_lock(&controlstats_lock);
-	if (!controlstats_zeroed) {
-		(void) memset(&controlstats, 0, sizeof (controlstats));
-		controlstats_zeroed = 1;
-	}
-	(void) ipc_mutex_unlock(&controlstats_lock);
+	/*
+	 * Random draws of this thread come from its own generator, seeded
+	 * from the run's seed and the thread's unique id, so that they are
+	 * reproducible and do not contend with other threads.
+	 */
+	fb_rand_seed(&threadflow->tf_rand,
+	    filebench_shm->shm_seed + threadflow->tf_utid);
+	fb_random_setthread(&threadflow->tf_rand);
+	fb_randring_seed(&threadflow->tf_randring, &threadflow->tf_rand);
+
+	(void) memset(&threadflow->tf_ctlstats, 0,
+	    sizeof (threadflow->tf_ctlstats));
 
 	flowop = threadflow->tf_thrd_fops;
 
@@ -421,12 +639,6 @@ flowop_start(threadflow_t *threadflow)
 		if (threadflow->tf_abort || filebench_shm->shm_f_abort)
 			break;
 
-		/* Be quiet while stats are gathered */
-		if (filebench_shm->shm_bequiet) {
-			(void) sleep(1);
-			continue;
-		}
-
 		/* Take it easy until everyone is ready to go */
 		if (!filebench_shm->shm_procs_running) {
 			(void) sleep(1);
@@ -439,7 +651,7 @@ flowop_start(threadflow_t *threadflow)
 		}
 
 		/* Execute the flowop for fo_iters times */
-		count = (int)avd_get_int(flowop->fo_iters);
+		count = (int)flowop_iters(flowop);
 		for (i = 0; i < count; i++) {
 
 			filebench_log(LOG_DEBUG_SCRIPT, "%s: executing flowop "
@@ -555,11 +767,8 @@ flowop_start(threadflow_t *threadflow)
 void
 flowop_init(int ismaster)
 {
-	if (ismaster) {
-		(void) pthread_mutex_init(&controlstats_lock,
-	   			 ipc_mutexattr(IPC_MUTEX_NORMAL));
+	if (ismaster)
 		flowoplib_flowinit();
-	}
 
 	switch (filebench_shm->shm_filesys_type) {
 	case LOCAL_FS_PLUG:
@@ -567,6 +776,15 @@ flowop_init(int ismaster)
 			fb_lfs_newflowops();
 		fb_lfs_funcvecinit();
 		break;
+	case IOURING_FS_PLUG:
+#ifdef HAVE_IO_URING
+		if (ismaster) {
+			fb_lfs_newflowops();
+			fb_uring_newflowops();
+		}
+		fb_uring_funcvecinit();
+#endif
+		break;
 	case NFS3_PLUG:
 	case NFS4_PLUG:
 	case CIFS_PLUG:
@@ -574,6 +792,65 @@ flowop_init(int ismaster)
 	}
 }
 
+/*
+ * Flowops are also kept in a hash table indexed by name, so that they
+ * can be looked up without walking the global list. Each chain keeps
+ * the definition, inner definition and FLOW_MASTER flowops ahead of the
+ * runtime instances, so that finding a master takes a few steps even
+ * when thousands of threads run flowops of the same name. The table is
+ * protected by shm_flowop_lock.
+ */
+static flowop_t **
+flowop_hash_bucket(char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return (&filebench_shm->shm_flowophash[hash &
+	    (FILEBENCH_FLOWOPHASHSIZE - 1)]);
+}
+
+static void
+flowop_hash_insert(flowop_t *flowop)
+{
+	flowop_t **bucket = flowop_hash_bucket(flowop->fo_name);
+	flowop_t *prev = NULL;
+	flowop_t *next = *bucket;
+
+	if (flowop->fo_instance > FLOW_DEFINITION) {
+		while (next && next->fo_instance <= FLOW_DEFINITION) {
+			prev = next;
+			next = next->fo_hashnext;
+		}
+	}
+
+	flowop->fo_hashprev = prev;
+	flowop->fo_hashnext = next;
+	if (next)
+		next->fo_hashprev = flowop;
+	if (prev)
+		prev->fo_hashnext = flowop;
+	else
+		*bucket = flowop;
+}
+
+static void
+flowop_hash_remove(flowop_t *flowop)
+{
+	if (flowop->fo_hashprev)
+		flowop->fo_hashprev->fo_hashnext = flowop->fo_hashnext;
+	else
+		*flowop_hash_bucket(flowop->fo_name) = flowop->fo_hashnext;
+
+	if (flowop->fo_hashnext)
+		flowop->fo_hashnext->fo_hashprev = flowop->fo_hashprev;
+
+	flowop->fo_hashnext = NULL;
+	flowop->fo_hashprev = NULL;
+}
+
 /*
  * Delete the designated flowop from the thread's flowop list.
  */
@@ -649,6 +926,7 @@ flowop_delete(flowop_t **flowoplist, flowop_t *flowop)
 		    "Deleted flowop: (%s-%d)",
 		    flowop->fo_name,
 		    flowop->fo_instance);
+		flowop_hash_remove(flowop);
 		ipc_free(FILEBENCH_FLOWOP, (char *)flowop);
 	} else {
 		filebench_log(LOG_DEBUG_IMPL, "Flowop %s-%d not found!",
@@ -742,7 +1020,33 @@ flowop_define_common(threadflow_t *threadflow, char *name, flowop_t *inherit,
 	/* Create backpointer to thread */
 	flowop->fo_thread = threadflow;
 
-	/* Add flowop to global list */
+	(void) strcpy(flowop->fo_name, name);
+	flowop->fo_instance = instance;
+	flowop_hash_insert(flowop);
+
+	/*
+	 * Runtime flowops are created from their FLOW_MASTER, or from a
+	 * runtime flowop which in turn points to its master. Statistics
+	 * are rolled up into the master through this pointer, and start
+	 * out empty rather than as a copy of the master's.
+	 */
+	flowop->fo_master = NULL;
+	if (inherit && instance > FLOW_DEFINITION) {
+		flowop->fo_master = (inherit->fo_instance == FLOW_MASTER) ?
+		    inherit : inherit->fo_master;
+		(void) memset(&flowop->fo_stats, 0, sizeof (struct flowstats));
+	}
+
+	/* the histogram of the flowop inherited from is not ours */
+	flowop->fo_stats.fs_lathist = NULL;
+	if (filebench_shm->lathist_enabled)
+		stats_lathist_attach(flowop);
+
+	/*
+	 * Add flowop to global list. This is done last, as stats_snap()
+	 * walks the list without taking shm_flowop_lock.
+	 */
+	FB_STORE_FENCE();
 	if (filebench_shm->shm_flowoplist == NULL) {
 		filebench_shm->shm_flowoplist = flowop;
 		flowop->fo_next = NULL;
@@ -751,9 +1055,6 @@ flowop_define_common(threadflow_t *threadflow, char *name, flowop_t *inherit,
 		filebench_shm->shm_flowoplist = flowop;
 	}
 
-	(void) strcpy(flowop->fo_name, name);
-	flowop->fo_instance = instance;
-
 	if (flowoplist_hdp == NULL)
 		return (flowop);
 
@@ -844,7 +1145,7 @@ flowop_find_barrier(void)
 
 /*
  * Returns a list of flowops named "name" from the master
- * flowop list.
+ * flowop list, using the name hash.
  */
 flowop_t *
 flowop_find(char *name)
@@ -856,7 +1157,7 @@ flowop_find(char *name)
 
 	(void) ipc_mutex_lock(&filebench_shm->shm_flowop_lock);
 
-	flowop = filebench_shm->shm_flowoplist;
+	flowop = *flowop_hash_bucket(name);
 
 	while (flowop) {
 		if (strcmp(name, flowop->fo_name) == 0) {
@@ -870,7 +1171,7 @@ flowop_find(char *name)
 				result = flowop;
 			}
 		}
-		flowop = flowop->fo_next;
+		flowop = flowop->fo_hashnext;
 	}
 
 	(void) ipc_mutex_unlock(&filebench_shm->shm_flowop_lock);
@@ -891,14 +1192,14 @@ flowop_find_one(char *name, int instance)
 
 	(void) ipc_mutex_lock(&filebench_shm->shm_flowop_lock);
 
-	test_flowop = filebench_shm->shm_flowoplist;
+	test_flowop = *flowop_hash_bucket(name);
 
 	while (test_flowop) {
 		if ((strcmp(name, test_flowop->fo_name) == 0) &&
 		    (instance == test_flowop->fo_instance))
 			break;
 
-		test_flowop = test_flowop->fo_next;
+		test_flowop = test_flowop->fo_hashnext;
 	}
 
 	(void) ipc_mutex_unlock(&filebench_shm->shm_flowop_lock);
@@ -1007,7 +1308,7 @@ flowop_composite(threadflow_t *threadflow, flowop_t *flowop)
 			return (FILEBENCH_DONE);
 
 		/* Execute the flowop for fo_iters times */
-		count = (int)avd_get_int(inner_flowop->fo_iters);
+		count = (int)flowop_iters(inner_flowop);
 		for (i = 0; i < count; i++) {
 
 			filebench_log(LOG_DEBUG_SCRIPT, "%s: executing flowop "
@@ -28,63 +28,135 @@
 
 #include "filebench.h"
 
+/* Distributions of random offsets within files */
+#define	FLOW_OFFSET_UNIFORM	0
+#define	FLOW_OFFSET_ZIPF	1 /* Zipf over the blocks */
+#define	FLOW_OFFSET_HOTSPOT	2 /* Most I/Os to the start of the wss */
+#define	FLOW_OFFSET_NORMAL	3 /* Normal around a moving center */
+#define	FLOW_OFFSET_RUNS	4 /* Sequential runs from random offsets */
+
+/*
+ * Random offset state of a flowop instance, set up from its attributes
+ * by flowop_initflow(). Only the owning thread uses it, and draws from
+ * the thread's generator. Offsets are drawn in blocks of the I/O size.
+ */
+typedef struct flowop_offsets {
+	int		fof_dist;	/* FLOW_OFFSET_* */
+	fbint_t		fof_wss;	/* Working set of the last I/O */
+	fbint_t		fof_iosize;	/* Size of the last I/O */
+	uint64_t	fof_nblocks;	/* fof_wss / fof_iosize */
+	int		fof_shift;	/* log2(fof_iosize), or -1 */
+	fb_zipf_t	fof_zipf;	/* Zipf, for the last block count */
+	uint64_t	fof_stride;	/* Zipf rank to block multiplier */
+	double		fof_theta;	/* Zipf exponent */
+	double		fof_hotfrac;	/* Fraction of blocks that are hot */
+	double		fof_hotprob;	/* Probability of a hot I/O */
+	double		fof_stddev;	/* Fraction of blocks */
+	double		fof_runlen;	/* Mean I/Os per run */
+	uint64_t	fof_center;	/* Normal: current center block */
+	uint64_t	fof_next;	/* Runs: next block of the run */
+	uint64_t	fof_runleft;	/* Runs: I/Os left in the run */
+} flowop_offsets_t;
+
+/*
+ * Flowops live in the shared memory array shm_flowop[], and the runtime
+ * instances of different threads sit next to each other there. The
+ * fields are therefore grouped by how they are accessed:
+ *
+ *  - read-mostly fields needed to execute the flowop come first;
+ *  - definition data, used when flowops are defined, created and looked
+ *    up (names, lists, attribute descriptors), is kept out of the way;
+ *  - the statistics and other state the owning thread updates on every
+ *    execution start on a cache line of their own, and the structure is
+ *    padded to a whole number of cache lines, so threads updating their
+ *    own flowops do not false-share with their neighbours.
+ */
 typedef struct flowop {
-	char		fo_name[128];	/* Name */
-	int		fo_instance;	/* Instance number */
-	struct flowop	*fo_next;	/* Next in global list */
-	struct flowop	*fo_exec_next;	/* Next in thread's or compfo's list */
-	struct flowop	*fo_resultnext;	/* List of flowops in result */
-	struct flowop	*fo_comp_fops;	/* List of flowops in composite fo */
-	var_t		*fo_lvar_list;	/* List of composite local vars */
-	struct threadflow *fo_thread;	/* Backpointer to thread */
+	/* Read-mostly, used on every execution */
 	int		(*fo_func)();	/* Method */
-	int		(*fo_init)();	/* Init Method */
-	void		(*fo_destruct)(); /* Destructor Method */
+	struct threadflow *fo_thread;	/* Backpointer to thread */
+	struct flowop	*fo_exec_next;	/* Next in thread's or compfo's list */
 	int		fo_type;	/* Type */
 	int		fo_attrs;	/* Flow op attribute */
-	avd_t		fo_filename;	/* file/fileset name */
 	fileset_t	*fo_fileset;	/* Fileset for op */
 	int		fo_fdnumber;	/* User specified file descriptor */
 	int		fo_srcfdnumber;	/* User specified src file descriptor */
 	fbint_t		fo_constvalue;	/* constant version of fo_value */
 	fbint_t		fo_constwss;	/* constant version of fo_wss */
+	int		fo_constattrs;	/* FLOW_CONST_* attributes resolved */
+	fbint_t		fo_constiosize;	/* constant version of fo_iosize */
+	fbint_t		fo_constiters;	/* constant version of fo_iters */
+	fbint_t		fo_constiodepth; /* constant version of fo_iodepth */
 	avd_t		fo_iosize;	/* Size of operation */
 	avd_t		fo_wss;		/* Flow op working set size */
-	char		fo_targetname[128]; /* Target, for wakeup etc... */
+	avd_t		fo_iters;	/* Number of iterations of op */
+	avd_t		fo_random;	/* Attr */
+	avd_t		fo_rotatefd;	/* Attr */
+	avd_t		fo_iodepth;	/* Max async I/Os in flight */
+	char		*fo_buf;	/* Per-flowop buffer */
+	uint64_t	fo_buf_size;	/* current size of buffer */
 	struct flowop	*fo_targets;	/* List of targets matching name */
+
+	/* Definition data */
+	char		fo_name[128];	/* Name */
+	int		fo_instance;	/* Instance number */
+	struct flowop	*fo_next;	/* Next in global list */
+	struct flowop	*fo_hashnext;	/* Next in name hash chain */
+	struct flowop	*fo_hashprev;	/* Previous in name hash chain */
+	struct flowop	*fo_master;	/* FLOW_MASTER this one runs for */
+	struct flowop	*fo_resultnext;	/* List of flowops in result */
+	struct flowop	*fo_comp_fops;	/* List of flowops in composite fo */
+	var_t		*fo_lvar_list;	/* List of composite local vars */
+	int		(*fo_init)();	/* Init Method */
+	void		(*fo_destruct)(); /* Destructor Method */
+	avd_t		fo_filename;	/* file/fileset name */
+	char		fo_targetname[128]; /* Target, for wakeup etc... */
 	struct flowop	*fo_targetnext;	/* List of targets matching name */
-	avd_t		fo_iters;	/* Number of iterations of op */
 	avd_t		fo_value;	/* Attr */
 	avd_t		fo_sequential;	/* Attr */
-	avd_t		fo_random;	/* Attr */
 	avd_t		fo_stride;	/* Attr */
 	avd_t		fo_backwards;	/* Attr */
 	avd_t		fo_dsync;	/* Attr */
 	avd_t		fo_blocking;	/* Attr */
 	avd_t		fo_directio;	/* Attr */
-	avd_t		fo_rotatefd;	/* Attr */
 	avd_t		fo_fileindex;	/* Attr */
+	avd_t		fo_popularity;	/* Attr, NULL to use the fileset's */
+	avd_t		fo_theta;	/* Attr */
+	avd_t		fo_hotset;	/* Attr */
+	avd_t		fo_hotaccess;	/* Attr */
+	avd_t		fo_locality;	/* Attr */
+	avd_t		fo_offsetdist;	/* Attr, FLOW_OFFSET_* by name */
+	avd_t		fo_offsettheta;	/* Attr, Zipf exponent (* 1000) */
+	avd_t		fo_hotspot;	/* Attr, % of wss that is hot */
+	avd_t		fo_hotspotaccess; /* Attr, % of I/Os to the hot spot */
+	avd_t		fo_offsetstddev; /* Attr, % of wss */
+	avd_t		fo_runlength;	/* Attr, mean I/Os per run */
 	avd_t		fo_noreadahead; /* Attr */
-	struct flowstats	fo_stats;	/* Flow statistics */
+	avd_t		fo_highwater;	/* value of highwater paramter */
+
+	/* Synchronization with other threads */
 	pthread_cond_t	fo_cv;		/* Block/wakeup cv */
 	pthread_mutex_t	fo_lock;	/* Mutex around flowop */
 	void		*fo_private;	/* Flowop private scratch pad area */
-	char		*fo_buf;	/* Per-flowop buffer */
-	uint64_t	fo_buf_size;	/* current size of buffer */
 #ifdef HAVE_SYSV_SEM
 	int		fo_semid_lw;	/* sem id */
 	int		fo_semid_hw;	/* sem id for highwater block */
 #else
 	sem_t		fo_sem;		/* sem_t for posix semaphores */
 #endif /* HAVE_SYSV_SEM */
-	avd_t		fo_highwater;	/* value of highwater paramter */
 	void		*fo_idp;	/* id, for sems etc */
-	hrtime_t	fo_timestamp;	/* for ratecontrol, etc... */
+
+	/* Updated by the owning thread on every execution */
+	struct flowstats fo_stats FB_CACHE_ALIGNED; /* Flow statistics */
+	int		fo_inflight;	/* Async I/Os now in flight */
+	flowop_offsets_t fo_off;	/* Random offset state */
+	fileset_popularity_t fo_pop;	/* Popularity, set up on first pick */
+	uint_t		fo_lastfile;	/* Index + 1 of the last picked file */
 	int		fo_initted;	/* Set to one if initialized */
+	hrtime_t	fo_timestamp;	/* for ratecontrol, etc... */
 	int64_t		fo_tputbucket;	/* Throughput bucket, for limiter */
 	uint64_t	fo_tputlast;	/* Throughput count, for delta's */
-
-} flowop_t;
+} FB_CACHE_ALIGNED flowop_t;
 
 /* Flow Op Attrs */
 #define	FLOW_ATTR_SEQUENTIAL	0x1
@@ -97,6 +169,17 @@ typedef struct flowop {
 #define	FLOW_ATTR_READ		0x80
 #define	FLOW_ATTR_WRITE		0x100
 #define FLOW_ATTR_FADV_RANDOM	0x200
+#define	FLOW_ATTR_ROTATEFD	0x400
+
+/* Flow Op Attrs resolved from the boolean attributes by flowop_initflow() */
+#define	FLOW_ATTR_RESOLVED	(FLOW_ATTR_RANDOM | FLOW_ATTR_DSYNC | \
+				FLOW_ATTR_BLOCKING | FLOW_ATTR_DIRECTIO | \
+				FLOW_ATTR_FADV_RANDOM | FLOW_ATTR_ROTATEFD)
+
+/* Integer attributes with a constant version, set by flowop_initflow() */
+#define	FLOW_CONST_IOSIZE	0x1
+#define	FLOW_CONST_ITERS	0x2
+#define	FLOW_CONST_IODEPTH	0x4
 
 /* Flowop Instance Numbers */
 			    /* Worker flowops have instance numbers > 0 */
@@ -123,9 +206,6 @@ typedef struct flowop_proto {
 	void	(*fl_destruct)();
 } flowop_proto_t;
 
-extern struct flowstats controlstats;
-extern pthread_mutex_t controlstats_lock;
-
 flowop_t *flowop_define(threadflow_t *, char *name, flowop_t *inherit,
 		flowop_t **flowoplist_hdp, int instance, int type);
 
@@ -140,7 +220,9 @@ int flowoplib_iosetup(threadflow_t *threadflow, flowop_t *flowop,
 void flowoplib_flowinit(void);
 void flowop_delete_all(flowop_t **threadlist);
 void flowop_endop(threadflow_t *threadflow, flowop_t *flowop, int64_t bytes);
+uint64_t flowop_random_offset(flowop_t *flowop, fbint_t wss, fbint_t iosize);
 void flowop_beginop(threadflow_t *threadflow, flowop_t *flowop);
+void flowop_ctlstats(threadflow_t *threadflow, struct ctlstats *sum);
 void flowop_destruct_all_flows(threadflow_t *threadflow);
 flowop_t *flowop_new_composite_define(char *name);
 void flowop_printall(void);
@@ -151,4 +233,38 @@ void flowop_init(int ismaster);
 void fb_lfs_funcvecinit();
 void fb_lfs_newflowops();
 
+/* io_uring specific */
+void fb_uring_funcvecinit();
+void fb_uring_newflowops();
+void fb_uring_closefd(threadflow_t *threadflow, int fd);
+
+/*
+ * Accessors for the integer attributes used on every execution. They
+ * return the constant version when flowop_initflow() could resolve the
+ * attribute, and draw a new value when it is a random or custom variable.
+ */
+static inline fbint_t
+flowop_iosize(flowop_t *flowop)
+{
+	if (flowop->fo_constattrs & FLOW_CONST_IOSIZE)
+		return (flowop->fo_constiosize);
+	return (avd_get_int(flowop->fo_iosize));
+}
+
+static inline fbint_t
+flowop_iters(flowop_t *flowop)
+{
+	if (flowop->fo_constattrs & FLOW_CONST_ITERS)
+		return (flowop->fo_constiters);
+	return (avd_get_int(flowop->fo_iters));
+}
+
+static inline fbint_t
+flowop_iodepth(flowop_t *flowop)
+{
+	if (flowop->fo_constattrs & FLOW_CONST_IODEPTH)
+		return (flowop->fo_constiodepth);
+	return (flowop->fo_iodepth ? avd_get_int(flowop->fo_iodepth) : 0);
+}
+
 #endif	/* _FB_FLOWOP_H */
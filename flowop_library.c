@@ -76,7 +76,12 @@ static void flowoplib_destruct_noop(flowop_t *flowop);
 static int flowoplib_fdnum(threadflow_t *threadflow, flowop_t *flowop);
 static int flowoplib_print(threadflow_t *threadflow, flowop_t *flowop);
 static int flowoplib_write(threadflow_t *threadflow, flowop_t *flowop);
+static int flowoplib_write_random(threadflow_t *threadflow, flowop_t *flowop);
+static int flowoplib_write_seq(threadflow_t *threadflow, flowop_t *flowop);
 static int flowoplib_read(threadflow_t *threadflow, flowop_t *flowop);
+static int flowoplib_read_random(threadflow_t *threadflow, flowop_t *flowop);
+static int flowoplib_read_seq(threadflow_t *threadflow, flowop_t *flowop);
+static int flowoplib_rw_init(flowop_t *flowop);
 static int flowoplib_block_init(flowop_t *flowop);
 static int flowoplib_block(threadflow_t *threadflow, flowop_t *flowop);
 static int flowoplib_wakeup(threadflow_t *threadflow, flowop_t *flowop);
@@ -113,9 +118,9 @@ static int flowoplib_testrandvar_init(flowop_t *flowop);
 static void flowoplib_testrandvar_destruct(flowop_t *flowop);
 
 static flowop_proto_t flowoplib_funcs[] = {
-	{FLOW_TYPE_IO, FLOW_ATTR_WRITE, "write", flowop_init_generic,
+	{FLOW_TYPE_IO, FLOW_ATTR_WRITE, "write", flowoplib_rw_init,
 	flowoplib_write, flowop_destruct_generic},
-	{FLOW_TYPE_IO, FLOW_ATTR_READ, "read", flowop_init_generic,
+	{FLOW_TYPE_IO, FLOW_ATTR_READ, "read", flowoplib_rw_init,
 	flowoplib_read, flowop_destruct_generic},
 	{FLOW_TYPE_SYNC, 0, "block", flowoplib_block_init,
 	flowoplib_block, flowop_destruct_generic},
@@ -209,18 +214,39 @@ flowoplib_destruct_noop(flowop_t *flowop)
 static int
 flowoplib_fileattrs(flowop_t *flowop)
 {
-	int attrs = 0;
-
-	if (avd_get_bool(flowop->fo_directio))
-		attrs |= FLOW_ATTR_DIRECTIO;
+	/* resolved from the flowop's attributes by flowop_initflow() */
+	return (flowop->fo_attrs &
+	    (FLOW_ATTR_DIRECTIO | FLOW_ATTR_DSYNC | FLOW_ATTR_FADV_RANDOM));
+}
 
-	if (avd_get_bool(flowop->fo_dsync))
-		attrs |= FLOW_ATTR_DSYNC;
-	
-	if (avd_get_bool(flowop->fo_noreadahead))
-		attrs |= FLOW_ATTR_FADV_RANDOM;
+/*
+ * Returns the popularity state that picks of existing files by "flowop"
+ * follow, setting it up on first use from the flowop's attributes, with
+ * the fileset's filling in those it lacks. Returns NULL if files are just
+ * picked in rotation, or if the attributes are bad, in which case
+ * *errp is set.
+ */
+static fileset_popularity_t *
+flowoplib_popularity(flowop_t *flowop, fileset_t *fileset, int *errp)
+{
+	fileset_popularity_t *fp = &flowop->fo_pop;
+
+	if (fp->fp_n != fileset->fs_constentries) {
+		if (fileset_popularity_init(fp, fileset,
+		    flowop->fo_popularity ? flowop->fo_popularity :
+		    fileset->fs_popularity,
+		    flowop->fo_theta ? flowop->fo_theta : fileset->fs_theta,
+		    flowop->fo_hotset ? flowop->fo_hotset : fileset->fs_hotset,
+		    flowop->fo_hotaccess ? flowop->fo_hotaccess :
+		    fileset->fs_hotaccess,
+		    flowop->fo_locality ? flowop->fo_locality :
+		    fileset->fs_locality) == FILEBENCH_ERROR) {
+			*errp = 1;
+			return (NULL);
+		}
+	}
 
-	return (attrs);
+	return (fp->fp_active ? fp : NULL);
 }
 
 /*
@@ -234,17 +260,28 @@ static int
 flowoplib_pickfile(filesetentry_t **filep, flowop_t *flowop, int flags, int tid)
 {
 	fileset_t	*fileset;
+	fileset_popularity_t *fp = NULL;
 	int		fileindex;
+	int		err = 0;
 
 	if ((fileset = flowop->fo_fileset) == NULL) {
 		filebench_log(LOG_ERROR, "flowop NO fileset");
 		return (FILEBENCH_ERROR);
 	}
 
+	/* files to create or to pick uniquely ignore popularity */
+	if (!(flags & (FILESET_PICKUNIQUE | FILESET_PICKNOEXIST)))
+		fp = flowoplib_popularity(flowop, fileset, &err);
+	if (err)
+		return (FILEBENCH_ERROR);
+
 	if (flowop->fo_fileindex) {
 		fileindex = (int)(avd_get_dbl(flowop->fo_fileindex));
 		fileindex = fileindex % fileset->fs_constentries;
 		flags |= FILESET_PICKBYINDEX;
+	} else if (fp) {
+		fileindex = fileset_popularity_pick(fp, &flowop->fo_lastfile);
+		flags |= FILESET_PICKBYINDEX;
 	} else {
 		fileindex = 0;
 	}
@@ -258,6 +295,8 @@ flowoplib_pickfile(filesetentry_t **filep, flowop_t *flowop, int flags, int tid)
 		return (FILEBENCH_NORSC);
 	}
 
+	flowop->fo_lastfile = (*filep)->fse_index + 1;
+
 	return (FILEBENCH_OK);
 }
 
@@ -322,7 +361,7 @@ flowoplib_fdnum(threadflow_t *threadflow, flowop_t *flowop)
 		goto retfd;
 	}
 
-	if (!avd_get_bool(flowop->fo_rotatefd)) {
+	if (!(flowop->fo_attrs & FLOW_ATTR_ROTATEFD)) {
 		filebench_log(LOG_DEBUG_IMPL, "picking default fd");
 		goto retfd;
 	}
@@ -508,72 +547,123 @@ flowoplib_iosetup(threadflow_t *threadflow, flowop_t *flowop,
  * any errors are encountered, FILEBENCH_ERROR is returned,
  * if no appropriate file can be obtained from the fileset then
  * FILEBENCH_NORSC is returned, otherise FILEBENCH_OK is returned.
+ *
+ * flowoplib_rw_init() replaces it by the random or the sequential
+ * variant, so that executions need not check the "random" attribute.
  */
 static int
 flowoplib_read(threadflow_t *threadflow, flowop_t *flowop)
+{
+	if (flowop->fo_attrs & FLOW_ATTR_RANDOM)
+		return (flowoplib_read_random(threadflow, flowop));
+
+	return (flowoplib_read_seq(threadflow, flowop));
+}
+
+/*
+ * Reads at a random offset within the working set.
+ */
+static int
+flowoplib_read_random(threadflow_t *threadflow, flowop_t *flowop)
 {
 	caddr_t iobuf;
 	fbint_t wss;
 	fbint_t iosize;
 	fb_fdesc_t *fdesc;
+	uint64_t fileoffset;
 	int ret;
 
-	iosize = avd_get_int(flowop->fo_iosize);
+	iosize = flowop_iosize(flowop);
 
 	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
 	    &fdesc, iosize)) != FILEBENCH_OK)
 		return (ret);
 
-	if (avd_get_bool(flowop->fo_random)) {
-		uint64_t fileoffset;
+	if (iosize > wss) {
+		filebench_log(LOG_ERROR,
+		    "file size smaller than IO size for thread %s",
+		    flowop->fo_name);
+		return (FILEBENCH_ERROR);
+	}
 
-		if (iosize > wss) {
-			filebench_log(LOG_ERROR,
-			    "file size smaller than IO size for thread %s",
-			    flowop->fo_name);
-			return (FILEBENCH_ERROR);
-		}
+	/* select randomly */
+	fileoffset = flowop_random_offset(flowop, wss, iosize);
 
-		/* select randomly */
-		fb_random64(&fileoffset, wss, iosize, NULL);
+	(void) flowop_beginop(threadflow, flowop);
+	if ((ret = FB_PREAD(fdesc, iobuf,
+	    iosize, (off64_t)fileoffset)) == -1) {
+		(void) flowop_endop(threadflow, flowop, 0);
+		filebench_log(LOG_ERROR,
+		    "read file %s failed, offset %llu "
+		    "io buffer %zd: %s",
+		    avd_get_str(flowop->fo_fileset->fs_name),
+		    (u_longlong_t)fileoffset, iobuf, strerror(errno));
+		flowop_endop(threadflow, flowop, 0);
+		return (FILEBENCH_ERROR);
+	}
+	(void) flowop_endop(threadflow, flowop, ret);
 
-		(void) flowop_beginop(threadflow, flowop);
-		if ((ret = FB_PREAD(fdesc, iobuf,
-		    iosize, (off64_t)fileoffset)) == -1) {
-			(void) flowop_endop(threadflow, flowop, 0);
-			filebench_log(LOG_ERROR,
-			    "read file %s failed, offset %llu "
-			    "io buffer %zd: %s",
-			    avd_get_str(flowop->fo_fileset->fs_name),
-			    (u_longlong_t)fileoffset, iobuf, strerror(errno));
-			flowop_endop(threadflow, flowop, 0);
-			return (FILEBENCH_ERROR);
-		}
-		(void) flowop_endop(threadflow, flowop, ret);
+	if ((ret == 0))
+		(void) FB_LSEEK(fdesc, 0, SEEK_SET);
 
-		if ((ret == 0))
-			(void) FB_LSEEK(fdesc, 0, SEEK_SET);
+	return (FILEBENCH_OK);
+}
 
-	} else {
-		(void) flowop_beginop(threadflow, flowop);
-		if ((ret = FB_READ(fdesc, iobuf, iosize)) == -1) {
-			(void) flowop_endop(threadflow, flowop, 0);
-			filebench_log(LOG_ERROR,
-			    "read file %s failed, io buffer %zd: %s",
-			    avd_get_str(flowop->fo_fileset->fs_name),
-			    iobuf, strerror(errno));
-			(void) flowop_endop(threadflow, flowop, 0);
-			return (FILEBENCH_ERROR);
-		}
-		(void) flowop_endop(threadflow, flowop, ret);
+/*
+ * Reads at the file's current offset, rewinding at the end of file.
+ */
+static int
+flowoplib_read_seq(threadflow_t *threadflow, flowop_t *flowop)
+{
+	caddr_t iobuf;
+	fbint_t wss;
+	fbint_t iosize;
+	fb_fdesc_t *fdesc;
+	int ret;
+
+	iosize = flowop_iosize(flowop);
+
+	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
+	    &fdesc, iosize)) != FILEBENCH_OK)
+		return (ret);
 
-		if ((ret == 0))
-			(void) FB_LSEEK(fdesc, 0, SEEK_SET);
+	(void) flowop_beginop(threadflow, flowop);
+	if ((ret = FB_READ(fdesc, iobuf, iosize)) == -1) {
+		(void) flowop_endop(threadflow, flowop, 0);
+		filebench_log(LOG_ERROR,
+		    "read file %s failed, io buffer %zd: %s",
+		    avd_get_str(flowop->fo_fileset->fs_name),
+		    iobuf, strerror(errno));
+		(void) flowop_endop(threadflow, flowop, 0);
+		return (FILEBENCH_ERROR);
 	}
+	(void) flowop_endop(threadflow, flowop, ret);
+
+	if ((ret == 0))
+		(void) FB_LSEEK(fdesc, 0, SEEK_SET);
 
 	return (FILEBENCH_OK);
 }
 
+/*
+ * Initializes a "read" or "write" flowop, choosing once between the
+ * random and sequential variants of its method.
+ */
+static int
+flowoplib_rw_init(flowop_t *flowop)
+{
+	int random = flowop->fo_attrs & FLOW_ATTR_RANDOM;
+
+	if (flowop->fo_attrs & FLOW_ATTR_READ)
+		flowop->fo_func = random ?
+		    flowoplib_read_random : flowoplib_read_seq;
+	else
+		flowop->fo_func = random ?
+		    flowoplib_write_random : flowoplib_write_seq;
+
+	return (flowop_init_generic(flowop));
+}
+
 /*
  * Initializes a "flowop_block" flowop. Specifically, it
  * initializes the flowop's fo_cv and unlocks the fo_lock.
@@ -829,10 +919,10 @@ flowoplib_iopslimit(threadflow_t *threadflow, flowop_t *flowop)
 		 */
 		iops = flowop->fo_targets->fo_stats.fs_count;
 	} else {
-		(void) ipc_mutex_lock(&controlstats_lock);
-		iops = (controlstats.fs_rcount +
-		    controlstats.fs_wcount);
-		(void) ipc_mutex_unlock(&controlstats_lock);
+		struct ctlstats cs;
+
+		flowop_ctlstats(threadflow, &cs);
+		iops = cs.cs_rcount + cs.cs_wcount;
 	}
 
 	/* Is this the first time around */
@@ -904,9 +994,10 @@ flowoplib_opslimit(threadflow_t *threadflow, flowop_t *flowop)
 	if (flowop->fo_targets) {
 		ops = flowop->fo_targets->fo_stats.fs_count;
 	} else {
-		(void) ipc_mutex_lock(&controlstats_lock);
-		ops = controlstats.fs_count;
-		(void) ipc_mutex_unlock(&controlstats_lock);
+		struct ctlstats cs;
+
+		flowop_ctlstats(threadflow, &cs);
+		ops = cs.cs_count;
 	}
 
 	/* Is this the first time around */
@@ -993,10 +1084,10 @@ flowoplib_bwlimit(threadflow_t *threadflow, flowop_t *flowop)
 		 */
 		bytes = flowop->fo_targets->fo_stats.fs_bytes;
 	} else {
-		(void) ipc_mutex_lock(&controlstats_lock);
-		bytes = (controlstats.fs_rbytes +
-		    controlstats.fs_wbytes);
-		(void) ipc_mutex_unlock(&controlstats_lock);
+		struct ctlstats cs;
+
+		flowop_ctlstats(threadflow, &cs);
+		bytes = cs.cs_rbytes + cs.cs_wbytes;
 	}
 
 	/* Is this the first time around? */
@@ -1073,9 +1164,10 @@ flowoplib_finishonbytes(threadflow_t *threadflow, flowop_t *flowop)
 	if (flowop->fo_targets) {
 		bytes_io = flowop->fo_targets->fo_stats.fs_bytes;
 	} else {
-		(void) ipc_mutex_lock(&controlstats_lock);
-		bytes_io = controlstats.fs_bytes;
-		(void) ipc_mutex_unlock(&controlstats_lock);
+		struct ctlstats cs;
+
+		flowop_ctlstats(threadflow, &cs);
+		bytes_io = cs.cs_bytes;
 	}
 
 	flowop_beginop(threadflow, flowop);
@@ -1111,9 +1203,10 @@ flowoplib_finishoncount(threadflow_t *threadflow, flowop_t *flowop)
 	if (flowop->fo_targets) {
 		ops = flowop->fo_targets->fo_stats.fs_count;
 	} else {
-		(void) ipc_mutex_lock(&controlstats_lock);
-		ops = controlstats.fs_count;
-		(void) ipc_mutex_unlock(&controlstats_lock);
+		struct ctlstats cs;
+
+		flowop_ctlstats(threadflow, &cs);
+		ops = cs.cs_count;
 	}
 
 	flowop_beginop(threadflow, flowop);
@@ -1184,7 +1277,7 @@ flowoplib_semblock_init(flowop_t *flowop)
 	sem_init(&flowop->fo_sem, 1, 0);
 #endif	/* HAVE_SYSV_SEM */
 
-	if (!(avd_get_bool(flowop->fo_blocking)))
+	if (!(flowop->fo_attrs & FLOW_ATTR_BLOCKING))
 		(void) ipc_mutex_unlock(&flowop->fo_lock);
 
 	return (FILEBENCH_OK);
@@ -1239,7 +1332,7 @@ flowoplib_semblock(threadflow_t *threadflow, flowop_t *flowop)
 	timeout.tv_sec = 600;
 	timeout.tv_nsec = 0;
 
-	if (avd_get_bool(flowop->fo_blocking))
+	if (flowop->fo_attrs & FLOW_ATTR_BLOCKING)
 		(void) ipc_mutex_unlock(&flowop->fo_lock);
 
 	flowop_beginop(threadflow, flowop);
@@ -1252,7 +1345,7 @@ flowoplib_semblock(threadflow_t *threadflow, flowop_t *flowop)
 	(void) semop(sys_semid, &sbuf[1], 1);
 #endif /* HAVE_SEMTIMEDOP */
 
-	if (avd_get_bool(flowop->fo_blocking))
+	if (flowop->fo_attrs & FLOW_ATTR_BLOCKING)
 		(void) ipc_mutex_lock(&flowop->fo_lock);
 
 	flowop_endop(threadflow, flowop, 0);
@@ -1370,7 +1463,7 @@ flowoplib_sempost(threadflow_t *threadflow, flowop_t *flowop)
 		timeout.tv_sec = 600;
 		timeout.tv_nsec = 0;
 
-		if (avd_get_bool(flowop->fo_blocking))
+		if (flowop->fo_attrs & FLOW_ATTR_BLOCKING)
 			blocking = 1;
 		else
 			blocking = 0;
@@ -1496,7 +1589,7 @@ flowoplib_openfile_common(threadflow_t *threadflow, flowop_t *flowop, int fd)
 	 * If the flowop doesn't default to persistent fd
 	 * then get unique thread ID for use by fileset_pick
 	 */
-	if (avd_get_bool(flowop->fo_rotatefd))
+	if (flowop->fo_attrs & FLOW_ATTR_ROTATEFD)
 		tid = threadflow->tf_utid;
 
 	if (threadflow->tf_fd[fd].fd_ptr != NULL) {
@@ -1515,7 +1608,7 @@ flowoplib_openfile_common(threadflow_t *threadflow, flowop_t *flowop, int fd)
 		(void) fb_strlcat(name, "/", MAXPATHLEN);
 		(void) fb_strlcat(name, fileset_name, MAXPATHLEN);
 
-		if (avd_get_bool(flowop->fo_dsync))
+		if (flowop->fo_attrs & FLOW_ATTR_DSYNC)
 			open_attrs |= O_SYNC;
 
 #ifdef HAVE_O_DIRECT
@@ -1686,7 +1779,8 @@ flowoplib_deletefile(threadflow_t *threadflow, flowop_t *flowop)
 	filesetentry_t *file;
 	fileset_t *fileset;
 	char path[MAXPATHLEN];
-	char *pathtmp;
+	char *name;
+	int dirfd;
 	int fd;
 
 	fd = flowoplib_fdnum(threadflow, flowop);
@@ -1732,17 +1826,7 @@ flowoplib_deletefile(threadflow_t *threadflow, flowop_t *flowop)
 		}
 	} else {
 		/* delete specific file. wait for it to be non-busy */
-		(void) ipc_mutex_lock(&fileset->fs_pick_lock);
-		while (file->fse_flags & FSE_BUSY) {
-			file->fse_flags |= FSE_THRD_WAITNG;
-			(void) pthread_cond_wait(&fileset->fs_thrd_wait_cv,
-			    &fileset->fs_pick_lock);
-		}
-
-		/* File now available, grab it for deletion */
-		file->fse_flags |= FSE_BUSY;
-		fileset->fs_idle_files--;
-		(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
+		fileset_busy(file);
 	}
 
 	/* don't delete if anyone (other than me) has file open */
@@ -1767,16 +1851,15 @@ flowoplib_deletefile(threadflow_t *threadflow, flowop_t *flowop)
 		return (FILEBENCH_OK);
 	}
 
-	(void) fb_strlcpy(path, avd_get_str(fileset->fs_path), MAXPATHLEN);
-	(void) fb_strlcat(path, "/", MAXPATHLEN);
-	(void) fb_strlcat(path, avd_get_str(fileset->fs_name), MAXPATHLEN);
-	pathtmp = fileset_resolvepath(file);
-	(void) fb_strlcat(path, pathtmp, MAXPATHLEN);
-	free(pathtmp);
+	if (fileset_locate(file, path, sizeof (path), &dirfd, &name)
+	    == FILEBENCH_ERROR) {
+		fileset_unbusy(file, FALSE, FALSE, 0);
+		return (FILEBENCH_ERROR);
+	}
 
 	/* delete the selected file */
 	flowop_beginop(threadflow, flowop);
-	(void) FB_UNLINK(path);
+	(void) FB_UNLINKAT(dirfd, name, 0);
 	flowop_endop(threadflow, flowop, 0);
 
 	/* indicate that it is no longer busy and no longer exists */
@@ -1875,7 +1958,6 @@ static int
 flowoplib_closefile(threadflow_t *threadflow, flowop_t *flowop)
 {
 	filesetentry_t *file;
-	fileset_t *fileset;
 	int fd;
 
 	fd = flowoplib_fdnum(threadflow, flowop);
@@ -1888,24 +1970,13 @@ flowoplib_closefile(threadflow_t *threadflow, flowop_t *flowop)
 	}
 
 	file = threadflow->tf_fse[fd];
-	fileset = file->fse_fileset;
 
-	/* Wait for it to be non-busy */
-	(void) ipc_mutex_lock(&fileset->fs_pick_lock);
-	while (file->fse_flags & FSE_BUSY) {
-		file->fse_flags |= FSE_THRD_WAITNG;
-		(void) pthread_cond_wait(&fileset->fs_thrd_wait_cv,
-		    &fileset->fs_pick_lock);
-	}
-
-	/* File now available, grab it for closing */
-	file->fse_flags |= FSE_BUSY;
+	/* Wait for it to be non-busy, then grab it for closing */
+	fileset_busy(file);
 
-	/* if last open, set declare idle */
-	if (file->fse_open_cnt == 1)
-		fileset->fs_idle_files--;
-
-	(void) ipc_mutex_unlock(&fileset->fs_pick_lock);
+#ifdef HAVE_IO_URING
+	fb_uring_closefd(threadflow, fd);
+#endif
 
 	/* Measure time to close */
 	flowop_beginop(threadflow, flowop);
@@ -1929,31 +2000,17 @@ flowoplib_closefile(threadflow_t *threadflow, flowop_t *flowop)
 static int
 flowoplib_getdirpath(filesetentry_t *dir, char *path)
 {
-	char		*fileset_path;
-	char		*fileset_name;
-	char		*part_path;
-
-	if ((fileset_path = avd_get_str(dir->fse_fileset->fs_path)) == NULL) {
+	if (avd_get_str(dir->fse_fileset->fs_path) == NULL) {
 		filebench_log(LOG_ERROR, "Fileset path not set");
 		return (FILEBENCH_ERROR);
 	}
 
-	if ((fileset_name = avd_get_str(dir->fse_fileset->fs_name)) == NULL) {
+	if (avd_get_str(dir->fse_fileset->fs_name) == NULL) {
 		filebench_log(LOG_ERROR, "Fileset name not set");
 		return (FILEBENCH_ERROR);
 	}
 
-	(void) fb_strlcpy(path, fileset_path, MAXPATHLEN);
-	(void) fb_strlcat(path, "/", MAXPATHLEN);
-	(void) fb_strlcat(path, fileset_name, MAXPATHLEN);
-
-	if ((part_path = fileset_resolvepath(dir)) == NULL)
-		return (FILEBENCH_ERROR);
-
-	(void) fb_strlcat(path, part_path, MAXPATHLEN);
-	free(part_path);
-
-	return (FILEBENCH_OK);
+	return (fileset_fullpath(dir, path, MAXPATHLEN));
 }
 
 /*
@@ -1969,17 +2026,22 @@ flowoplib_makedir(threadflow_t *threadflow, flowop_t *flowop)
 {
 	filesetentry_t	*dir;
 	int		ret;
+	int		dirfd;
+	char		*name;
 	char		full_path[MAXPATHLEN];
 
 	if ((ret = flowoplib_pickleafdir(&dir, flowop,
 	    FILESET_PICKNOEXIST)) != FILEBENCH_OK)
 		return (ret);
 
-	if ((ret = flowoplib_getdirpath(dir, full_path)) != FILEBENCH_OK)
+	if ((ret = fileset_locate(dir, full_path, sizeof (full_path),
+	    &dirfd, &name)) != FILEBENCH_OK) {
+		fileset_unbusy(dir, FALSE, FALSE, 0);
 		return (ret);
+	}
 
 	flowop_beginop(threadflow, flowop);
-	(void) FB_MKDIR(full_path, 0755);
+	(void) FB_MKDIRAT(dirfd, name, 0755);
 	flowop_endop(threadflow, flowop, 0);
 
 	/* indicate that it is no longer busy and now exists */
@@ -2001,17 +2063,22 @@ flowoplib_removedir(threadflow_t *threadflow, flowop_t *flowop)
 {
 	filesetentry_t *dir;
 	int		ret;
+	int		dirfd;
+	char		*name;
 	char		full_path[MAXPATHLEN];
 
 	if ((ret = flowoplib_pickleafdir(&dir, flowop,
 	    FILESET_PICKEXISTS)) != FILEBENCH_OK)
 		return (ret);
 
-	if ((ret = flowoplib_getdirpath(dir, full_path)) != FILEBENCH_OK)
+	if ((ret = fileset_locate(dir, full_path, sizeof (full_path),
+	    &dirfd, &name)) != FILEBENCH_OK) {
+		fileset_unbusy(dir, FALSE, FALSE, 0);
 		return (ret);
+	}
 
 	flowop_beginop(threadflow, flowop);
-	(void) FB_RMDIR(full_path);
+	(void) FB_UNLINKAT(dirfd, name, AT_REMOVEDIR);
 	flowop_endop(threadflow, flowop, 0);
 
 	/* indicate that it is no longer busy and no longer exists */
@@ -2137,7 +2204,8 @@ flowoplib_statfile(threadflow_t *threadflow, flowop_t *flowop)
 
 	if (file == NULL) {
 		char path[MAXPATHLEN];
-		char *pathtmp;
+		char *name;
+		int dirfd;
 		int err;
 
 		/* pick arbitrary, existing (allocated) file */
@@ -2150,18 +2218,15 @@ flowoplib_statfile(threadflow_t *threadflow, flowop_t *flowop)
 		}
 
 		/* resolve path and do a stat on file */
-		(void) fb_strlcpy(path, avd_get_str(fileset->fs_path),
-		    MAXPATHLEN);
-		(void) fb_strlcat(path, "/", MAXPATHLEN);
-		(void) fb_strlcat(path, avd_get_str(fileset->fs_name),
-		    MAXPATHLEN);
-		pathtmp = fileset_resolvepath(file);
-		(void) fb_strlcat(path, pathtmp, MAXPATHLEN);
-		free(pathtmp);
+		if (fileset_locate(file, path, sizeof (path), &dirfd, &name) ==
+		    FILEBENCH_ERROR) {
+			fileset_unbusy(file, FALSE, FALSE, 0);
+			return (FILEBENCH_ERROR);
+		}
 
 		/* stat the file */
 		flowop_beginop(threadflow, flowop);
-		if (FB_STAT(path, &statbuf) == -1)
+		if (FB_FSTATAT(dirfd, name, &statbuf) == -1)
 			filebench_log(LOG_ERROR,
 			    "statfile flowop %s failed", flowop->fo_name);
 		flowop_endop(threadflow, flowop, 0);
@@ -2216,7 +2281,7 @@ flowoplib_readwholefile(threadflow_t *threadflow, flowop_t *flowop)
 		return (ret);
 
 	/* an I/O size of zero means read entire working set with one I/O */
-	if ((iosize = avd_get_int(flowop->fo_iosize)) == 0)
+	if ((iosize = flowop_iosize(flowop)) == 0)
 		iosize = wss;
 
 	/*
@@ -2265,56 +2330,86 @@ flowoplib_readwholefile(threadflow_t *threadflow, flowop_t *flowop)
  * a random file offset is used for the write. Otherwise the
  * write is to the next sequential location. Returns
  * FILEBENCH_ERROR on errors, FILEBENCH_NORSC if iosetup can't
- * obtain a file, or FILEBENCH_OK on success.
+ * obtain a file, or FILEBENCH_OK on success. Like flowoplib_read(),
+ * it is replaced by one of its variants at initialization.
  */
 static int
 flowoplib_write(threadflow_t *threadflow, flowop_t *flowop)
+{
+	if (flowop->fo_attrs & FLOW_ATTR_RANDOM)
+		return (flowoplib_write_random(threadflow, flowop));
+
+	return (flowoplib_write_seq(threadflow, flowop));
+}
+
+/*
+ * Writes at a random offset within the working set.
+ */
+static int
+flowoplib_write_random(threadflow_t *threadflow, flowop_t *flowop)
 {
 	caddr_t iobuf;
 	fbint_t wss;
 	fbint_t iosize;
 	fb_fdesc_t *fdesc;
+	uint64_t fileoffset;
 	int ret;
 
-	iosize = avd_get_int(flowop->fo_iosize);
+	iosize = flowop_iosize(flowop);
 	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
 	    &fdesc, iosize)) != FILEBENCH_OK)
 		return (ret);
 
-	if (avd_get_bool(flowop->fo_random)) {
-		uint64_t fileoffset;
+	if (wss < iosize) {
+		filebench_log(LOG_ERROR,
+		    "file size smaller than IO size for thread %s",
+		    flowop->fo_name);
+		return (FILEBENCH_ERROR);
+	}
 
-		if (wss < iosize) {
-			filebench_log(LOG_ERROR,
-			    "file size smaller than IO size for thread %s",
-			    flowop->fo_name);
-			return (FILEBENCH_ERROR);
-		}
+	/* select randomly */
+	fileoffset = flowop_random_offset(flowop, wss, iosize);
 
-		/* select randomly */
-		fb_random64(&fileoffset, wss, iosize, NULL);
+	flowop_beginop(threadflow, flowop);
+	if (FB_PWRITE(fdesc, iobuf,
+	    iosize, (off64_t)fileoffset) == -1) {
+		filebench_log(LOG_ERROR, "write failed, "
+		    "offset %llu io buffer %zd: %s",
+		    (u_longlong_t)fileoffset, iobuf, strerror(errno));
+		flowop_endop(threadflow, flowop, 0);
+		return (FILEBENCH_ERROR);
+	}
+	flowop_endop(threadflow, flowop, iosize);
 
-		flowop_beginop(threadflow, flowop);
-		if (FB_PWRITE(fdesc, iobuf,
-		    iosize, (off64_t)fileoffset) == -1) {
-			filebench_log(LOG_ERROR, "write failed, "
-			    "offset %llu io buffer %zd: %s",
-			    (u_longlong_t)fileoffset, iobuf, strerror(errno));
-			flowop_endop(threadflow, flowop, 0);
-			return (FILEBENCH_ERROR);
-		}
-		flowop_endop(threadflow, flowop, iosize);
-	} else {
-		flowop_beginop(threadflow, flowop);
-		if (FB_WRITE(fdesc, iobuf, iosize) == -1) {
-			filebench_log(LOG_ERROR,
-			    "write failed, io buffer %zd: %s",
-			    iobuf, strerror(errno));
-			flowop_endop(threadflow, flowop, 0);
-			return (FILEBENCH_ERROR);
-		}
-		flowop_endop(threadflow, flowop, iosize);
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Writes at the file's current offset.
+ */
+static int
+flowoplib_write_seq(threadflow_t *threadflow, flowop_t *flowop)
+{
+	caddr_t iobuf;
+	fbint_t wss;
+	fbint_t iosize;
+	fb_fdesc_t *fdesc;
+	int ret;
+
+	iosize = flowop_iosize(flowop);
+	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
+	    &fdesc, iosize)) != FILEBENCH_OK)
+		return (ret);
+
+	flowop_beginop(threadflow, flowop);
+	if (FB_WRITE(fdesc, iobuf, iosize) == -1) {
+		filebench_log(LOG_ERROR,
+		    "write failed, io buffer %zd: %s",
+		    iobuf, strerror(errno));
+		flowop_endop(threadflow, flowop, 0);
+		return (FILEBENCH_ERROR);
 	}
+	flowop_endop(threadflow, flowop, iosize);
 
 	return (FILEBENCH_OK);
 }
@@ -2348,7 +2443,7 @@ flowoplib_writewholefile(threadflow_t *threadflow, flowop_t *flowop)
 		return (ret);
 
 	/* an I/O size of zero means write entire working set with one I/O */
-	if ((iosize = avd_get_int(flowop->fo_iosize)) == 0)
+	if ((iosize = flowop_iosize(flowop)) == 0)
 		iosize = wss;
 
 	/*
@@ -2423,7 +2518,7 @@ flowoplib_appendfile(threadflow_t *threadflow, flowop_t *flowop)
 	fbint_t iosize;
 	int ret;
 
-	iosize = avd_get_int(flowop->fo_iosize);
+	iosize = flowop_iosize(flowop);
 	if ((ret = flowoplib_iosetup(threadflow, flowop, &wss, &iobuf,
 	    &fdesc, iosize)) != FILEBENCH_OK)
 		return (ret);
@@ -2472,7 +2567,7 @@ flowoplib_appendfilerand(threadflow_t *threadflow, flowop_t *flowop)
 	fbint_t iosize;
 	int ret = 0;
 
-	if ((iosize = avd_get_int(flowop->fo_iosize)) == 0) {
+	if ((iosize = flowop_iosize(flowop)) == 0) {
 		filebench_log(LOG_ERROR, "zero iosize for flowop %s",
 		    flowop->fo_name);
 		return (FILEBENCH_ERROR);
@@ -29,6 +29,15 @@
 #define	_FB_FSPLUG_H
 
 #include "filebench.h"
+#include <fcntl.h>
+
+/* for the *at() plug-in calls on systems without openat() */
+#ifndef AT_FDCWD
+#define	AT_FDCWD	(-100)
+#endif
+#ifndef AT_REMOVEDIR
+#define	AT_REMOVEDIR	0x200
+#endif
 
 /*
  * Type of file system client plug-in desired.
@@ -37,7 +46,8 @@ typedef enum fb_plugin_type {
 	LOCAL_FS_PLUG = 0,
 	NFS3_PLUG,
 	NFS4_PLUG,
-	CIFS_PLUG
+	CIFS_PLUG,
+	IOURING_FS_PLUG
 } fb_plugin_type_t;
 
 /* universal file descriptor for both local and nfs file systems */
@@ -75,6 +85,10 @@ typedef struct fsplug_func_s {
 	int (*fsp_fstat)(fb_fdesc_t *, struct stat64 *);
 	int (*fsp_access)(const char *, int);
 	void (*fsp_recur_rm)(char *);
+	int (*fsp_openat)(fb_fdesc_t *, int, char *, int, int);
+	int (*fsp_fstatat)(int, char *, struct stat64 *);
+	int (*fsp_unlinkat)(int, char *, int);
+	int (*fsp_mkdirat)(int, char *, int);
 } fsplug_func_t;
 
 extern fsplug_func_t *fs_functions_vec;
@@ -137,6 +151,22 @@ extern fsplug_func_t *fs_functions_vec;
 #define	FB_FTRUNC(fdesc, size) \
 	(*fs_functions_vec->fsp_ftrunc)(fdesc, size)
 
+/*
+ * Variants of the above that take names relative to a directory fd, as
+ * handed out by fileset_locate(). With AT_FDCWD they take full paths.
+ */
+#define	FB_OPENAT(fd, dirfd, name, flags, perms) \
+	(*fs_functions_vec->fsp_openat)(fd, dirfd, name, flags, perms)
+
+#define	FB_FSTATAT(dirfd, name, statp) \
+	(*fs_functions_vec->fsp_fstatat)(dirfd, name, statp)
+
+#define	FB_UNLINKAT(dirfd, name, flags) \
+	(*fs_functions_vec->fsp_unlinkat)(dirfd, name, flags)
+
+#define	FB_MKDIRAT(dirfd, name, perm) \
+	(*fs_functions_vec->fsp_mkdirat)(dirfd, name, perm)
+
 #define	FB_LINK(existing, new) \
 	(*fs_functions_vec->fsp_link)(existing, new)
 
@@ -41,6 +41,7 @@
 
 filebench_shm_t *filebench_shm = NULL;
 char shmpath[128] = "/tmp/filebench-shm-XXXXXX";
+static int ipc_shmfd = -1;	/* shared memory file, for arena growth */
 
 /*
  * Interprocess Communication mechanisms. If multiple processes
@@ -263,6 +264,153 @@ ipc_seminit(void)
 	filebench_shm->shm_sys_semid = sys_semid;
 }
 
+/*
+ * Describes the preallocated pool of objects of type "obj_type" in the
+ * filebench_shm region: sets *basep to its first slot and *sizep to the
+ * size of a slot, and returns the number of slots. Returns 0 for types
+ * that are not allocated from a pool.
+ */
+static int
+ipc_pool_info(int obj_type, caddr_t *basep, size_t *sizep)
+{
+	switch (obj_type) {
+	case FILEBENCH_FILESET:
+		*basep = (caddr_t)filebench_shm->shm_fileset;
+		*sizep = sizeof (fileset_t);
+		return (FILEBENCH_NFILESETS);
+	case FILEBENCH_PROCFLOW:
+		*basep = (caddr_t)filebench_shm->shm_procflow;
+		*sizep = sizeof (procflow_t);
+		return (FILEBENCH_NPROCFLOWS);
+	case FILEBENCH_THREADFLOW:
+		*basep = (caddr_t)filebench_shm->shm_threadflow;
+		*sizep = sizeof (threadflow_t);
+		return (FILEBENCH_NTHREADFLOWS);
+	case FILEBENCH_FLOWOP:
+		*basep = (caddr_t)filebench_shm->shm_flowop;
+		*sizep = sizeof (flowop_t);
+		return (FILEBENCH_NFLOWOPS);
+	case FILEBENCH_VARIABLE:
+		*basep = (caddr_t)filebench_shm->shm_var;
+		*sizep = sizeof (var_t);
+		return (FILEBENCH_NVARIABLES);
+	case FILEBENCH_AVD:
+		*basep = (caddr_t)filebench_shm->shm_avd_ptrs;
+		*sizep = sizeof (struct avd);
+		return (FILEBENCH_NAVDS);
+	case FILEBENCH_RANDDIST:
+		*basep = (caddr_t)filebench_shm->shm_randdist;
+		*sizep = sizeof (randdist_t);
+		return (FILEBENCH_NRANDDISTS);
+	case FILEBENCH_CVAR:
+		*basep = (caddr_t)filebench_shm->shm_cvar;
+		*sizep = sizeof (cvar_t);
+		return (FILEBENCH_NCVARS);
+	case FILEBENCH_CVAR_LIB_INFO:
+		*basep = (caddr_t)filebench_shm->shm_cvar_lib_info;
+		*sizep = sizeof (cvar_library_info_t);
+		return (FILEBENCH_NCVAR_LIB_INFO);
+	default:
+		*basep = NULL;
+		*sizep = 0;
+		return (0);
+	}
+}
+
+/*
+ * Assigns each pool its range of slots in the shared free list link
+ * and allocation map arrays. Called once from ipc_init().
+ */
+static void
+ipc_pool_init(void)
+{
+	caddr_t base;
+	size_t size;
+	uint32_t first = 0;
+	int type;
+
+	for (type = 0; type < FILEBENCH_MAXTYPE; type++) {
+		filebench_shm->shm_pool[type].ip_first = first;
+		first += ipc_pool_info(type, &base, &size);
+	}
+}
+
+/*
+ * Lays out the growable arenas after filebench_shm_t in the shared memory
+ * file, filling in "arenas" if it is not NULL, and returns the size of the
+ * whole region to map. The layout only depends on compile time constants,
+ * so worker processes can compute the mapping size before attaching.
+ */
+static size_t
+ipc_arena_layout(ipc_arena_t *arenas)
+{
+	size_t sizes[IPC_NARENAS];
+	size_t offset;
+	int i;
+
+	sizes[IPC_ARENA_FILESETENTRY] =
+	    (size_t)FILEBENCH_NFILESETENTRIES * sizeof (filesetentry_t);
+	sizes[IPC_ARENA_FILESETPATH] = FILEBENCH_FILESETPATHMEMORY;
+	sizes[IPC_ARENA_RANDTABLE] = FILEBENCH_RANDTABLEMEMORY;
+	sizes[IPC_ARENA_LATHIST] = FILEBENCH_LATHISTMEMORY;
+
+	/* leave the extra megabyte that ipc_init() writes past the struct */
+	offset = roundup(sizeof (filebench_shm_t) + MB, MB);
+	for (i = 0; i < IPC_NARENAS; i++) {
+		if (arenas) {
+			arenas[i].ia_offset = offset;
+			arenas[i].ia_size = sizes[i];
+			arenas[i].ia_used = 0;
+			arenas[i].ia_backed = 0;
+		}
+		offset += roundup(sizes[i], MB);
+	}
+
+	return (offset);
+}
+
+/*
+ * Hands out "size" bytes from the supplied arena, first growing the shared
+ * memory file if the arena's backed part is too small. Called with
+ * shm_malloc_lock held. Returns NULL if the arena is exhausted or the file
+ * cannot be grown.
+ */
+static void *
+ipc_arena_alloc(int arena, size_t size)
+{
+	ipc_arena_t *ia = &filebench_shm->shm_arena[arena];
+	size_t backed;
+	off64_t end;
+	char *addr;
+
+	if (ia->ia_used + size > ia->ia_size)
+		return (NULL);
+
+	if (ia->ia_used + size > ia->ia_backed) {
+		backed = roundup(ia->ia_used + size, FILEBENCH_ARENA_CHUNK);
+		if (backed > ia->ia_size)
+			backed = ia->ia_size;
+
+		/* arenas grow independently, never shrink the file */
+		end = (off64_t)(ia->ia_offset + backed);
+		if (end > filebench_shm->shm_filesize) {
+			if (ftruncate(ipc_shmfd, end) < 0) {
+				filebench_log(LOG_ERROR, "Could not grow the "
+				    "shared memory file to %lldMB: %s",
+				    (long long)(end / MB), strerror(errno));
+				return (NULL);
+			}
+			filebench_shm->shm_filesize = end;
+		}
+		ia->ia_backed = backed;
+	}
+
+	addr = (char *)filebench_shm + ia->ia_offset + ia->ia_used;
+	ia->ia_used += size;
+
+	return (addr);
+}
+
 /*
  * Initialize the Interprocess Communication system and its associated shared
  * memory structure. It first creates a temporary file using the mkstemp()
@@ -298,9 +446,13 @@ void ipc_init(void)
 		exit(1);
 	}
 
+	/*
+	 * Map the arenas too; they are backed by the file only as they
+	 * grow, so this just reserves address space.
+	 */
 	if ((filebench_shm = (filebench_shm_t *)mmap(NULL,
-	    sizeof(filebench_shm_t), PROT_READ | PROT_WRITE,
-	    MAP_SHARED, shmfd, 0)) == MAP_FAILED) {
+	    ipc_arena_layout(NULL), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_NORESERVE, shmfd, 0)) == MAP_FAILED) {
 		filebench_log(LOG_FATAL, "Could not mmap the shared "
 		"memory file: %s", strerror(errno));
 		exit(1);
@@ -309,6 +461,11 @@ void ipc_init(void)
 	(void) memset(filebench_shm, 0,
 		 (char *)&filebench_shm->shm_marker - (char *)filebench_shm);
 
+	ipc_shmfd = shmfd;
+	filebench_shm->shm_filesize = sizeof (filebench_shm_t) + MB;
+	(void) ipc_arena_layout(filebench_shm->shm_arena);
+	ipc_pool_init();
+
 	/*
 	 * First, initialize all the structures needed for the filebench_log()
 	 * function to work correctly with the log levels other than LOG_FATAL
@@ -327,11 +484,13 @@ void ipc_init(void)
 
 	filebench_log(LOG_INFO, "Allocated %lldMB of shared memory",
 			(sizeof(filebench_shm_t) + MB) / MB);
+	filebench_log(LOG_VERBOSE, "Reserved room for %llu fileset entries, "
+	    "mapped as they are used",
+	    (u_longlong_t)FILEBENCH_NFILESETENTRIES);
 
 	filebench_shm->shm_rmode = FILEBENCH_MODE_TIMEOUT;
 	filebench_shm->shm_string_ptr = &filebench_shm->shm_strings[0];
 	filebench_shm->shm_ptr = (char *)filebench_shm->shm_addr;
-	filebench_shm->shm_path_ptr = &filebench_shm->shm_filesetpaths[0];
 
 	(void) pthread_mutex_init(&filebench_shm->shm_fileset_lock,
 	    ipc_mutexattr(IPC_MUTEX_NORMAL));
@@ -409,8 +568,8 @@ ipc_attach(void *shmaddr, char *shmpath)
 	}
 
 	if ((filebench_shm = (filebench_shm_t *)mmap(shmaddr,
-	    sizeof (filebench_shm_t), PROT_READ | PROT_WRITE,
-	    MAP_SHARED | MAP_FIXED, shmfd, 0)) == MAP_FAILED) {
+	    ipc_arena_layout(NULL), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_FIXED | MAP_NORESERVE, shmfd, 0)) == MAP_FAILED) {
 		filebench_log(LOG_FATAL, "Could not mmap the shared "
 		"memory file: %s", strerror(errno));
 		return (-1);
@@ -423,254 +582,170 @@ ipc_attach(void *shmaddr, char *shmpath)
 		return (-1);
 	}
 
+	ipc_shmfd = shmfd;
+
 	return (0);
 }
 
 /*
- * Returns the number of preallocated objects in the filebench_shm region
+ * Allocates a zeroed fileset entry, reusing a freed one if there is
+ * one, otherwise carving a new one out of the fileset entry arena.
  */
-static int
-preallocated_entries(int obj_type)
+static void *
+ipc_fse_malloc(void)
 {
-	int entries;
-	
-	switch(obj_type) {
-	case FILEBENCH_FILESET:
-		entries = sizeof(filebench_shm->shm_fileset)
-						/ sizeof(fileset_t);
-		break;
-	case FILEBENCH_FILESETENTRY:
-		entries = sizeof(filebench_shm->shm_filesetentry)
-						/ sizeof(filesetentry_t);
-		break;
-	case FILEBENCH_PROCFLOW:
-		entries = sizeof(filebench_shm->shm_procflow)
-						/ sizeof(procflow_t);
-		break;
-	case FILEBENCH_THREADFLOW:
-		entries = sizeof(filebench_shm->shm_threadflow)
-						/ sizeof(threadflow_t);
-		break;
-	case FILEBENCH_FLOWOP:
-		entries = sizeof(filebench_shm->shm_flowop)
-						/ sizeof(flowop_t);
-		break;
-	case FILEBENCH_VARIABLE:
-		entries = sizeof(filebench_shm->shm_var)
-						/ sizeof(var_t);
-		break;
-	case FILEBENCH_AVD:
-		entries = sizeof(filebench_shm->shm_avd_ptrs)
-						/ sizeof(avd_t);
-		break;
-	case FILEBENCH_RANDDIST:
-		entries = sizeof(filebench_shm->shm_randdist)
-						/ sizeof(randdist_t);
-		break;
-	case FILEBENCH_CVAR:
-		entries = sizeof(filebench_shm->shm_cvar)
-						/ sizeof(cvar_t);
-		break;
-	case FILEBENCH_CVAR_LIB_INFO:
-		entries = sizeof(filebench_shm->shm_cvar_lib_info)
-						/ sizeof(cvar_library_info_t);
-		break;
-	default:
-		entries = -1;
-		filebench_log(LOG_ERROR, "preallocated_entries: "
-						"unknown object type");
-		filebench_shutdown(1);
-		break;
+	filesetentry_t *entry;
+
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+
+	if ((entry = filebench_shm->shm_fse_freelist) != NULL) {
+		filebench_shm->shm_fse_freelist = entry->fse_nextoftype;
+	} else if ((entry = ipc_arena_alloc(IPC_ARENA_FILESETENTRY,
+	    sizeof (filesetentry_t))) == NULL) {
+		filebench_log(LOG_ERROR, "Out of shared memory for "
+		    "fileset entries (limit %llu)",
+		    (u_longlong_t)FILEBENCH_NFILESETENTRIES);
+		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+		return (NULL);
 	}
 
-	return entries;
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+
+	(void) memset(entry, 0, sizeof (filesetentry_t));
+	return (entry);
+}
+
+/*
+ * Puts a fileset entry on the free list for reuse by ipc_fse_malloc()
+ */
+static void
+ipc_fse_free(filesetentry_t *entry)
+{
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+	entry->fse_nextoftype = filebench_shm->shm_fse_freelist;
+	filebench_shm->shm_fse_freelist = entry;
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
 }
 
 /*
  * Allocates filebench objects from pre allocated region of
- * shareable memory. The memory region is partitioned into sets
- * of objects during initialization. This routine scans for
- * the first unallocated object of type "type" in the set of
- * available objects, and makes it as allocated. The routine
- * returns a pointer to the object, or NULL if all objects have
- * been allocated.
+ * shareable memory. Each pool keeps a lock free stack of freed
+ * slots, linked by slot number through shm_pool_freenext[], and
+ * a high water mark of slots ever handed out. A slot is taken
+ * from the stack if it has one, otherwise the next never used
+ * slot is handed out, so both paths are O(1) and untouched pool
+ * pages are never faulted in. The stack head carries a tag that
+ * is bumped on every update to rule out ABA races. The routine
+ * returns a pointer to the zeroed object, or NULL if all objects
+ * have been allocated.
  */
 void *
 ipc_malloc(int obj_type)
 {
-	int start_idx;
-	int max_idx;
-	int i;
-
-	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
-
-	start_idx = filebench_shm->shm_lastbitmapindex[obj_type];
-	max_idx = preallocated_entries(obj_type) - 1;
+	ipc_pool_t *pool;
+	caddr_t base;
+	size_t size;
+	uint64_t head, newhead;
+	uint32_t slot, nslots;
+	char *addr;
+
+	/* fileset entries come from their own arena */
+	if (obj_type == FILEBENCH_FILESETENTRY)
+		return (ipc_fse_malloc());
+
+	nslots = ipc_pool_info(obj_type, &base, &size);
+	if (nslots == 0) {
+		filebench_log(LOG_ERROR,
+		    "Attempt to ipc_malloc unknown object type (%d)!",
+		    obj_type);
+		return (NULL);
+	}
+	pool = &filebench_shm->shm_pool[obj_type];
 
-	i = start_idx;
+	/* pop a freed slot, if there is one */
+	head = __atomic_load_n(&pool->ip_freehead, __ATOMIC_ACQUIRE);
 	do {
-		i++;
-		if (i > max_idx)
-			i = 0;
-
-		if (filebench_shm->shm_bitmap[obj_type][i] == 0)
+		if (IPC_POOL_SLOT(head) == 0)
 			break;
-	} while (i != start_idx);
-
-	if (i == start_idx) {
-		filebench_log(LOG_ERROR, "Out of shared memory (%d)!", obj_type);
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return (NULL);
+		slot = IPC_POOL_SLOT(head) - 1;
+		newhead = IPC_POOL_HEAD(IPC_POOL_TAG(head) + 1,
+		    filebench_shm->shm_pool_freenext[pool->ip_first + slot]);
+	} while (!__atomic_compare_exchange_n(&pool->ip_freehead, &head,
+	    newhead, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	/* otherwise carve out a slot that was never used */
+	if (IPC_POOL_SLOT(head) == 0) {
+		slot = __atomic_load_n(&pool->ip_hiwater, __ATOMIC_RELAXED);
+		do {
+			if (slot >= nslots) {
+				filebench_log(LOG_ERROR,
+				    "Out of shared memory (%d)!", obj_type);
+				return (NULL);
+			}
+		} while (!__atomic_compare_exchange_n(&pool->ip_hiwater,
+		    &slot, slot + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 	}
 
-	filebench_shm->shm_bitmap[obj_type][i] = 1;
-	filebench_shm->shm_lastbitmapindex[obj_type] = i;
-
-	switch (obj_type) {
-	case FILEBENCH_FILESET:
-		(void) memset((char *)&filebench_shm->shm_fileset[i], 0,
-		    sizeof (fileset_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_fileset[i]);
-
-	case FILEBENCH_FILESETENTRY:
-		(void) memset((char *)&filebench_shm->shm_filesetentry[i], 0,
-		    sizeof (filesetentry_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_filesetentry[i]);
-
-	case FILEBENCH_PROCFLOW:
-		(void) memset((char *)&filebench_shm->shm_procflow[i], 0,
-		    sizeof (procflow_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_procflow[i]);
-
-	case FILEBENCH_THREADFLOW:
-		(void) memset((char *)&filebench_shm->shm_threadflow[i], 0,
-		    sizeof (threadflow_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_threadflow[i]);
-
-	case FILEBENCH_FLOWOP:
-		(void) memset((char *)&filebench_shm->shm_flowop[i], 0,
-		    sizeof (flowop_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_flowop[i]);
-
-	case FILEBENCH_VARIABLE:
-		(void) memset((char *)&filebench_shm->shm_var[i], 0,
-		    sizeof (var_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_var[i]);
-
-	case FILEBENCH_AVD:
-		filebench_shm->shm_avd_ptrs[i].avd_type = AVD_INVALID;
-		filebench_shm->shm_avd_ptrs[i].avd_val.varptr = NULL;
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_avd_ptrs[i]);
-
-	case FILEBENCH_RANDDIST:
-		(void) memset((char *)&filebench_shm->shm_randdist[i], 0,
-		    sizeof (randdist_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_randdist[i]);
+	IPC_POOL_SETALLOC(pool->ip_first + slot);
+	addr = base + (size_t)slot * size;
 
-	case FILEBENCH_CVAR:
-		(void) memset((char *)&filebench_shm->shm_cvar[i], 0, sizeof(cvar_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_cvar[i]);
-
-	case FILEBENCH_CVAR_LIB_INFO:
-		(void) memset((char *)&filebench_shm->shm_cvar_lib_info[i], 0,
-			sizeof(cvar_library_info_t));
-		(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-		return ((char *)&filebench_shm->shm_cvar_lib_info[i]);
+	if (obj_type == FILEBENCH_AVD) {
+		((avd_t)addr)->avd_type = AVD_INVALID;
+		((avd_t)addr)->avd_val.varptr = NULL;
+	} else {
+		(void) memset(addr, 0, size);
 	}
 
-	filebench_log(LOG_ERROR, "Attempt to ipc_malloc unknown object type (%d)!",
-	    obj_type);
-	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
-	return (NULL);
+	return (addr);
 }
 
 /*
  * Frees a filebench object of type "type" at the location
  * pointed to by "addr". It uses the type and address to
- * calculate which object is being freed, and clears its
- * allocation map entry.
+ * calculate which object is being freed, clears its
+ * allocation map bit and pushes it onto the pool's free stack.
  */
 void
 ipc_free(int type, char *addr)
 {
-	int item;
-	caddr_t base = 0;
-	size_t offset;
-	size_t size = 0;
+	ipc_pool_t *pool;
+	caddr_t base;
+	size_t size;
+	uint64_t head, newhead;
+	uint32_t slot, nslots;
 
 	if (addr == NULL) {
 		filebench_log(LOG_ERROR, "Freeing type %d %zx", type, addr);
 		return;
 	}
 
-	switch (type) {
-
-	case FILEBENCH_FILESET:
-		base = (caddr_t)&filebench_shm->shm_fileset[0];
-		size = sizeof (fileset_t);
-		break;
-
-	case FILEBENCH_FILESETENTRY:
-		base = (caddr_t)&filebench_shm->shm_filesetentry[0];
-		size = sizeof (filesetentry_t);
-		break;
-
-	case FILEBENCH_PROCFLOW:
-		base = (caddr_t)&filebench_shm->shm_procflow[0];
-		size = sizeof (procflow_t);
-		break;
-
-	case FILEBENCH_THREADFLOW:
-		base = (caddr_t)&filebench_shm->shm_threadflow[0];
-		size = sizeof (threadflow_t);
-		break;
-
-	case FILEBENCH_FLOWOP:
-		base = (caddr_t)&filebench_shm->shm_flowop[0];
-		size = sizeof (flowop_t);
-		break;
-
-	case FILEBENCH_VARIABLE:
-		base = (caddr_t)&filebench_shm->shm_var[0];
-		size = sizeof (var_t);
-		break;
-
-	case FILEBENCH_AVD:
-		base = (caddr_t)&filebench_shm->shm_avd_ptrs[0];
-		size = sizeof (avd_t);
-		break;
-
-	case FILEBENCH_RANDDIST:
-		base = (caddr_t)&filebench_shm->shm_randdist[0];
-		size = sizeof (randdist_t);
-		break;
-
-	case FILEBENCH_CVAR:
-		base = (caddr_t)&filebench_shm->shm_cvar[0];
-		size = sizeof (cvar_t);
-		break;
+	if (type == FILEBENCH_FILESETENTRY) {
+		ipc_fse_free((filesetentry_t *)addr);
+		return;
+	}
 
-	case FILEBENCH_CVAR_LIB_INFO:
-		base = (caddr_t)&filebench_shm->shm_cvar_lib_info[0];
-		size = sizeof(cvar_library_info_t);
-		break;
+	nslots = ipc_pool_info(type, &base, &size);
+	slot = ((size_t)addr - (size_t)base) / size;
+	if (nslots == 0 || addr < base || slot >= nslots) {
+		filebench_log(LOG_ERROR, "Freeing type %d %zx: not in pool",
+		    type, addr);
+		return;
 	}
+	pool = &filebench_shm->shm_pool[type];
 
-	offset = ((size_t)addr - (size_t)base);
-	item = offset / size;
+	if (!IPC_POOL_CLRALLOC(pool->ip_first + slot)) {
+		filebench_log(LOG_ERROR, "Freeing type %d %zx twice",
+		    type, addr);
+		return;
+	}
 
-	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
-	filebench_shm->shm_bitmap[type][item] = 0;
-	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+	head = __atomic_load_n(&pool->ip_freehead, __ATOMIC_RELAXED);
+	do {
+		filebench_shm->shm_pool_freenext[pool->ip_first + slot] =
+		    IPC_POOL_SLOT(head);
+		newhead = IPC_POOL_HEAD(IPC_POOL_TAG(head) + 1, slot + 1);
+	} while (!__atomic_compare_exchange_n(&pool->ip_freehead, &head,
+	    newhead, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
 /*
@@ -710,18 +785,19 @@ ipc_stralloc(const char *string)
 char *
 ipc_pathalloc(char *path)
 {
-	char *allocpath = filebench_shm->shm_path_ptr;
+	char *allocpath;
+	size_t len = strlen(path) + 1;
 
-	filebench_shm->shm_path_ptr += strlen(path) + 1;
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+	allocpath = ipc_arena_alloc(IPC_ARENA_FILESETPATH, len);
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
 
-	if ((filebench_shm->shm_path_ptr -
-	    &filebench_shm->shm_filesetpaths[0]) >
-	    FILEBENCH_FILESETPATHMEMORY) {
+	if (allocpath == NULL) {
 		filebench_log(LOG_ERROR, "Out of fileset path memory");
 		return (NULL);
 	}
 
-	(void) strncpy(allocpath, path, strlen(path));
+	(void) memcpy(allocpath, path, len);
 
 	return (allocpath);
 }
@@ -729,12 +805,65 @@ ipc_pathalloc(char *path)
 /*
  * This is a limited functionality deallocator for path
  * strings - it can only free all path strings at once,
- * in order to avoid fragmentation.
+ * in order to avoid fragmentation. The arena keeps its
+ * backing so a following fileset can reuse it.
  */
 void
 ipc_freepaths(void)
 {
-	filebench_shm->shm_path_ptr = &filebench_shm->shm_filesetpaths[0];
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+	filebench_shm->shm_arena[IPC_ARENA_FILESETPATH].ia_used = 0;
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+}
+
+/*
+ * Allocates "size" bytes for the lookup table of a tabular random
+ * variable. Tables live as long as the run, so they are never freed.
+ * Returns NULL if the table arena is exhausted.
+ */
+void *
+ipc_randtablealloc(size_t size)
+{
+	void *table;
+
+	/* keep the tables of doubles aligned */
+	size = roundup(size, sizeof (double));
+
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+	table = ipc_arena_alloc(IPC_ARENA_RANDTABLE, size);
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+
+	if (table == NULL)
+		filebench_log(LOG_ERROR, "Out of random table memory");
+
+	return (table);
+}
+
+/*
+ * Returns the latency histogram of the flowop in pool slot "slot". The
+ * histogram arena has a fixed place for every slot, so a histogram is
+ * reused along with its flowop slot instead of being freed, and the arena
+ * is only backed up to the highest slot that asked for one. The caller
+ * clears the histogram. Returns NULL if the arena cannot be grown.
+ */
+uint64_t *
+ipc_lathistalloc(int slot)
+{
+	ipc_arena_t *ia = &filebench_shm->shm_arena[IPC_ARENA_LATHIST];
+	size_t end = (size_t)(slot + 1) * LATHIST_SIZE;
+	uint64_t *lathist = NULL;
+
+	(void) ipc_mutex_lock(&filebench_shm->shm_malloc_lock);
+	if (end <= ia->ia_used ||
+	    ipc_arena_alloc(IPC_ARENA_LATHIST, end - ia->ia_used) != NULL)
+		lathist = (uint64_t *)((char *)filebench_shm + ia->ia_offset +
+		    end - LATHIST_SIZE);
+	(void) ipc_mutex_unlock(&filebench_shm->shm_malloc_lock);
+
+	if (lathist == NULL)
+		filebench_log(LOG_ERROR, "Out of latency histogram memory");
+
+	return (lathist);
 }
 
 /*
@@ -74,11 +74,12 @@
  * has to increase these values
  */
 #define	FILEBENCH_NFILESETS		(16)
-#define	FILEBENCH_NFILESETENTRIES	(1024 * 1024)
 #define	FILEBENCH_NPROCFLOWS		(1024)
 #define	FILEBENCH_NTHREADFLOWS 		(1024)
 /* 16 flowops per threadflow seems reasonable */
 #define	FILEBENCH_NFLOWOPS 		(16 * 1024)
+/* buckets of the flowop name hash, a power of two */
+#define	FILEBENCH_FLOWOPHASHSIZE	(1024)
 /* variables are not the only one that are specified
    explicitly in the .f file. Some special 
    variables are used within FB itself. So, let's
@@ -88,10 +89,69 @@
 #define	FILEBENCH_NRANDDISTS		(16)
 #define FILEBENCH_NCVARS		(16)
 #define FILEBENCH_NCVAR_LIB_INFO	(32)
-#define	FILEBENCH_MAXBITMAP		FILEBENCH_NFILESETENTRIES
+/* total number of slots in the pools above */
+#define	FILEBENCH_NPOOLSLOTS	(FILEBENCH_NFILESETS + FILEBENCH_NPROCFLOWS + \
+	FILEBENCH_NTHREADFLOWS + FILEBENCH_NFLOWOPS + FILEBENCH_NVARIABLES + \
+	FILEBENCH_NAVDS + FILEBENCH_NRANDDISTS + FILEBENCH_NCVARS + \
+	FILEBENCH_NCVAR_LIB_INFO)
+
+/*
+ * Allocation state of one pool, see ipc_malloc(). The free stack head
+ * packs an update tag in its upper 32 bits and the top slot number plus
+ * one (0 for an empty stack) in the lower 32 bits.
+ */
+typedef struct ipc_pool {
+	uint64_t	ip_freehead;	/* free stack head, tag and slot */
+	uint32_t	ip_hiwater;	/* number of slots ever handed out */
+	uint32_t	ip_first;	/* first slot in the shared arrays */
+} ipc_pool_t;
+
+#define	IPC_POOL_HEAD(tag, slot)	(((uint64_t)(tag) << 32) | (slot))
+#define	IPC_POOL_TAG(head)		((uint32_t)((head) >> 32))
+#define	IPC_POOL_SLOT(head)		((uint32_t)(head))
+
+/* one allocation bit per pool slot, used to catch double frees */
+#define	IPC_POOL_SETALLOC(i)						\
+	(void) __atomic_fetch_or(&filebench_shm->shm_pool_allocmap[(i) >> 6], \
+	    1ULL << ((i) & 63), __ATOMIC_RELAXED)
+#define	IPC_POOL_CLRALLOC(i)						\
+	(__atomic_fetch_and(&filebench_shm->shm_pool_allocmap[(i) >> 6],  \
+	    ~(1ULL << ((i) & 63)), __ATOMIC_RELAXED) & (1ULL << ((i) & 63)))
+
+/*
+ * Fileset entries, their path strings, the lookup tables of tabular
+ * random variables and the flowop latency histograms are not kept in fixed pools inside filebench_shm_t,
+ * but in growable arenas that follow it in the shared memory file. The
+ * whole reservation is mapped up front by every process, but the file,
+ * and so the memory actually used, only grows in FILEBENCH_ARENA_CHUNK
+ * steps as the arenas fill up.
+ */
+#if defined(_LP64) || (__WORDSIZE == 64)
+#define	FILEBENCH_NFILESETENTRIES	(256 * 1024 * 1024)
+#else
+#define	FILEBENCH_NFILESETENTRIES	(1024 * 1024)
+#endif
+#define	FILEBENCH_FILESETPATHMEMORY	\
+	((size_t)FILEBENCH_NFILESETENTRIES * FSE_MAXPATHLEN)
+#define	FILEBENCH_RANDTABLEMEMORY	(256 * 1024 * 1024)
+#define	FILEBENCH_LATHISTMEMORY		\
+	((size_t)FILEBENCH_NFLOWOPS * LATHIST_SIZE)
+#define	FILEBENCH_ARENA_CHUNK		(64 * 1024 * 1024)
+
+#define	IPC_ARENA_FILESETENTRY		0
+#define	IPC_ARENA_FILESETPATH		1
+#define	IPC_ARENA_RANDTABLE		2
+#define	IPC_ARENA_LATHIST		3
+#define	IPC_NARENAS			4
+
+typedef struct ipc_arena {
+	size_t		ia_offset;	/* start of arena in the shm file */
+	size_t		ia_size;	/* bytes reserved for the arena */
+	size_t		ia_used;	/* bytes handed out so far */
+	size_t		ia_backed;	/* bytes backed by the shm file */
+} ipc_arena_t;
 
 /* these below are not regular pools and are allocated separately from ipc_malloc() */
-#define	FILEBENCH_FILESETPATHMEMORY	(FILEBENCH_NFILESETENTRIES * FSE_MAXPATHLEN)
 #define	FILEBENCH_STRINGMEMORY		(FILEBENCH_NVARIABLES * 128)
 #define FILEBENCH_CVAR_HEAPSIZE		(FILEBENCH_NCVARS * 4096)
 
@@ -112,16 +172,9 @@ typedef struct filebench_shm {
 	/* threadflow_t	*shm_threadflowlist; (this one is per procflow) */ 
 	pthread_mutex_t shm_threadflow_lock;
 	flowop_t	*shm_flowoplist;
+	flowop_t	*shm_flowophash[FILEBENCH_FLOWOPHASHSIZE]; /* by fo_name */
 	pthread_mutex_t shm_flowop_lock;
 
-	/*
-	 * parallel file allocation  control. Restricts number of spawned
-	 * allocation threads and allows waiting for allocation to finish.
-	 */
-	pthread_cond_t	shm_fsparalloc_cv;    /* cv to wait for alloc threads */
-	int		shm_fsparalloc_count; /* active alloc thread count */
-	pthread_mutex_t	shm_fsparalloc_lock;  /* lock to protect count */
-
 	/*
 	 * Procflow and process state
 	 */
@@ -154,7 +207,7 @@ typedef struct filebench_shm {
 	 * log and statistics dumping controls and state
 	 */
 	int		shm_debug_level;
-	int		shm_bequiet;	/* pause run while collecting stats */
+	int		shm_stats_gen;	/* bumped by every stats_clear() */
 	int		shm_dump_fd;	/* dump file descriptor */
 	char		shm_dump_filename[MAXPATHLEN];
 
@@ -185,11 +238,12 @@ typedef struct filebench_shm {
 	pthread_mutex_t shm_msg_lock;
 	pthread_mutexattr_t shm_mutexattr[IPC_NUM_MUTEX_ATTRS];
 	char		*shm_string_ptr;
-	char		*shm_path_ptr;
 	hrtime_t	shm_epoch;
 	hrtime_t	shm_starttime;
 	int		shm_utid;
+	uint64_t	shm_seed;	/* Seeds the generators of threads */
 	int		lathist_enabled;
+	char		shm_lathist_filename[MAXPATHLEN]; /* histogram export */
 	int		shm_cvar_heapsize;
 
 	/*
@@ -209,14 +263,24 @@ typedef struct filebench_shm {
 
 	/*
 	 * IPC shared memory pools allocation/deallocation control:
-	 *	- bitmap (if fact, bit is an integer here)
-	 * 	- last allocated index
-	 *	- lock for the operations on the pool
+	 *	- per pool free stack and high water mark
+	 *	- free stack links, by slot number
+	 *	- allocation map, one bit per slot
+	 *	- lock for the arenas and the fileset entry free list
 	 */
-	int		shm_bitmap[FILEBENCH_MAXTYPE][FILEBENCH_MAXBITMAP];
-	int		shm_lastbitmapindex[FILEBENCH_MAXTYPE];
+	ipc_pool_t	shm_pool[FILEBENCH_MAXTYPE];
+	uint32_t	shm_pool_freenext[FILEBENCH_NPOOLSLOTS];
+	uint64_t	shm_pool_allocmap[(FILEBENCH_NPOOLSLOTS + 63) / 64];
 	pthread_mutex_t shm_malloc_lock;
 
+	/*
+	 * Growable arenas, protected by shm_malloc_lock, and the list
+	 * of freed fileset entries (linked through fse_nextoftype).
+	 */
+	ipc_arena_t	shm_arena[IPC_NARENAS];
+	off64_t		shm_filesize;	/* current size of the shm file */
+	filesetentry_t	*shm_fse_freelist;
+
 	/*
 	 * end of pre-zeroed data. We do not bzero pools, because
 	 * otherwise we will touch every page in the pools and
@@ -231,7 +295,6 @@ typedef struct filebench_shm {
 	 * ipc_malloc() will bzero each allocated slot.
 	 */
 	fileset_t	shm_fileset[FILEBENCH_NFILESETS];
-	filesetentry_t	shm_filesetentry[FILEBENCH_NFILESETENTRIES];
 	procflow_t	shm_procflow[FILEBENCH_NPROCFLOWS];
 	threadflow_t	shm_threadflow[FILEBENCH_NTHREADFLOWS];
 	flowop_t	shm_flowop[FILEBENCH_NFLOWOPS];
@@ -243,7 +306,6 @@ typedef struct filebench_shm {
 
 	/* these below are not regular pools and are allocated separately from ipc_malloc() */
 	char		shm_strings[FILEBENCH_STRINGMEMORY];
-	char		shm_filesetpaths[FILEBENCH_FILESETPATHMEMORY];
 	char		shm_cvar_heap[FILEBENCH_CVAR_HEAPSIZE];
 
 } filebench_shm_t;
@@ -262,6 +324,9 @@ int ipc_semidalloc(void);
 void ipc_semidfree(int semid);
 char *ipc_stralloc(const char *string);
 char *ipc_pathalloc(char *string);
+void ipc_freepaths(void);
+void *ipc_randtablealloc(size_t size);
+uint64_t *ipc_lathistalloc(int slot);
 void *ipc_cvar_heapalloc(size_t size);
 void ipc_cvar_heapfree(void *ptr);
 int ipc_mutex_lock(pthread_mutex_t *mutex);
@@ -108,6 +108,7 @@ static void parser_sleep(cmd_t *cmd);
 static void parser_sleep_variable(cmd_t *cmd);
 static void parser_version(cmd_t *cmd);
 static void parser_enable_lathist(cmd_t *cmd);
+static void parser_enable_timeseries(cmd_t *cmd);
 
 %}
 
@@ -147,7 +148,12 @@ static void parser_enable_lathist(cmd_t *cmd);
 %token FSA_RANDSEED FSA_RANDGAMMA FSA_RANDMEAN FSA_MIN FSA_MAX FSA_MASTER
 %token FSA_CLIENT FSS_TYPE FSS_SEED FSS_GAMMA FSS_MEAN FSS_MIN FSS_SRC FSS_ROUND
 %token FSA_LVAR_ASSIGN FSA_ALLDONE FSA_FIRSTDONE FSA_TIMEOUT FSA_LATHIST
+%token FSA_TIMESERIES FSA_INTERVAL
 %token FSA_NOREADAHEAD FSA_IOPRIO FSA_WRITEONLY FSA_PARAMETERS FSA_NOUSESTATS
+%token FSA_IODEPTH FSA_IOURING FSA_DIRFDS FSA_ALLOCMODE FSA_MANIFEST
+%token FSA_POPULARITY FSA_THETA FSA_HOTSET FSA_HOTACCESS FSA_LOCALITY
+%token FSA_OFFSETDIST FSA_OFFSETTHETA FSA_HOTSPOT FSA_HOTSPOTACCESS
+%token FSA_OFFSETSTDDEV FSA_RUNLENGTH FSA_HISTOGRAM
 
 %type <ival> FSV_VAL_POSINT FSV_VAL_NEGINT
 %type <bval> FSV_VAL_BOOLEAN
@@ -174,7 +180,9 @@ static void parser_enable_lathist(cmd_t *cmd);
 %type <attr> randvar_attr_op randvar_attr_ops randvar_attr_typop
 %type <attr> randvar_attr_srcop attr_value
 %type <attr> comp_lvar_def comp_attr_op comp_attr_ops
-%type <attr> enable_multi_ops enable_multi_op multisync_op
+%type <attr> enable_multi_ops enable_multi_op multisync_op lathist_op
+%type <attr> timeseries_ops timeseries_op
+%type <ival> ts_attr_name
 %type <attr> cvar_attr_ops cvar_attr_op
 %type <list> whitevar_string whitevar_string_list
 %type <ival> attrs_define_thread attrs_flowop
@@ -271,6 +279,22 @@ enable_command: FSC_ENABLE FSE_MULTI enable_multi_ops
 		YYERROR;
 
 	$$->cmd = parser_enable_lathist;
+}
+| FSC_ENABLE FSA_LATHIST lathist_op
+{
+	if (($$ = alloc_cmd()) == NULL)
+		YYERROR;
+
+	$$->cmd = parser_enable_lathist;
+	$$->cmd_attr_list = $3;
+}
+| FSC_ENABLE FSA_TIMESERIES timeseries_ops
+{
+	if (($$ = alloc_cmd()) == NULL)
+		YYERROR;
+
+	$$->cmd = parser_enable_timeseries;
+	$$->cmd_attr_list = $3;
 };
 
 multisync_command: FSC_DOMULTISYNC multisync_op
@@ -510,6 +534,42 @@ set_mode: FSC_SET FSE_MODE FSC_QUIT FSA_TIMEOUT
 	filebench_log(LOG_INFO, "Disabling CPU usage statistics");
 	filebench_shm->shm_mmode |= FILEBENCH_MODE_NOUSAGE;
 
+	$$->cmd = NULL;
+}
+| FSC_SET FSE_MODE FSA_IOURING
+{
+	$$ = alloc_cmd();
+	if (!$$)
+		YYERROR;
+
+#ifdef HAVE_IO_URING
+	/*
+	 * Local file system flowops were added by flowop_init() already,
+	 * so only the io_uring ones need to be added here.
+	 */
+	if (filebench_shm->shm_filesys_type != IOURING_FS_PLUG) {
+		filebench_log(LOG_INFO, "Using io_uring file system plug-in");
+		filebench_shm->shm_filesys_type = IOURING_FS_PLUG;
+		fb_uring_newflowops();
+		fb_uring_funcvecinit();
+	}
+#else
+	filebench_log(LOG_ERROR, "io_uring is not supported on this system");
+	YYERROR;
+#endif
+
+	$$->cmd = NULL;
+}
+| FSC_SET FSE_MODE FSA_RANDSEED FSK_ASSIGN FSV_VAL_POSINT
+{
+	$$ = alloc_cmd();
+	if (!$$)
+		YYERROR;
+
+	filebench_log(LOG_INFO, "Seeding the random numbers of threads "
+	    "with %llu", (u_longlong_t)$5);
+	filebench_shm->shm_seed = $5;
+
 	$$->cmd = NULL;
 };
 
@@ -1027,6 +1087,41 @@ multisync_op: FSA_VALUE FSK_ASSIGN attr_value
 	$$->attr_name = FSA_VALUE;
 };
 
+lathist_op: FSA_FILENAME FSK_ASSIGN attr_value
+{
+	$$ = $3;
+	$$->attr_name = FSA_FILENAME;
+};
+
+timeseries_ops: timeseries_op
+{
+	$$ = $1;
+}
+| timeseries_ops FSK_SEPLST timeseries_op
+{
+	attr_t *attr = NULL;
+	attr_t *list_end = NULL;
+
+	for (attr = $1; attr != NULL;
+	    attr = attr->attr_next)
+		list_end = attr; /* Find end of list */
+
+	list_end->attr_next = $3;
+
+	$$ = $1;
+};
+
+timeseries_op: ts_attr_name FSK_ASSIGN attr_value
+{
+	$$ = $3;
+	$$->attr_name = $1;
+};
+
+ts_attr_name:
+  FSA_FILENAME { $$ = FSA_FILENAME;}
+| FSA_INTERVAL { $$ = FSA_INTERVAL;}
+| FSA_TYPE { $$ = FSA_TYPE;};
+
 /*
  * Attribute names
  */
@@ -1041,6 +1136,7 @@ attrs_define_file:
 | FSA_SIZE { $$ = FSA_SIZE;}
 | FSA_PREALLOC { $$ = FSA_PREALLOC;}
 | FSA_PARALLOC { $$ = FSA_PARALLOC;}
+| FSA_ALLOCMODE { $$ = FSA_ALLOCMODE;}
 | FSA_REUSE { $$ = FSA_REUSE;}
 | FSA_TRUSTTREE { $$ = FSA_TRUSTTREE;}
 | FSA_READONLY { $$ = FSA_READONLY;}
@@ -1053,6 +1149,7 @@ attrs_define_fileset:
 | FSA_SIZE { $$ = FSA_SIZE;}
 | FSA_PREALLOC { $$ = FSA_PREALLOC;}
 | FSA_PARALLOC { $$ = FSA_PARALLOC;}
+| FSA_ALLOCMODE { $$ = FSA_ALLOCMODE;}
 | FSA_REUSE { $$ = FSA_REUSE;}
 | FSA_TRUSTTREE { $$ = FSA_TRUSTTREE;}
 | FSA_READONLY { $$ = FSA_READONLY;}
@@ -1060,6 +1157,13 @@ attrs_define_fileset:
 | FSA_DIRWIDTH { $$ = FSA_DIRWIDTH;}
 | FSA_DIRDEPTHRV { $$ = FSA_DIRDEPTHRV;}
 | FSA_DIRGAMMA { $$ = FSA_DIRGAMMA;}
+| FSA_DIRFDS { $$ = FSA_DIRFDS;}
+| FSA_MANIFEST { $$ = FSA_MANIFEST;}
+| FSA_POPULARITY { $$ = FSA_POPULARITY;}
+| FSA_THETA { $$ = FSA_THETA;}
+| FSA_HOTSET { $$ = FSA_HOTSET;}
+| FSA_HOTACCESS { $$ = FSA_HOTACCESS;}
+| FSA_LOCALITY { $$ = FSA_LOCALITY;}
 | FSA_LEAFDIRS { $$ = FSA_LEAFDIRS;};
 
 randvar_attr_name:
@@ -1068,7 +1172,8 @@ randvar_attr_name:
 | FSA_RANDGAMMA { $$ = FSA_RANDGAMMA;}
 | FSA_RANDMEAN { $$ = FSA_RANDMEAN;}
 | FSA_MIN { $$ = FSA_MIN;}
-| FSA_ROUND { $$ = FSA_ROUND;};
+| FSA_ROUND { $$ = FSA_ROUND;}
+| FSA_HISTOGRAM { $$ = FSA_HISTOGRAM;};
 
 randvar_attr_typop: randtype_name
 {
@@ -1105,6 +1210,7 @@ attrs_define_thread:
 | FSA_MEMSIZE { $$ = FSA_MEMSIZE;}
 | FSA_USEISM { $$ = FSA_USEISM;}
 | FSA_INSTANCES { $$ = FSA_INSTANCES;}
+| FSA_IODEPTH { $$ = FSA_IODEPTH;}
 | FSA_IOPRIO { $$ = FSA_IOPRIO;};
 
 attrs_flowop:
@@ -1124,6 +1230,18 @@ attrs_flowop:
 | FSA_BLOCKING { $$ = FSA_BLOCKING;}
 | FSA_HIGHWATER { $$ = FSA_HIGHWATER;}
 | FSA_IOSIZE { $$ = FSA_IOSIZE;}
+| FSA_IODEPTH { $$ = FSA_IODEPTH;}
+| FSA_POPULARITY { $$ = FSA_POPULARITY;}
+| FSA_THETA { $$ = FSA_THETA;}
+| FSA_HOTSET { $$ = FSA_HOTSET;}
+| FSA_HOTACCESS { $$ = FSA_HOTACCESS;}
+| FSA_LOCALITY { $$ = FSA_LOCALITY;}
+| FSA_OFFSETDIST { $$ = FSA_OFFSETDIST;}
+| FSA_OFFSETTHETA { $$ = FSA_OFFSETTHETA;}
+| FSA_HOTSPOT { $$ = FSA_HOTSPOT;}
+| FSA_HOTSPOTACCESS { $$ = FSA_HOTSPOTACCESS;}
+| FSA_OFFSETSTDDEV { $$ = FSA_OFFSETSTDDEV;}
+| FSA_RUNLENGTH { $$ = FSA_RUNLENGTH;}
 | FSA_NOREADAHEAD { $$ = FSA_NOREADAHEAD;};
 
 attrs_eventgen:
@@ -1292,7 +1410,7 @@ var_int_val: FSV_VAL_POSINT
 
 #define	USAGE \
 "Usage: " \
-"filebench {-f <wmlscript> | -h | -c [cvartype]}\n\n" \
+"filebench {-f <wmlscript> | -h | -c [cvartype] | -b}\n\n" \
 "  Filebench version " FILEBENCH_VERSION "\n\n" \
 "  Filebench is a file system and storage benchmark that interprets a script\n" \
 "  written in its Workload Model Language (WML), and procees to generate the\n" \
@@ -1302,7 +1420,8 @@ var_int_val: FSV_VAL_POSINT
 "   -f <wmlscript> generate workload from the specified file\n" \
 "   -h             display this help message\n" \
 "   -c             display supported cvar types\n" \
-"   -c [cvartype]  display options of the specific cvar type\n\n"
+"   -c [cvartype]  display options of the specific cvar type\n" \
+"   -b             measure how fast random I/O offsets are generated\n\n"
 
 static void
 usage_exit(int ret, const char *msg)
@@ -1337,11 +1456,12 @@ init_fbparams(struct fbparams *fbparams)
 #define FB_MODE_MASTER		2
 #define FB_MODE_WORKER		3
 #define FB_MODE_CVARS		4
+#define FB_MODE_BENCH		5
 
 static int
 parse_options(int argc, char *argv[], struct fbparams *fbparams)
 {
-	const char cmd_options[] = "m:s:a:i:hf:c:";
+	const char cmd_options[] = "m:s:a:i:hf:c:b";
 	int mode = FB_MODE_NONE;
 	int opt;
 
@@ -1361,6 +1481,7 @@ parse_options(int argc, char *argv[], struct fbparams *fbparams)
 		(-f <wmlscript>) or
 		(-a and -s and -m and -i) or
 		(-c [cvartype]) or
+		(-b) or
 		(-h)
 	   must be specified */
 	while ((opt = getopt(argc, argv, cmd_options)) > 0) {
@@ -1383,6 +1504,11 @@ parse_options(int argc, char *argv[], struct fbparams *fbparams)
 			mode = FB_MODE_MASTER;
 			fbparams->fscriptname = optarg;
 			break;
+		case 'b':
+			if (mode != FB_MODE_NONE)
+				usage_exit(1, "Too many options specified");
+			mode = FB_MODE_BENCH;
+			break;
 		/* private parameters: when filebench calls itself */
 		case 'a':
 			if (mode != FB_MODE_NONE &&
@@ -1588,6 +1714,7 @@ master_mode(struct fbparams *fbparams) {
 	(void)strcpy(filebench_shm->shm_fscriptname,
 				fbparams->fscriptname);
 
+	fbtime_init();
 	flowop_init(1);
 	eventgen_init();
 
@@ -1649,6 +1776,11 @@ main(int argc, char *argv[])
 	if (mode == FB_MODE_CVARS)
 		cvars_mode(&fbparams);
 
+	if (mode == FB_MODE_BENCH) {
+		fb_random_bench();
+		exit(0);
+	}
+
 	init_common();
 
 	if (mode == FB_MODE_MASTER)
@@ -1938,6 +2070,11 @@ parser_thread_define(cmd_t *cmd, procflow_t *procflow)
 	else /* XXX: really, ioprio is 8 by default?.. */
 		template.tf_ioprio = avd_int_alloc(8);
 
+	/* without iodepth, asynchronous I/Os in flight are not limited */
+	attr = get_attr(cmd, FSA_IODEPTH);
+	if (attr)
+		template.tf_iodepth = attr->attr_avd;
+
 
 	threadflow = threadflow_define(procflow, name, &template, instances);
 	if (!threadflow) {
@@ -1991,8 +2128,11 @@ parser_flowop_get_attrs(cmd_t *cmd, flowop_t *flowop)
 		flowop->fo_wss = avd_int_alloc(0);
 
 	/* Random I/O? */
+	/* an offset distribution implies random I/O */
 	if ((attr = get_attr(cmd, FSA_RANDOM)))
 		flowop->fo_random = attr->attr_avd;
+	else if (get_attr(cmd, FSA_OFFSETDIST))
+		flowop->fo_random = avd_bool_alloc(TRUE);
 	else
 		flowop->fo_random = avd_bool_alloc(FALSE);
 
@@ -2056,12 +2196,80 @@ parser_flowop_get_attrs(cmd_t *cmd, flowop_t *flowop)
 		flowop->fo_highwater = avd_int_alloc(1);
 	}
 
+	/* Asynchronous I/Os in flight, zero means the thread's limit */
+	if ((attr = get_attr(cmd, FSA_IODEPTH)))
+		flowop->fo_iodepth = attr->attr_avd;
+	else
+		flowop->fo_iodepth = avd_int_alloc(0);
+
 	/* find file or leaf directory by index number */
 	if ((attr = get_attr(cmd, FSA_INDEXED)))
 		flowop->fo_fileindex = attr->attr_avd;
 	else
 		flowop->fo_fileindex = NULL;
 
+	/* file popularity, defaults to that of the fileset */
+	if ((attr = get_attr(cmd, FSA_POPULARITY)))
+		flowop->fo_popularity = attr->attr_avd;
+	else
+		flowop->fo_popularity = NULL;
+
+	if ((attr = get_attr(cmd, FSA_THETA)))
+		flowop->fo_theta = attr->attr_avd;
+	else
+		flowop->fo_theta = NULL;
+
+	if ((attr = get_attr(cmd, FSA_HOTSET)))
+		flowop->fo_hotset = attr->attr_avd;
+	else
+		flowop->fo_hotset = NULL;
+
+	if ((attr = get_attr(cmd, FSA_HOTACCESS)))
+		flowop->fo_hotaccess = attr->attr_avd;
+	else
+		flowop->fo_hotaccess = NULL;
+
+	if ((attr = get_attr(cmd, FSA_LOCALITY)))
+		flowop->fo_locality = attr->attr_avd;
+	else
+		flowop->fo_locality = NULL;
+
+	/* uniform, zipf, hotspot, normal or runs random offsets */
+	if ((attr = get_attr(cmd, FSA_OFFSETDIST)))
+		flowop->fo_offsetdist = attr->attr_avd;
+	else
+		flowop->fo_offsetdist = avd_str_alloc("uniform");
+
+	/* Zipf exponent, * 1000 */
+	if ((attr = get_attr(cmd, FSA_OFFSETTHETA)))
+		flowop->fo_offsettheta = attr->attr_avd;
+	else
+		flowop->fo_offsettheta = avd_int_alloc(990);
+
+	/* % of the working set that is hot */
+	if ((attr = get_attr(cmd, FSA_HOTSPOT)))
+		flowop->fo_hotspot = attr->attr_avd;
+	else
+		flowop->fo_hotspot = avd_int_alloc(10);
+
+	/* % of I/Os that go to the hot spot */
+	if ((attr = get_attr(cmd, FSA_HOTSPOTACCESS)))
+		flowop->fo_hotspotaccess = attr->attr_avd;
+	else
+		flowop->fo_hotspotaccess = avd_int_alloc(90);
+
+	/* standard deviation, % of the working set */
+	if ((attr = get_attr(cmd, FSA_OFFSETSTDDEV)))
+		flowop->fo_offsetstddev = attr->attr_avd;
+	else
+		flowop->fo_offsetstddev = avd_int_alloc(5);
+
+	/* mean number of I/Os in a sequential run */
+	if ((attr = get_attr(cmd, FSA_RUNLENGTH)))
+		flowop->fo_runlength = attr->attr_avd;
+	else
+		flowop->fo_runlength = avd_int_alloc(16);
+
 	/* Read Ahead Diable */
 	if ((attr = get_attr(cmd, FSA_NOREADAHEAD)))
 		flowop->fo_noreadahead = attr->attr_avd;
@@ -2182,6 +2390,18 @@ parser_inner_flowop_define(threadflow_t *thread, flowop_t *comp0_flow,
 		    comp_mstr_flow->fo_lvar_list);
 		avd_update(&inner_flowop->fo_highwater,
 		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_iodepth,
+		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_popularity,
+		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_theta,
+		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_hotset,
+		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_hotaccess,
+		    comp_mstr_flow->fo_lvar_list);
+		avd_update(&inner_flowop->fo_locality,
+		    comp_mstr_flow->fo_lvar_list);
 
 		inner_flowtype = inner_flowtype->fo_exec_next;
 	}
@@ -2206,6 +2426,7 @@ parser_inner_flowop_define(threadflow_t *thread, flowop_t *comp0_flow,
  *  - a source fd (fo_srcfdnumber)
  *  - specify a blocking operation (fo_blocking)
  *  - specify a highwater mark (fo_highwater)
+ *  - asynchronous I/Os to keep in flight (fo_iodepth)
  *
  * After all the supplied attributes are stored in their respective locations
  * in the flowop object, the flowop's init function is called. No errors are
@@ -2361,6 +2582,13 @@ parser_fileset_define_common(cmd_t *cmd)
 	else
 		fileset->fs_paralloc = avd_bool_alloc(FALSE);
 
+	/* write, fallocate, zero, sparse or clone */
+	attr = get_attr(cmd, FSA_ALLOCMODE);
+	if (attr)
+		fileset->fs_allocmode = attr->attr_avd;
+	else
+		fileset->fs_allocmode = avd_str_alloc("write");
+
 	attr = get_attr(cmd, FSA_READONLY);
 	if (attr)
 		fileset->fs_readonly = attr->attr_avd;
@@ -2460,6 +2688,52 @@ parser_fileset_define(cmd_t *cmd)
 		fileset->fs_dirgamma = attr->attr_avd;
 	else
 		fileset->fs_dirgamma = avd_int_alloc(1500);
+
+	/* Use *at() calls relative to cached directory fds? */
+	attr = get_attr(cmd, FSA_DIRFDS);
+	if (attr)
+		fileset->fs_dirfds = attr->attr_avd;
+	else
+		fileset->fs_dirfds = avd_bool_alloc(FALSE);
+
+	/* Keep a manifest of the tree to speed up its reuse? */
+	attr = get_attr(cmd, FSA_MANIFEST);
+	if (attr)
+		fileset->fs_manifest = attr->attr_avd;
+	else
+		fileset->fs_manifest = avd_bool_alloc(FALSE);
+
+	/* uniform, zipf or hotcold file popularity */
+	attr = get_attr(cmd, FSA_POPULARITY);
+	if (attr)
+		fileset->fs_popularity = attr->attr_avd;
+	else
+		fileset->fs_popularity = avd_str_alloc("uniform");
+
+	/* Zipf exponent, * 1000 */
+	attr = get_attr(cmd, FSA_THETA);
+	if (attr)
+		fileset->fs_theta = attr->attr_avd;
+	else
+		fileset->fs_theta = avd_int_alloc(990);
+
+	attr = get_attr(cmd, FSA_HOTSET);
+	if (attr)
+		fileset->fs_hotset = attr->attr_avd;
+	else
+		fileset->fs_hotset = avd_int_alloc(20);
+
+	attr = get_attr(cmd, FSA_HOTACCESS);
+	if (attr)
+		fileset->fs_hotaccess = attr->attr_avd;
+	else
+		fileset->fs_hotaccess = avd_int_alloc(80);
+
+	attr = get_attr(cmd, FSA_LOCALITY);
+	if (attr)
+		fileset->fs_locality = attr->attr_avd;
+	else
+		fileset->fs_locality = avd_int_alloc(0);
 }
 
 /*
@@ -2555,6 +2829,7 @@ parser_run(cmd_t *cmd)
 
 	filebench_log(LOG_INFO, "Running...");
 	stats_clear();
+	stats_timeseries_start();
 
 	/* If it is a timed mode and timeout is not specified use default */
 	if (filebench_shm->shm_rmode == FILEBENCH_MODE_TIMEOUT && !runtime)
@@ -2563,6 +2838,7 @@ parser_run(cmd_t *cmd)
 	timeslept = parser_pause(runtime);
 
 	filebench_log(LOG_INFO, "Run took %d seconds...", timeslept);
+	stats_timeseries_stop();
 	stats_snap();
 	proc_shutdown();
 	parser_filebench_shutdown((cmd_t *)0);
@@ -2603,6 +2879,7 @@ parser_psrun(cmd_t *cmd)
 
 	filebench_log(LOG_INFO, "Running...");
 	stats_clear();
+	stats_timeseries_start();
 
 	/* If it is a timed mode and timeout is not specified use default */
 	if (filebench_shm->shm_rmode == FILEBENCH_MODE_TIMEOUT && !runtime)
@@ -2630,6 +2907,7 @@ parser_psrun(cmd_t *cmd)
 	}
 
 	filebench_log(LOG_INFO, "Run took %d seconds...", timeslept);
+	stats_timeseries_stop();
 	stats_snap();
 	proc_shutdown();
 	parser_filebench_shutdown((cmd_t *)0);
@@ -2663,6 +2941,7 @@ parser_run_variable(cmd_t *cmd)
 
 	filebench_log(LOG_INFO, "Running...");
 	stats_clear();
+	stats_timeseries_start();
 
 	/* If it is a timed mode and timeout is not specified use default */
 	if (filebench_shm->shm_rmode == FILEBENCH_MODE_TIMEOUT && !runtime)
@@ -2671,6 +2950,7 @@ parser_run_variable(cmd_t *cmd)
 	timeslept = parser_pause(runtime);
 
 	filebench_log(LOG_INFO, "Run took %d seconds...", timeslept);
+	stats_timeseries_stop();
 	stats_snap();
 	proc_shutdown();
 	parser_filebench_shutdown((cmd_t *)0);
@@ -2833,13 +3113,84 @@ parser_version(cmd_t *cmd)
 	filebench_log(LOG_INFO, "Filebench Version: %s", FILEBENCH_VERSION);
 }
 
+/*
+ * Enables latency histograms. If a file name is supplied, every stats
+ * snap also appends the histograms, in JSON lines form, to that file,
+ * which is truncated here.
+ */
 static void
 parser_enable_lathist(cmd_t *cmd)
 {
-	filebench_shm->lathist_enabled = 1;
+	attr_t *attr;
+	char *filename;
+	FILE *fp;
+
+	if ((attr = get_attr(cmd, FSA_FILENAME))) {
+		filename = avd_get_str(attr->attr_avd);
+		if ((fp = fopen(filename, "w")) == NULL) {
+			filebench_log(LOG_ERROR,
+			    "enable lathist: could not create %s: %s",
+			    filename, strerror(errno));
+			filebench_shutdown(1);
+		}
+		(void) fclose(fp);
+		(void) strncpy(filebench_shm->shm_lathist_filename, filename,
+		    sizeof (filebench_shm->shm_lathist_filename) - 1);
+	}
+
+	stats_lathist_enable();
 	filebench_log(LOG_INFO, "Latency histogram enabled");
 }
 
+/*
+ * Enables the time series of interval statistics, written to the
+ * mandatory file name every "interval" milliseconds (1000 by default),
+ * as CSV unless "type" is "json".
+ */
+static void
+parser_enable_timeseries(cmd_t *cmd)
+{
+	attr_t *attr;
+	char *filename = NULL;
+	int interval = 1000;
+	int json = 0;
+
+	if ((attr = get_attr(cmd, FSA_FILENAME))) {
+		filename = avd_get_str(attr->attr_avd);
+	} else {
+		filebench_log(LOG_ERROR,
+		    "enable timeseries: no filename specified");
+		filebench_shutdown(1);
+	}
+
+	if ((attr = get_attr(cmd, FSA_INTERVAL)))
+		interval = avd_get_int(attr->attr_avd);
+
+	if (interval < 10) {
+		filebench_log(LOG_ERROR,
+		    "enable timeseries: interval must be at least 10ms");
+		filebench_shutdown(1);
+	}
+
+	if ((attr = get_attr(cmd, FSA_TYPE))) {
+		char *type = avd_get_str(attr->attr_avd);
+
+		if (!strcmp(type, "json")) {
+			json = 1;
+		} else if (strcmp(type, "csv")) {
+			filebench_log(LOG_ERROR,
+			    "enable timeseries: unknown type %s", type);
+			filebench_shutdown(1);
+		}
+	}
+
+	if (stats_timeseries_enable(filename, interval, json) != FILEBENCH_OK)
+		filebench_shutdown(1);
+
+	filebench_log(LOG_INFO, "Time series enabled, every %dms to %s",
+	    interval, filename);
+}
+
 /*
  * define a random variable and initialize the distribution parameters
  */
@@ -2895,6 +3246,24 @@ parser_var_assign_random(char *name, cmd_t *cmd)
 		rndp->rnd_probtabs = NULL;
 	}
 
+	/* Or one read from a histogram file */
+	if ((attr = get_attr(cmd, FSA_HISTOGRAM))) {
+		if (rndp->rnd_probtabs) {
+			filebench_log(LOG_ERROR,
+			    "randvar %s: both randtable and histogram given",
+			    name);
+			filebench_shutdown(1);
+		}
+		rndp->rnd_histogram = attr->attr_avd;
+		rndp->rnd_type |= RAND_TYPE_TABLE;
+
+		/* replay the histogram from its own minimum by default */
+		if (!get_attr(cmd, FSA_MIN))
+			rndp->rnd_min = NULL;
+	} else {
+		rndp->rnd_histogram = NULL;
+	}
+
 	/* Get the type for the random variable */
 	if ((attr = get_attr(cmd, FSA_TYPE))) {
 		int disttype = (int)avd_get_int(attr->attr_avd);
@@ -29,6 +29,9 @@
 #include <sys/types.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
 
 #include "filebench.h"
 #include "flowop.h"
@@ -66,18 +69,336 @@ stats_add(struct flowstats *a, struct flowstats *b)
 	if (b->fs_minlat < a->fs_minlat)
 		a->fs_minlat = b->fs_minlat;
 
-	for (i = 0; i < OSPROF_BUCKET_NUMBER; i++)
-		a->fs_distribution[i] += b->fs_distribution[i];
+	if (a->fs_lathist && b->fs_lathist)
+		for (i = 0; i < LATHIST_BUCKETS; i++)
+			a->fs_lathist[i] += b->fs_lathist[i];
+}
+
+/*
+ * Zeroes the statistics in fs. A latency histogram is kept, but cleared.
+ */
+static void
+stats_zero(struct flowstats *fs)
+{
+	uint64_t *lathist = fs->fs_lathist;
+
+	(void) memset(fs, 0, sizeof (struct flowstats));
+	if (lathist) {
+		(void) memset(lathist, 0, LATHIST_SIZE);
+		fs->fs_lathist = lathist;
+	}
+}
+
+/*
+ * Allocates n zeroed, process local flowstats. When lathist is enabled
+ * each of them gets a latency histogram, carved out of the same block,
+ * so the whole lot is released with a single free().
+ */
+static struct flowstats *
+stats_alloc(int n)
+{
+	struct flowstats *fs;
+	uint64_t *lathist;
+	size_t size = n * sizeof (struct flowstats);
+	int i;
+
+	if (filebench_shm->lathist_enabled)
+		size += n * LATHIST_SIZE;
+
+	if ((fs = calloc(1, size)) == NULL)
+		return (NULL);
+
+	if (filebench_shm->lathist_enabled) {
+		lathist = (uint64_t *)&fs[n];
+		for (i = 0; i < n; i++)
+			fs[i].fs_lathist = lathist + i * LATHIST_BUCKETS;
+	}
+
+	return (fs);
+}
+
+/*
+ * Returns the latency histogram bucket that a latency of lat
+ * nanoseconds falls into. See the description of LATHIST_SUB_BITS
+ * in stats.h for the layout of the buckets.
+ */
+int
+stats_lathist_index(unsigned long long lat)
+{
+	int msb;
+	int shift;
+
+	if (lat < (1ULL << LATHIST_SUB_BITS))
+		return ((int)lat);
+
+	if (lat >= (1ULL << LATHIST_MAX_BITS))
+		return (LATHIST_BUCKETS - 1);
+
+#ifdef __GNUC__
+	msb = 63 - __builtin_clzll(lat);
+#else
+	for (msb = LATHIST_SUB_BITS; (lat >> (msb + 1)) != 0; msb++)
+		;
+#endif
+	shift = msb - (LATHIST_SUB_BITS - 1);
+
+	return ((shift << (LATHIST_SUB_BITS - 1)) + (int)(lat >> shift));
+}
+
+/*
+ * Returns the range of latencies, in nanoseconds, that bucket idx
+ * of a latency histogram covers.
+ */
+static void
+stats_lathist_range(int idx, unsigned long long *low, unsigned long long *high)
+{
+	int shift;
+	unsigned long long sub;
+
+	if (idx < (1 << LATHIST_SUB_BITS)) {
+		*low = *high = idx;
+		return;
+	}
+
+	shift = (idx >> (LATHIST_SUB_BITS - 1)) - 1;
+	sub = idx - (shift << (LATHIST_SUB_BITS - 1));
+	*low = sub << shift;
+	*high = ((sub + 1) << shift) - 1;
+}
+
+/*
+ * Percentiles reported for latency histograms.
+ */
+static const struct {
+	const char	*name;
+	double		fraction;
+} stats_pcts[] = {
+	{ "p50",	0.5 },
+	{ "p90",	0.9 },
+	{ "p99",	0.99 },
+	{ "p99.9",	0.999 },
+	{ "p99.99",	0.9999 },
+};
+
+#define	STATS_NPCTS	(sizeof (stats_pcts) / sizeof (stats_pcts[0]))
+#define	STATS_PCT_P99	2	/* index of p99 in stats_pcts */
+
+/*
+ * Fills pcts with the latencies, in nanoseconds, at the percentiles
+ * listed in stats_pcts. A percentile is reported as the highest latency
+ * of the bucket it falls into, capped by the largest latency actually
+ * seen, so it never understates the tail. Returns the number of
+ * latencies recorded in the histogram.
+ */
+static uint64_t
+stats_lathist_pcts(struct flowstats *fs, unsigned long long *pcts)
+{
+	unsigned long long low, high;
+	uint64_t total = 0;
+	uint64_t seen = 0;
+	uint64_t want;
+	int i, p = 0;
+
+	for (i = 0; i < STATS_NPCTS; i++)
+		pcts[i] = 0;
+
+	if (fs->fs_lathist == NULL)
+		return (0);
+
+	for (i = 0; i < LATHIST_BUCKETS; i++)
+		total += fs->fs_lathist[i];
+
+	if (total == 0)
+		return (0);
+
+	for (i = 0; i < LATHIST_BUCKETS && p < STATS_NPCTS; i++) {
+		seen += fs->fs_lathist[i];
+		stats_lathist_range(i, &low, &high);
+		if (high > fs->fs_maxlat)
+			high = fs->fs_maxlat;
+
+		while (p < STATS_NPCTS) {
+			want = (uint64_t)ceil(stats_pcts[p].fraction * total);
+			if (want == 0)
+				want = 1;
+			if (seen < want)
+				break;
+			pcts[p++] = high;
+		}
+	}
+
+	return (total);
+}
+
+/*
+ * Appends the latency percentiles of fs to the line being built in str.
+ */
+static void
+stats_lathist_print(struct flowstats *fs, char *str, size_t len)
+{
+	unsigned long long pcts[STATS_NPCTS];
+	size_t off;
+	int i;
+
+	(void) stats_lathist_pcts(fs, pcts);
+
+	for (i = 0; i < STATS_NPCTS; i++) {
+		off = strlen(str);
+		(void) snprintf(str + off, len - off, " %s %.3fms",
+		    stats_pcts[i].name, pcts[i] / SEC2MS_FLOAT);
+	}
+}
+
+/*
+ * Writes the latency histogram of fs, along with its percentiles, as
+ * a single JSON object on its own line. Only non-empty buckets are
+ * listed, each as a [low, high, count] triple with latencies in
+ * nanoseconds, so that external tools can merge histograms or compute
+ * any other percentile.
+ */
+static void
+stats_lathist_export(FILE *fp, const char *name, struct flowstats *fs,
+    double total_time_sec)
+{
+	unsigned long long pcts[STATS_NPCTS];
+	unsigned long long low, high;
+	uint64_t total;
+	char *sep = "";
+	int i;
+
+	total = stats_lathist_pcts(fs, pcts);
+	if (total == 0)
+		return;
+
+	(void) fprintf(fp, "{\"name\": \"%s\", \"seconds\": %.3f, "
+	    "\"ops\": %llu, \"mean_ns\": %.0f, \"max_ns\": %llu",
+	    name, total_time_sec, (unsigned long long)total,
+	    fs->fs_count ? (double)fs->fs_total_lat / fs->fs_count : 0.0,
+	    fs->fs_maxlat);
+
+	for (i = 0; i < STATS_NPCTS; i++)
+		(void) fprintf(fp, ", \"%s_ns\": %llu",
+		    stats_pcts[i].name, pcts[i]);
+
+	(void) fprintf(fp, ", \"buckets\": [");
+	for (i = 0; i < LATHIST_BUCKETS; i++) {
+		if (fs->fs_lathist[i] == 0)
+			continue;
+		stats_lathist_range(i, &low, &high);
+		(void) fprintf(fp, "%s[%llu, %llu, %llu]", sep, low, high,
+		    (unsigned long long)fs->fs_lathist[i]);
+		sep = ", ";
+	}
+	(void) fprintf(fp, "]}\n");
+}
+
+/*
+ * Gives flowop a cleared latency histogram of its own in shared memory,
+ * unless it already has one. Called with shm_flowop_lock held, for every
+ * flowop created while lathist is enabled and for all existing flowops
+ * when it gets enabled. The latencies of a flowop without a histogram
+ * are not recorded.
+ */
+void
+stats_lathist_attach(flowop_t *flowop)
+{
+	uint64_t *lathist;
+
+	if (flowop->fo_stats.fs_lathist)
+		return;
+
+	lathist = ipc_lathistalloc(flowop - filebench_shm->shm_flowop);
+	if (lathist == NULL)
+		return;
+
+	(void) memset(lathist, 0, LATHIST_SIZE);
+	flowop->fo_stats.fs_lathist = lathist;
+}
+
+/*
+ * Turns latency histograms on, for the flowops that already exist and
+ * for all those created from now on.
+ */
+void
+stats_lathist_enable(void)
+{
+	flowop_t *flowop;
+
+	(void) ipc_mutex_lock(&filebench_shm->shm_flowop_lock);
+	filebench_shm->lathist_enabled = 1;
+	for (flowop = filebench_shm->shm_flowoplist; flowop;
+	    flowop = flowop->fo_next)
+		stats_lathist_attach(flowop);
+	(void) ipc_mutex_unlock(&filebench_shm->shm_flowop_lock);
+}
+
+/*
+ * Resets the statistics of a flowop and tags them with generation gen.
+ * Called by the thread owning the flowop, between STATS_WRITE_BEGIN()
+ * and STATS_WRITE_END(), so the sequence counter is left alone.
+ */
+void
+stats_reset(struct flowstats *fs, int gen)
+{
+	unsigned int seq = fs->fs_seq;
+
+	stats_zero(fs);
+	fs->fs_seq = seq;
+	fs->fs_gen = gen;
+}
+
+/*
+ * Copies the statistics of a running flowop from src to dst without
+ * stopping the thread that updates them. The counters are copied again
+ * until no update was in progress while they were copied; if the owner
+ * never seems to finish its update (it may have died half way through)
+ * the last copy is used as is. The latency histogram is too large to be
+ * copied in one go between two operations of a fast flowop, so it is
+ * copied on its own, into dst's own histogram if it has one: its buckets
+ * only ever grow, so it is at most a few operations off from the
+ * counters. Returns 0 if the statistics predate the last stats_clear()
+ * and so count as empty, 1 otherwise.
+ */
+static int
+stats_read(struct flowstats *dst, struct flowstats *src)
+{
+	unsigned int seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = src->fs_seq;
+		FB_LOAD_FENCE();
+		(void) memcpy(dst, src, offsetof(struct flowstats, fs_lathist));
+		FB_LOAD_FENCE();
+		if (!(seq & 1) && seq == src->fs_seq)
+			break;
+
+		/* the owner may have been preempted half way through */
+		if (tries >= 100)
+			(void) usleep(1000);
+	}
+
+	if (dst->fs_gen != filebench_shm->shm_stats_gen)
+		return (0);
+
+	if (dst->fs_lathist == NULL)
+		return (1);
+
+	if (src->fs_lathist)
+		(void) memcpy(dst->fs_lathist, src->fs_lathist, LATHIST_SIZE);
+	else
+		(void) memset(dst->fs_lathist, 0, LATHIST_SIZE);
+
+	return (1);
 }
 
 /*
  * Takes a "snapshot" of the global statistics. Actually, it calculates
  * them from the local statistics maintained by each flowop.
- * First the routine pauses filebench, then rolls the statistics for
- * each flowop into its associated FLOW_MASTER flowop.
- * Next all the FLOW_MASTER flowops' statistics are written
- * to the log file followed by the global totals. Then filebench
- * operation is allowed to resume.
+ * The routine copies the statistics of each flowop while the run goes
+ * on (see stats_read()) and rolls them into its associated FLOW_MASTER
+ * flowop. Next all the FLOW_MASTER flowops' statistics are written
+ * to the log file followed by the global totals.
  */
 void
 stats_snap(void)
@@ -86,8 +407,11 @@ stats_snap(void)
 	struct flowstats *aiostat = &globalstats[FLOW_TYPE_AIO];
 	hrtime_t orig_starttime;
 	flowop_t *flowop;
+	struct flowstats *snap;
+	FILE *lathist_fp = NULL;
 	char *str;
 	double total_time_sec;
+	int i;
 
 	if (!globalstats) {
 		filebench_log(LOG_ERROR,
@@ -102,8 +426,11 @@ stats_snap(void)
 		return;
 	}
 
-	/* Freeze statistics during update */
-	filebench_shm->shm_bequiet = 1;
+	if ((snap = stats_alloc(1)) == NULL) {
+		filebench_log(LOG_ERROR,
+		    "stats snap: could not allocate memory");
+		return;
+	}
 
 	/* We want to have blank global statistics each
 	 * time we start the summation process, but the
@@ -111,7 +438,8 @@ stats_snap(void)
 	 * unchanged (it's a snapshot compared to the original
 	 * start time). */
 	orig_starttime = globalstats->fs_stime;
-	(void) memset(globalstats, 0, FLOW_TYPES * sizeof(struct flowstats));
+	for (i = 0; i < FLOW_TYPES; i++)
+		stats_zero(&globalstats[i]);
 	globalstats->fs_stime = orig_starttime;
 	globalstats->fs_etime = gethrtime();
 
@@ -124,7 +452,7 @@ stats_snap(void)
 	flowop = filebench_shm->shm_flowoplist;
 	while (flowop) {
 		if (flowop->fo_instance == FLOW_MASTER) {
-			(void) memset(&flowop->fo_stats, 0, sizeof(struct flowstats));
+			stats_zero(&flowop->fo_stats);
 			flowop->fo_stats.fs_minlat = ULLONG_MAX;
 		}
 		flowop = flowop->fo_next;
@@ -140,14 +468,19 @@ stats_snap(void)
 			continue;
 		}
 
+		if (!stats_read(snap, &flowop->fo_stats)) {
+			flowop = flowop->fo_next;
+			continue;
+		}
+
 		/* Roll up per-flowop into global stats */
-		stats_add(&globalstats[flowop->fo_type], &flowop->fo_stats);
-		stats_add(&globalstats[FLOW_TYPE_GLOBAL], &flowop->fo_stats);
+		stats_add(&globalstats[flowop->fo_type], snap);
+		stats_add(&globalstats[FLOW_TYPE_GLOBAL], snap);
 
-		flowop_master = flowop_find_one(flowop->fo_name, FLOW_MASTER);
+		flowop_master = flowop->fo_master;
 		if (flowop_master) {
 			/* Roll up per-flowop stats into master */
-			stats_add(&flowop_master->fo_stats, &flowop->fo_stats);
+			stats_add(&flowop_master->fo_stats, snap);
 		} else {
 			filebench_log(LOG_DEBUG_NEVER,
 			    "flowop_stats could not find %s",
@@ -159,26 +492,33 @@ stats_snap(void)
 		    "%8.3fms/op",
 		    flowop->fo_name,
 		    flowop->fo_instance,
-		    flowop->fo_stats.fs_count,
-		    flowop->fo_stats.fs_count / total_time_sec,
-		    (flowop->fo_stats.fs_bytes / MB_FLOAT) / total_time_sec,
-		    flowop->fo_stats.fs_count ?
-		    flowop->fo_stats.fs_total_lat /
-		    (flowop->fo_stats.fs_count * SEC2MS_FLOAT) : 0);
+		    snap->fs_count,
+		    snap->fs_count / total_time_sec,
+		    (snap->fs_bytes / MB_FLOAT) / total_time_sec,
+		    snap->fs_count ?
+		    snap->fs_total_lat /
+		    (snap->fs_count * SEC2MS_FLOAT) : 0);
 
 		flowop = flowop->fo_next;
 
 	}
 
+	if (filebench_shm->lathist_enabled &&
+	    filebench_shm->shm_lathist_filename[0] != '\0') {
+		lathist_fp = fopen(filebench_shm->shm_lathist_filename, "a");
+		if (lathist_fp == NULL)
+			filebench_log(LOG_ERROR,
+			    "Could not open latency histogram file %s: %s",
+			    filebench_shm->shm_lathist_filename,
+			    strerror(errno));
+	}
+
 	flowop = filebench_shm->shm_flowoplist;
 	str = malloc(1048576);
 	*str = '\0';
 	(void) strcpy(str, "Per-Operation Breakdown\n");
 	while (flowop) {
 		char line[1024];
-		char histogram[1024];
-		char hist_reading[20];
-		int i = 0;
 
 		if (flowop->fo_instance != FLOW_MASTER) {
 			flowop = flowop->fo_next;
@@ -202,16 +542,16 @@ stats_snap(void)
 		(void) strcat(str, line);
 
 		if (filebench_shm->lathist_enabled) {
-			(void) sprintf(histogram, "\t[ ");
-			for (i = 0; i < OSPROF_BUCKET_NUMBER; i++) {
-				(void) sprintf(hist_reading, "%lu ",
-				flowop->fo_stats.fs_distribution[i]);
-				(void) strcat(histogram, hist_reading);
-			}
-			(void) strcat(histogram, "]\n");
-			(void) strcat(str, histogram);
-		} else
-			(void) strcat(str, "\n");
+			line[0] = '\0';
+			stats_lathist_print(&flowop->fo_stats, line,
+			    sizeof (line));
+			(void) strcat(str, line);
+			if (lathist_fp)
+				stats_lathist_export(lathist_fp,
+				    flowop->fo_name, &flowop->fo_stats,
+				    total_time_sec);
+		}
+		(void) strcat(str, "\n");
 
 		flowop = flowop->fo_next;
 	}
@@ -235,11 +575,38 @@ stats_snap(void)
 	    (iostat->fs_total_lat + aiostat->fs_total_lat) /
 	    ((iostat->fs_count + aiostat->fs_count) * SEC2MS_FLOAT) : 0);
 
-	filebench_shm->shm_bequiet = 0;
+	if (filebench_shm->lathist_enabled) {
+		struct flowstats *allio;
+		char line[1024];
+
+		allio = stats_alloc(1);
+		if (allio) {
+			allio->fs_minlat = ULLONG_MAX;
+			stats_add(allio, iostat);
+			stats_add(allio, aiostat);
+
+			(void) strcpy(line, "IO Summary latency:");
+			stats_lathist_print(allio, line, sizeof (line));
+			filebench_log(LOG_INFO, "%s", line);
+
+			if (lathist_fp)
+				stats_lathist_export(lathist_fp, "IO Summary",
+				    allio, total_time_sec);
+			free(allio);
+		}
+	}
+
+	if (lathist_fp)
+		(void) fclose(lathist_fp);
+
+	free(snap);
 }
 
 /*
  * Clears all the statistics variables (fo_stats) for every defined flowop.
+ * Running flowops are not written to; instead the statistics generation
+ * is advanced, which makes stats_snap() ignore their current statistics
+ * and their threads reset them on their next operation.
  * It also creates a global flowstat table if one doesn't already exist and
  * clears it.
  */
@@ -247,22 +614,357 @@ void
 stats_clear(void)
 {
 	flowop_t *flowop;
+	int i;
 
-	if (globalstats == NULL)
-		globalstats = malloc(FLOW_TYPES * sizeof (struct flowstats));
+	/* lathist may have been enabled since the table was allocated */
+	if (globalstats && globalstats->fs_lathist == NULL &&
+	    filebench_shm->lathist_enabled) {
+		free(globalstats);
+		globalstats = NULL;
+	}
 
-	(void) memset(globalstats, 0, FLOW_TYPES * sizeof (struct flowstats));
+	if (globalstats == NULL &&
+	    (globalstats = stats_alloc(FLOW_TYPES)) == NULL) {
+		filebench_log(LOG_ERROR,
+		    "stats clear: could not allocate memory");
+		return;
+	}
+
+	for (i = 0; i < FLOW_TYPES; i++)
+		stats_zero(&globalstats[i]);
 
 	flowop = filebench_shm->shm_flowoplist;
 
+	filebench_shm->shm_stats_gen++;
+
 	while (flowop) {
 		filebench_log(LOG_DEBUG_IMPL, "Clearing stats for %s-%d",
 		    flowop->fo_name,
 		    flowop->fo_instance);
-		(void) memset(&flowop->fo_stats, 0, sizeof (struct flowstats));
+		if (flowop->fo_instance <= FLOW_DEFINITION)
+			stats_zero(&flowop->fo_stats);
 		flowop = flowop->fo_next;
 	}
 
-	(void) memset(globalstats, 0, sizeof(struct flowstats));
 	globalstats->fs_stime = gethrtime();
 }
+
+/*
+ * Time series of interval statistics. When enabled, a thread of the
+ * master process samples the statistics of all runtime flowops every
+ * ts_interval nanoseconds while a run is in progress, and writes, for
+ * each FLOW_MASTER flowop and each threadflow, a record with the
+ * throughput and latency over the last interval. Samples are taken the
+ * same way as stats_snap() takes them, so the run is not disturbed.
+ * Interval latency percentiles come from the difference between two
+ * consecutive latency histograms, and the interval maximum is the upper
+ * bound of the highest bucket that grew.
+ *
+ * The cumulative sums shrink when runtime flowops are destroyed, so a
+ * counter that went down contributes nothing to the interval rather
+ * than wrapping around.
+ */
+#define	TS_DELTA(cur, prev)	((cur) > (prev) ? (cur) - (prev) : 0)
+
+typedef struct stats_tsentry {
+	char			te_name[288];	/* flowop, or process.thread */
+	struct flowstats	te_cur;		/* cumulative, this sample */
+	struct flowstats	te_prev;	/* cumulative, last sample */
+} stats_tsentry_t;
+
+static char ts_filename[MAXPATHLEN];
+static int ts_json;
+static hrtime_t ts_interval;
+static FILE *ts_fp;
+static pthread_t ts_tid;
+static volatile int ts_running;
+static hrtime_t ts_start;
+static hrtime_t ts_last;
+static int ts_gen;
+static stats_tsentry_t *ts_flowops[FILEBENCH_NFLOWOPS];
+static stats_tsentry_t *ts_threads[FILEBENCH_NTHREADFLOWS];
+
+/*
+ * Records the time series settings. Called by the parser for the
+ * "enable timeseries" command. The file is created, or truncated, here
+ * so that errors show up before the run starts.
+ */
+int
+stats_timeseries_enable(char *filename, int interval_ms, int json)
+{
+	FILE *fp;
+
+	if ((fp = fopen(filename, "w")) == NULL) {
+		filebench_log(LOG_ERROR, "Could not create time series file "
+		    "%s: %s", filename, strerror(errno));
+		return (FILEBENCH_ERROR);
+	}
+	(void) fclose(fp);
+
+	(void) strncpy(ts_filename, filename, sizeof (ts_filename) - 1);
+	ts_interval = (hrtime_t)interval_ms * 1000000LL;
+	ts_json = json;
+
+	/* interval percentiles need the latency histograms */
+	stats_lathist_enable();
+
+	return (FILEBENCH_OK);
+}
+
+/*
+ * Returns the entry in slot, allocating it on first use along with the
+ * histograms of its two samples.
+ */
+static stats_tsentry_t *
+stats_ts_entry(stats_tsentry_t **slot)
+{
+	stats_tsentry_t *te;
+
+	if (*slot == NULL &&
+	    (te = calloc(1, sizeof (stats_tsentry_t) + 2 * LATHIST_SIZE))) {
+		te->te_cur.fs_lathist = (uint64_t *)&te[1];
+		te->te_prev.fs_lathist = te->te_cur.fs_lathist +
+		    LATHIST_BUCKETS;
+		*slot = te;
+	}
+
+	return (*slot);
+}
+
+/*
+ * Writes the record for one entry, covering the time since the
+ * previous sample, and makes the current sample the previous one.
+ */
+static void
+stats_ts_emit(stats_tsentry_t *te, struct flowstats *d, const char *kind,
+    double seconds, double period)
+{
+	struct flowstats *cur = &te->te_cur;
+	struct flowstats *prev = &te->te_prev;
+	unsigned long long pcts[STATS_NPCTS];
+	unsigned long long low, high, maxlat = 0;
+	int i;
+
+	stats_zero(d);
+	d->fs_count = TS_DELTA(cur->fs_count, prev->fs_count);
+	d->fs_bytes = TS_DELTA(cur->fs_bytes, prev->fs_bytes);
+	d->fs_total_lat = TS_DELTA(cur->fs_total_lat, prev->fs_total_lat);
+	d->fs_maxlat = cur->fs_maxlat;
+	for (i = 0; i < LATHIST_BUCKETS; i++) {
+		d->fs_lathist[i] = TS_DELTA(cur->fs_lathist[i],
+		    prev->fs_lathist[i]);
+		if (d->fs_lathist[i]) {
+			stats_lathist_range(i, &low, &high);
+			maxlat = high < cur->fs_maxlat ? high : cur->fs_maxlat;
+		}
+	}
+	(void) stats_lathist_pcts(d, pcts);
+
+	if (ts_json)
+		(void) fprintf(ts_fp, "{\"seconds\": %.3f, \"kind\": \"%s\", "
+		    "\"name\": \"%s\", \"ops\": %d, \"ops_per_sec\": %.1f, "
+		    "\"mb_per_sec\": %.3f, \"mean_ms\": %.3f, "
+		    "\"p99_ms\": %.3f, \"max_ms\": %.3f}\n",
+		    seconds, kind, te->te_name, d->fs_count,
+		    d->fs_count / period, (d->fs_bytes / MB_FLOAT) / period,
+		    d->fs_count ? d->fs_total_lat /
+		    (d->fs_count * SEC2MS_FLOAT) : 0,
+		    pcts[STATS_PCT_P99] / SEC2MS_FLOAT, maxlat / SEC2MS_FLOAT);
+	else
+		(void) fprintf(ts_fp, "%.3f,%s,%s,%d,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+		    seconds, kind, te->te_name, d->fs_count,
+		    d->fs_count / period, (d->fs_bytes / MB_FLOAT) / period,
+		    d->fs_count ? d->fs_total_lat /
+		    (d->fs_count * SEC2MS_FLOAT) : 0,
+		    pcts[STATS_PCT_P99] / SEC2MS_FLOAT, maxlat / SEC2MS_FLOAT);
+
+	(void) memcpy(prev, cur, offsetof(struct flowstats, fs_lathist));
+	(void) memcpy(prev->fs_lathist, cur->fs_lathist, LATHIST_SIZE);
+	stats_zero(cur);
+}
+
+/*
+ * Takes one time series sample and writes its records.
+ */
+static void
+stats_ts_sample(struct flowstats *snap)
+{
+	flowop_t *flowop;
+	stats_tsentry_t *te;
+	hrtime_t now = gethrtime();
+	double period;
+	int reset = 0;
+	int i;
+
+	period = (now - ts_last) / SEC2NS_FLOAT;
+	if (period <= 0)
+		return;
+
+	/* statistics cleared by psrun: start over from zero */
+	if (ts_gen != filebench_shm->shm_stats_gen) {
+		ts_gen = filebench_shm->shm_stats_gen;
+		reset = 1;
+	}
+
+	/*
+	 * Runtime flowops come and go while the run is in progress, so
+	 * keep them from being deleted under the walk.
+	 */
+	(void) ipc_mutex_lock(&filebench_shm->shm_flowop_lock);
+	for (flowop = filebench_shm->shm_flowoplist; flowop;
+	    flowop = flowop->fo_next) {
+		threadflow_t *threadflow = flowop->fo_thread;
+
+		if (flowop->fo_instance <= FLOW_DEFINITION ||
+		    flowop->fo_master == NULL || threadflow == NULL)
+			continue;
+
+		te = stats_ts_entry(&ts_flowops[flowop->fo_master -
+		    filebench_shm->shm_flowop]);
+		if (te && te->te_name[0] == '\0')
+			(void) strncpy(te->te_name, flowop->fo_master->fo_name,
+			    sizeof (te->te_name) - 1);
+
+		if (!stats_read(snap, &flowop->fo_stats))
+			continue;
+
+		if (te)
+			stats_add(&te->te_cur, snap);
+
+		te = stats_ts_entry(&ts_threads[threadflow -
+		    filebench_shm->shm_threadflow]);
+		if (te == NULL)
+			continue;
+		if (te->te_name[0] == '\0')
+			(void) snprintf(te->te_name, sizeof (te->te_name),
+			    "%s-%d.%s-%d", threadflow->tf_process->pf_name,
+			    threadflow->tf_process->pf_instance,
+			    threadflow->tf_name, threadflow->tf_instance);
+		stats_add(&te->te_cur, snap);
+	}
+	(void) ipc_mutex_unlock(&filebench_shm->shm_flowop_lock);
+
+	for (i = 0; i < FILEBENCH_NFLOWOPS; i++) {
+		if ((te = ts_flowops[i]) == NULL)
+			continue;
+		if (reset)
+			stats_zero(&te->te_prev);
+		stats_ts_emit(te, snap, "flowop",
+		    (now - ts_start) / SEC2NS_FLOAT, period);
+	}
+
+	for (i = 0; i < FILEBENCH_NTHREADFLOWS; i++) {
+		if ((te = ts_threads[i]) == NULL)
+			continue;
+		if (reset)
+			stats_zero(&te->te_prev);
+		stats_ts_emit(te, snap, "thread",
+		    (now - ts_start) / SEC2NS_FLOAT, period);
+	}
+
+	(void) fflush(ts_fp);
+	ts_last = now;
+}
+
+static void *
+stats_ts_thread(void *arg)
+{
+	struct flowstats *snap = arg;
+	hrtime_t next = ts_start + ts_interval;
+	hrtime_t now;
+
+	while (ts_running) {
+		now = gethrtime();
+		if (now < next) {
+			/* wake up regularly to notice the end of the run */
+			hrtime_t nap = next - now;
+
+			if (nap > 100000000LL)
+				nap = 100000000LL;
+			(void) usleep(nap / 1000);
+			continue;
+		}
+
+		stats_ts_sample(snap);
+		next += ts_interval;
+		if (next < now)
+			next = now + ts_interval;
+	}
+
+	return (snap);
+}
+
+/*
+ * Starts sampling the time series, if enabled. Called once the run
+ * has started and the statistics have been cleared.
+ */
+void
+stats_timeseries_start(void)
+{
+	struct flowstats *snap;
+
+	if (ts_interval == 0 || ts_running)
+		return;
+
+	if ((ts_fp = fopen(ts_filename, "a")) == NULL) {
+		filebench_log(LOG_ERROR, "Could not open time series file "
+		    "%s: %s", ts_filename, strerror(errno));
+		return;
+	}
+
+	if ((snap = stats_alloc(1)) == NULL) {
+		(void) fclose(ts_fp);
+		return;
+	}
+
+	if (!ts_json && ftell(ts_fp) == 0)
+		(void) fprintf(ts_fp, "seconds,kind,name,ops,ops_per_sec,"
+		    "mb_per_sec,mean_ms,p99_ms,max_ms\n");
+
+	ts_start = ts_last = gethrtime();
+	ts_gen = filebench_shm->shm_stats_gen;
+	ts_running = 1;
+
+	if (pthread_create(&ts_tid, NULL, stats_ts_thread, snap) != 0) {
+		filebench_log(LOG_ERROR, "Could not create time series "
+		    "thread: %s", strerror(errno));
+		ts_running = 0;
+		(void) fclose(ts_fp);
+		free(snap);
+		return;
+	}
+
+	filebench_log(LOG_VERBOSE, "Writing time series to %s every %.3fs",
+	    ts_filename, ts_interval / SEC2NS_FLOAT);
+}
+
+/*
+ * Stops sampling, writing a last sample for the partial interval.
+ * Must be called before the run's flowops are deleted.
+ */
+void
+stats_timeseries_stop(void)
+{
+	void *snap;
+	int i;
+
+	if (!ts_running)
+		return;
+
+	ts_running = 0;
+	(void) pthread_join(ts_tid, &snap);
+
+	stats_ts_sample(snap);
+	free(snap);
+	(void) fclose(ts_fp);
+	ts_fp = NULL;
+
+	for (i = 0; i < FILEBENCH_NFLOWOPS; i++) {
+		free(ts_flowops[i]);
+		ts_flowops[i] = NULL;
+	}
+	for (i = 0; i < FILEBENCH_NTHREADFLOWS; i++) {
+		free(ts_threads[i]);
+		ts_threads[i] = NULL;
+	}
+}
@@ -31,32 +31,126 @@
 
 void stats_clear(void);
 void stats_snap(void);
+int stats_lathist_index(unsigned long long lat);
+struct flowstats;
+void stats_reset(struct flowstats *fs, int gen);
+struct flowop;
+void stats_lathist_enable(void);
+void stats_lathist_attach(struct flowop *flowop);
+int stats_timeseries_enable(char *filename, int interval_ms, int json);
+void stats_timeseries_start(void);
+void stats_timeseries_stop(void);
 
-#define OSPROF_BUCKET_NUMBER	64
+/*
+ * Latency histograms are log-linear, in the spirit of HdrHistogram:
+ * latencies below 2^LATHIST_SUB_BITS nanoseconds get a bucket each, and
+ * every following power of two range is split into
+ * 2^(LATHIST_SUB_BITS - 1) equally sized buckets. The width of a bucket
+ * is therefore never more than 1/32 of the values it holds, which bounds
+ * the relative error of reported percentiles to about 3%. Latencies of
+ * 2^LATHIST_MAX_BITS nanoseconds (about 68 seconds) and more all land in
+ * the last bucket. Histograms are plain arrays of counters, so merging
+ * them across threads and processes is a simple element-wise sum.
+ */
+#define	LATHIST_SUB_BITS	6
+#define	LATHIST_MAX_BITS	36
+#define	LATHIST_BUCKETS		\
+	((LATHIST_MAX_BITS - LATHIST_SUB_BITS + 2) << (LATHIST_SUB_BITS - 1))
+#define	LATHIST_SIZE		(LATHIST_BUCKETS * sizeof (uint64_t))
+
+/*
+ * Size of a cache line. Statistics that are updated by one thread and
+ * read by others are aligned and padded to it, so that threads updating
+ * their own counters do not invalidate each other's cache lines.
+ */
+#define	FB_CACHE_LINE	64
+#ifdef __GNUC__
+#define	FB_CACHE_ALIGNED __attribute__((aligned(FB_CACHE_LINE)))
+#else
+#define	FB_CACHE_ALIGNED
+#endif
+
+/*
+ * Memory barriers for the flowstats sequence counter: the store fence
+ * orders the counter update against the statistics stores around it,
+ * the load fence does the same for the reader's loads.
+ */
+#ifdef __GNUC__
+#define	FB_STORE_FENCE()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define	FB_LOAD_FENCE()		__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+#define	FB_STORE_FENCE()
+#define	FB_LOAD_FENCE()
+#endif
 
 struct flowstats {
-	/* Eight fields below are updated per each flowop and
-	 * added up in globalstats and master flowop at stats_snap() */
+	/*
+	 * The fields below are updated per each flowop and added up in
+	 * globalstats and master flowop at stats_snap(). Those updated on
+	 * every operation come first, so they share a single cache line.
+	 *
+	 * Only the thread running a flowop updates its statistics, and it
+	 * does so between STATS_WRITE_BEGIN() and STATS_WRITE_END(), which
+	 * bump fs_seq to an odd and back to an even value. stats_snap()
+	 * copies the statistics while the run goes on and retries the copy
+	 * if fs_seq was odd or changed under it. stats_clear() does not
+	 * touch running flowops either: it bumps shm_stats_gen instead, and
+	 * statistics tagged with an older fs_gen count as zero until their
+	 * owner resets them on its next operation.
+	 */
+	volatile unsigned int fs_seq;	/* update sequence counter */
+	int		fs_gen;		/* stats_clear() generation */
 	int		fs_count;	/* Number of ops */
+	uint64_t	fs_bytes;	/* Number of bytes read/written */
+	hrtime_t	fs_total_lat;
+	unsigned long long fs_maxlat;	/* max flowop latency (nanoseconds) */
+	unsigned long long fs_minlat; /* min flowop latency (nanoseconds) */
 	uint64_t	fs_rcount;	/* Number of read ops */
 	uint64_t	fs_wcount;	/* Number of write ops */
 
-	uint64_t	fs_bytes;	/* Number of bytes read/written */
 	uint64_t	fs_rbytes;	/* Number of bytes read */
 	uint64_t	fs_wbytes;	/* Number of bytes written */
 
-	unsigned long	fs_distribution[OSPROF_BUCKET_NUMBER]; /* Used for OSprof */
-	hrtime_t	fs_total_lat;
-	unsigned long long fs_maxlat;	/* max flowop latency (nanoseconds) */
-	unsigned long long fs_minlat; /* min flowop latency (nanoseconds) */
-
 	/* These two fields are used only in globalstats variable
 	 * to note the total time of statistics collection: from
 	 * stats_clear() to stats_snap() */
 	hrtime_t	fs_stime;
 	hrtime_t	fs_etime;
+
+	/*
+	 * Latency histogram of LATHIST_BUCKETS counters, or NULL. At 8KB it
+	 * is several times the size of the rest of the statistics, so it is
+	 * kept out of line and only allocated once lathist is enabled: see
+	 * stats_lathist_attach(). Must stay the last field.
+	 */
+	uint64_t	*fs_lathist;
 };
 
+/*
+ * Per-thread I/O counters used by the rate limiting and finishon flowops.
+ * Only the owning thread updates them, so no lock is needed; readers add
+ * up the counters of all threads of the process when they need them.
+ */
+struct ctlstats {
+	uint64_t	cs_count;	/* Number of I/O ops */
+	uint64_t	cs_bytes;	/* Number of bytes read/written */
+	uint64_t	cs_rcount;	/* Number of read ops */
+	uint64_t	cs_wcount;	/* Number of write ops */
+	uint64_t	cs_rbytes;	/* Number of bytes read */
+	uint64_t	cs_wbytes;	/* Number of bytes written */
+	char		cs_pad[FB_CACHE_LINE - 6 * sizeof (uint64_t)];
+} FB_CACHE_ALIGNED;
+
+#define	STATS_WRITE_BEGIN(fs) {					\
+	(fs)->fs_seq++;							\
+	FB_STORE_FENCE();						\
+}
+
+#define	STATS_WRITE_END(fs) {					\
+	FB_STORE_FENCE();						\
+	(fs)->fs_seq++;							\
+}
+
 #define	IS_FLOW_IOP(x) (x->fo_stats.fs_rcount + x->fo_stats.fs_wcount)
 #define	STAT_IOPS(x)   ((x->fs_rcount) + (x->fs_wcount))
 #define	IS_FLOW_ACTIVE(x) (x->fo_stats.fs_count)
@@ -33,9 +33,10 @@
 
 #ifdef HAVE_AIO
 typedef struct aiolist {
-	int		al_type;
-	struct aiolist	*al_next;
-	struct aiolist	*al_worknext;
+	int		al_type;	/* AL_READ or AL_WRITE */
+	int		al_done;	/* Completed, not yet retired */
+	struct flowop	*al_flowop;	/* Flowop that issued the IO */
+	hrtime_t	al_stime;	/* Time the IO was issued */
 	struct aiocb64	 al_aiocb;
 } aiolist_t;
 #endif
@@ -63,10 +64,21 @@ typedef struct threadflow {
 	filesetentry_t	*tf_fse[THREADFLOW_MAXFD + 1]; /* Thread local files */
 	int		tf_fdrotor;	/* Rotating fd within set */
 	struct flowstats	tf_stats;	/* Thread statistics */
+	struct ctlstats	tf_ctlstats;	/* Thread's share of process stats */
 	hrtime_t	tf_stime;	/* Start time of current flowop: used to measure the latency of the flowop */
+	fb_rand_t	tf_rand;	/* Generator for the thread's draws */
+	fb_randring_t	tf_randring;	/* Batched draws for I/O offsets */
 #ifdef HAVE_AIO
-	aiolist_t	*tf_aiolist;	/* List of async I/Os */
+	aiolist_t	**tf_aiolist;	/* Ring of async I/O slots */
+	int		tf_aioslots;	/* Number of slots in tf_aiolist */
+	int		tf_aiohead;	/* Oldest slot in use */
+	int		tf_aiocount;	/* Number of slots in use */
+	int		tf_aiomaxdepth;	/* Largest iodepth of async flowops */
 #endif
+#ifdef HAVE_IO_URING
+	struct fb_uring	*tf_uring;	/* io_uring of the thread */
+#endif
+	avd_t		tf_iodepth;	/* Max async I/Os in flight */
 	avd_t		tf_ioprio;	/* ioprio attribute */
 
 } threadflow_t;
@@ -292,6 +292,28 @@ avd_get_str(avd_t avd)
 	}
 }
 
+/*
+ * Returns TRUE if "avd" yields the same value on every get, that is
+ * unless it is bound to a random or a custom variable. Resolves avds
+ * pointing to variables whose type was not known yet.
+ */
+boolean_t
+avd_is_constant(avd_t avd)
+{
+	assert(avd);
+
+	if (avd->avd_type == AVD_VARVAL_UNKNOWN)
+		set_avd_type_by_var(avd, avd->avd_val.varptr, 1);
+
+	switch (avd->avd_type) {
+	case AVD_VARVAL_RANDOM:
+	case AVD_VARVAL_CUSTOM:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
 static avd_t
 avd_alloc_cmn(void)
 {
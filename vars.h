@@ -177,6 +177,7 @@ boolean_t avd_get_bool(avd_t);
 uint64_t avd_get_int(avd_t);
 double avd_get_dbl(avd_t);
 char *avd_get_str(avd_t);
+boolean_t avd_is_constant(avd_t);
 
 /* Local variables related */
 void avd_update(avd_t *avdp, var_t *lvar_list);